@@ -0,0 +1,65 @@
+#include "instrument.h"
+
+#ifdef INSTRUMENT
+
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+
+__thread InstrumentCounters instrument_counters;
+
+// Where INSTR_DUMP writes, stderr until instrument_open is called
+static FILE *instrument_out;
+
+static const char *phase_names[PHASE_COUNT] = { "load", "search", "path", "output" };
+
+static double instrument_now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+void instrument_open(const char *fname) {
+    FILE *f = fopen(fname, "a");
+    if (!f) {
+        fprintf(stderr, "Unable to open %s for instrumentation\n", fname);
+        return;
+    }
+    instrument_out = f;
+}
+
+void instrument_reset(void) {
+    memset(&instrument_counters, 0, sizeof(InstrumentCounters));
+}
+
+void instrument_phase_begin(InstrumentPhase phase) {
+    instrument_counters.phase_began[phase] = instrument_now();
+}
+
+void instrument_phase_end(InstrumentPhase phase) {
+    instrument_counters.phase_seconds[phase] += instrument_now() - instrument_counters.phase_began[phase];
+}
+
+void instrument_dump(const char *fields, ...) {
+    FILE *out = instrument_out ? instrument_out : stderr;
+    const InstrumentCounters *c = &instrument_counters;
+    // One line at a time when several threads dump
+    flockfile(out);
+    fputc('{', out);
+    va_list args;
+    va_start(args, fields);
+    vfprintf(out, fields, args);
+    va_end(args);
+    fprintf(out, "%s\"settled\":%ld,\"scanned\":%ld,\"relaxed\":%ld,\"pushes\":%ld,"
+                 "\"decrease_keys\":%ld,\"pops\":%ld,\"bytes_parsed\":%ld",
+            fields[0] ? "," : "", c->settled, c->scanned, c->relaxed, c->pushes,
+            c->decrease_keys, c->pops, c->bytes_parsed);
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        fprintf(out, ",\"%s_us\":%.2f", phase_names[p], c->phase_seconds[p] * 1e6);
+    }
+    fputs("}\n", out);
+    fflush(out);
+    funlockfile(out);
+}
+
+#endif
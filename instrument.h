@@ -0,0 +1,62 @@
+#ifndef INSTRUMENT_H_
+#define INSTRUMENT_H_
+
+#include <stdio.h>
+
+// Opt-in work counters and phase timers for the traversals
+// Build with -DINSTRUMENT (make INSTRUMENT=1) to turn them on, otherwise
+// every INSTR_ macro expands to nothing and costs nothing. Counters are
+// per thread, INSTR_RESET clears them and INSTR_DUMP writes them as one
+// JSON line to the file given to INSTR_OPEN, or stderr.
+
+typedef enum InstrumentPhase {
+    PHASE_LOAD,
+    PHASE_SEARCH,
+    PHASE_PATH, // path reconstruction
+    PHASE_OUTPUT,
+    PHASE_COUNT
+} InstrumentPhase;
+
+typedef struct InstrumentCounters {
+    long settled;       // nodes finalised or visited
+    long scanned;       // edges looked at
+    long relaxed;       // edges that improved a distance
+    long pushes;        // heap inserts
+    long decrease_keys; // heap key decreases
+    long pops;          // heap removals
+    long bytes_parsed;  // input read by the loaders
+    double phase_seconds[PHASE_COUNT];
+    double phase_began[PHASE_COUNT];
+} InstrumentCounters;
+
+#ifdef INSTRUMENT
+
+extern __thread InstrumentCounters instrument_counters;
+
+void instrument_open(const char *fname); // appends JSON lines to fname from now on
+void instrument_reset(void);
+void instrument_phase_begin(InstrumentPhase phase);
+void instrument_phase_end(InstrumentPhase phase);
+// writes {fields, counters, phase times} as one line, fields is a printf
+// format for the leading JSON members such as "\"start\":%d"
+void instrument_dump(const char *fields, ...);
+
+#define INSTR_OPEN(fname) instrument_open(fname)
+#define INSTR_RESET() instrument_reset()
+#define INSTR_ADD(counter, n) (instrument_counters.counter += (n))
+#define INSTR_PHASE_BEGIN(phase) instrument_phase_begin(phase)
+#define INSTR_PHASE_END(phase) instrument_phase_end(phase)
+#define INSTR_DUMP(...) instrument_dump(__VA_ARGS__)
+
+#else
+
+#define INSTR_OPEN(fname) ((void)0)
+#define INSTR_RESET() ((void)0)
+#define INSTR_ADD(counter, n) ((void)0)
+#define INSTR_PHASE_BEGIN(phase) ((void)0)
+#define INSTR_PHASE_END(phase) ((void)0)
+#define INSTR_DUMP(...) ((void)0)
+
+#endif
+
+#endif
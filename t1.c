@@ -1,15 +1,45 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "t1.h"
+#include "instrument.h"
 
-Node* create_node(int dest) {
-    // Allocate memory for new node
-    Node* new_node = (Node*)malloc(sizeof(Node));
-    // Check for failure
-    if (!new_node) {
-        fprintf(stderr, "Error: Memory allocation failed for new node.\n");
-        exit(EXIT_FAILURE);
+// Nodes the first slab holds, each new slab doubles up to the largest size
+#define FIRST_SLAB_NODES 256
+#define MAX_SLAB_NODES 65536
+
+// Take count consecutive nodes from the graph's newest slab, starting a new
+// slab when it hasn't got room
+static Node* alloc_nodes(Graph* g, int count) {
+    NodeSlab* slab = g->slabs;
+    if (!slab || slab->capacity - slab->used < count) {
+        int capacity = slab ? slab->capacity * 2 : FIRST_SLAB_NODES;
+        if (capacity > MAX_SLAB_NODES) {
+            capacity = MAX_SLAB_NODES;
+        }
+        // A bulk insert larger than a slab gets a slab of its own
+        if (capacity < count) {
+            capacity = count;
+        }
+        slab = (NodeSlab*)malloc(sizeof(NodeSlab) + (size_t)capacity * sizeof(Node));
+        // Check for failure
+        if (!slab) {
+            fprintf(stderr, "Error: Memory allocation failed for new node.\n");
+            exit(EXIT_FAILURE);
+        }
+        slab->capacity = capacity;
+        slab->used = 0;
+        slab->next = g->slabs;
+        g->slabs = slab;
     }
+    Node* nodes = slab->nodes + slab->used;
+    slab->used += count;
+    return nodes;
+}
+
+Node* create_node(Graph* g, int dest) {
+    // Take memory for the new node from the graph's slabs
+    Node* new_node = alloc_nodes(g, 1);
     // Set dest to arg and next to NULL
     new_node->dest = dest;
     new_node->next = NULL;
@@ -28,6 +58,8 @@ Graph* create_graph(int num_nodes) {
 
     // Set number of nodes based on argument
     graph->num_nodes = num_nodes;
+    // No slabs until the first edge
+    graph->slabs = NULL;
 
     // Memory for the adjacency list 
     graph->adjacency_list = (Node**)malloc(num_nodes * sizeof(Node*));
@@ -54,92 +86,374 @@ void add_edge(Graph* g, int from, int to) {
     }
 
     // Create a new node for the destination
-    Node* new_node = create_node(to);
+    Node* new_node = create_node(g, to);
 
     // Insert the new node at the beginning of the adjacency list
     new_node->next = g->adjacency_list[from];
     g->adjacency_list[from] = new_node;
 }
 
-void bfs(Graph* g, int origin) {
-    // Check graph is valid
-    if (!g) {
-        return;
+int add_edges(Graph* g, const int* from, const int* to, int count) {
+    if (!g || count <= 0) {
+        return 0;
     }
-    // Check origin is valud
-    if (origin < 0 || origin >= g->num_nodes) {
-        printf("Error: Invalid origin node for BFS.\n");
+
+    // One slab reservation for the whole batch
+    Node* nodes = alloc_nodes(g, count);
+    int added = 0;
+    int invalid = 0;
+    for (int i = 0; i < count; i++) {
+        if (from[i] < 0 || from[i] >= g->num_nodes || to[i] < 0 || to[i] >= g->num_nodes) {
+            invalid++;
+            continue;
+        }
+        // Same list order as calling add_edge for each edge in turn
+        Node* new_node = &nodes[added++];
+        new_node->dest = to[i];
+        new_node->next = g->adjacency_list[from[i]];
+        g->adjacency_list[from[i]] = new_node;
+    }
+    // Hand back the nodes the invalid edges didn't use
+    g->slabs->used -= invalid;
+    if (invalid) {
+        fprintf(stderr, "Error: Skipped %d edges with an invalid node index.\n", invalid);
+    }
+    return added;
+}
+
+// Make room in the context for num_nodes nodes
+static void grow_context(TraversalContext* ctx, int num_nodes) {
+    if (num_nodes > ctx->capacity) {
+        unsigned int* visited = (unsigned int*)realloc(ctx->visited, num_nodes * sizeof(unsigned int));
+        unsigned int* finished = (unsigned int*)realloc(ctx->finished, num_nodes * sizeof(unsigned int));
+        int* queue = (int*)realloc(ctx->queue, num_nodes * sizeof(int));
+        Node** edge = (Node**)realloc(ctx->edge, num_nodes * sizeof(Node*));
+        int* order = (int*)realloc(ctx->order, num_nodes * sizeof(int));
+        // Check for failure
+        if (!visited || !finished || !queue || !edge || !order) {
+            fprintf(stderr, "Error: Memory allocation failed for traversal context.\n");
+            exit(EXIT_FAILURE);
+        }
+        // New slots must not look visited
+        for (int i = ctx->capacity; i < num_nodes; i++) {
+            visited[i] = 0;
+            finished[i] = 0;
+        }
+        ctx->visited = visited;
+        ctx->finished = finished;
+        ctx->queue = queue;
+        ctx->edge = edge;
+        ctx->order = order;
+        ctx->capacity = num_nodes;
+    }
+}
+
+// Start a new traversal over num_nodes nodes, growing the context if needed
+static void begin_traversal(TraversalContext* ctx, int num_nodes) {
+    grow_context(ctx, num_nodes);
+
+    // Moving to a new epoch unvisits every node at once
+    ctx->epoch++;
+    if (ctx->epoch == 0) {
+        // Wrapped around, clear the stamps once so old ones can't match
+        for (int i = 0; i < ctx->capacity; i++) {
+            ctx->visited[i] = 0;
+            ctx->finished[i] = 0;
+        }
+        ctx->epoch = 1;
+    }
+}
+
+TraversalContext* create_context(int num_nodes) {
+    // Allocate memory for the context
+    TraversalContext* ctx = (TraversalContext*)malloc(sizeof(TraversalContext));
+    // Check for failure
+    if (!ctx) {
+        fprintf(stderr, "Error: Memory allocation failed for traversal context.\n");
+        exit(EXIT_FAILURE);
+    }
+    ctx->capacity = 0;
+    ctx->visited = NULL;
+    ctx->finished = NULL;
+    ctx->queue = NULL;
+    ctx->edge = NULL;
+    ctx->order = NULL;
+    ctx->epoch = 0;
+    begin_traversal(ctx, num_nodes);
+    return ctx;
+}
+
+void delete_context(TraversalContext* ctx) {
+    // Check context exists
+    if (!ctx) {
         return;
     }
+    free(ctx->visited);
+    free(ctx->finished);
+    free(ctx->queue);
+    free(ctx->edge);
+    free(ctx->order);
+    free(ctx);
+}
 
-    // Array to keep track of visited nodes
-    int visited[g->num_nodes];
-    for (int i = 0; i < g->num_nodes; i++) {
-        visited[i] = 0;
+int bfs_order(Graph* g, int origin, TraversalContext* ctx, int* order) {
+    // Check graph and origin are valid
+    if (!g || !ctx || origin < 0 || origin >= g->num_nodes) {
+        return -1;
     }
 
-    // Simple queue implementation using a fixed-size array
-    int queue[g->num_nodes];
+    INSTR_PHASE_BEGIN(PHASE_SEARCH);
+    begin_traversal(ctx, g->num_nodes);
+    unsigned int* visited = ctx->visited;
+    unsigned int epoch = ctx->epoch;
+
+    // Nodes leave the queue in the order they are visited, so the queue
+    // itself is the result
+    int* queue = order ? order : ctx->queue;
     int front = 0;
     int rear = 0;
 
     // Enqueue the origin node and mark it as visited
     queue[rear++] = origin;
-    visited[origin] = 1;
-
-    printf("BFS Traversal: ");
+    visited[origin] = epoch;
 
     while (front < rear) {
         // Dequeue the front node
         int current = queue[front++];
-
-        // Print the current node
-        printf("%c ", 'A' + current);
+        INSTR_ADD(settled, 1);
 
         // Traverse all adjacent nodes
         Node* temp = g->adjacency_list[current];
         while (temp) {
             int adj = temp->dest;
-            if (!visited[adj]) {
+            INSTR_ADD(scanned, 1);
+            if (visited[adj] != epoch) {
                 queue[rear++] = adj;
-                visited[adj] = 1;
+                visited[adj] = epoch;
             }
             temp = temp->next;
         }
     }
 
-    printf("\n");
+    INSTR_PHASE_END(PHASE_SEARCH);
+    return rear;
 }
 
-void dfs_util(Graph* g, int vertex, int* visited) {
-    // Mark the current node as visited and print it
-    visited[vertex] = 1;
-    printf("%c ", 'A' + vertex); // Convert index to character
+// Prints label and then every node of order as a letter, building the line
+// in memory so stdout is written once instead of once per node
+static void print_order(const char* label, const int* order, int count) {
+    size_t label_length = strlen(label);
+    char* line = (char*)malloc(label_length + 2 * (size_t)count + 1);
+    if (!line) {
+        fprintf(stderr, "Error: Memory allocation failed for traversal output.\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(line, label, label_length);
+    char* at = line + label_length;
+    for (int i = 0; i < count; i++) {
+        *at++ = 'A' + order[i];
+        *at++ = ' ';
+    }
+    *at++ = '\n';
+    fwrite(line, 1, at - line, stdout);
+    free(line);
+}
+
+void bfs_with_context(Graph* g, int origin, TraversalContext* ctx) {
+    // Check graph is valid
+    if (!g || !ctx) {
+        return;
+    }
+    // Check origin is valud
+    if (origin < 0 || origin >= g->num_nodes) {
+        printf("Error: Invalid origin node for BFS.\n");
+        return;
+    }
+
+    INSTR_RESET();
+    int count = bfs_order(g, origin, ctx, NULL);
 
-    for (Node* temp = g->adjacency_list[vertex]; temp; temp = temp->next) {
-        if (!visited[temp->dest]) {
-            dfs_util(g, temp->dest, visited);
+    // Print the nodes in the order they were visited
+    INSTR_PHASE_BEGIN(PHASE_OUTPUT);
+    print_order("BFS Traversal: ", ctx->queue, count);
+    INSTR_PHASE_END(PHASE_OUTPUT);
+    INSTR_DUMP("\"query\":\"bfs\",\"origin\":%d", origin);
+}
+
+void bfs(Graph* g, int origin) {
+    // Check graph is valid
+    if (!g) {
+        return;
+    }
+    TraversalContext* ctx = create_context(g->num_nodes);
+    bfs_with_context(g, origin, ctx);
+    delete_context(ctx);
+}
+
+// Depth first search from root with an explicit stack, so the depth of the
+// graph is not limited by the call stack. queue holds the nodes on the path
+// from root and edge[i] the next adjacency list entry queue[i] will try, which
+// visits nodes in the same order as recursing on each list entry would.
+// Returns 1 if an edge back to a node still on the stack was seen.
+static int dfs_visit(Graph* g, int root, TraversalContext* ctx, DfsResult* result, int* clock) {
+    unsigned int epoch = ctx->epoch;
+    int* stack = ctx->queue;
+    Node** edge = ctx->edge;
+    int depth = 0;
+    int back_edge = 0;
+
+    stack[depth] = root;
+    edge[depth++] = g->adjacency_list[root];
+    ctx->visited[root] = epoch;
+    INSTR_ADD(settled, 1);
+    if (result->preorder) {
+        result->preorder[result->count] = root;
+    }
+    if (result->discovery) {
+        result->discovery[root] = *clock;
+    }
+    if (result->parent) {
+        result->parent[root] = -1;
+    }
+    (*clock)++;
+    result->count++;
+
+    while (depth > 0) {
+        int vertex = stack[depth - 1];
+        Node* temp = edge[depth - 1];
+        if (!temp) {
+            // Every neighbour is done, so is this node
+            depth--;
+            ctx->finished[vertex] = epoch;
+            if (result->postorder) {
+                result->postorder[result->post_count] = vertex;
+            }
+            if (result->finish) {
+                result->finish[vertex] = *clock;
+            }
+            (*clock)++;
+            result->post_count++;
+            continue;
+        }
+        edge[depth - 1] = temp->next;
+        INSTR_ADD(scanned, 1);
+
+        int adj = temp->dest;
+        if (ctx->visited[adj] == epoch) {
+            // Visited but not finished means adj is on the stack
+            back_edge |= ctx->finished[adj] != epoch;
+            continue;
+        }
+        ctx->visited[adj] = epoch;
+        INSTR_ADD(settled, 1);
+        if (result->preorder) {
+            result->preorder[result->count] = adj;
+        }
+        if (result->discovery) {
+            result->discovery[adj] = *clock;
+        }
+        if (result->parent) {
+            result->parent[adj] = vertex;
         }
+        (*clock)++;
+        result->count++;
+        stack[depth] = adj;
+        edge[depth++] = g->adjacency_list[adj];
     }
+    return back_edge;
 }
 
-void dfs(Graph* g, int origin) {
-    if (!g || origin < 0 || origin >= g->num_nodes) {
+int dfs_order(Graph* g, int origin, TraversalContext* ctx, DfsResult* result) {
+    if (!g || !ctx || !result || origin < -1 || origin >= g->num_nodes) {
+        fprintf(stderr, "Error: Invalid origin node or graph for DFS.\n");
+        return -1;
+    }
+
+    begin_traversal(ctx, g->num_nodes);
+    result->count = 0;
+    result->post_count = 0;
+    result->has_cycle = 0;
+
+    int clock = 0;
+    if (origin >= 0) {
+        result->has_cycle = dfs_visit(g, origin, ctx, result, &clock);
+        return result->count;
+    }
+    // The whole graph, every node not reached yet starts a new tree
+    for (int root = 0; root < g->num_nodes; root++) {
+        if (ctx->visited[root] != ctx->epoch) {
+            result->has_cycle |= dfs_visit(g, root, ctx, result, &clock);
+        }
+    }
+    return result->count;
+}
+
+int has_cycle(Graph* g) {
+    // Check graph is valid
+    if (!g) {
+        return 0;
+    }
+    DfsResult result = { 0 };
+    TraversalContext* ctx = create_context(g->num_nodes);
+    dfs_order(g, -1, ctx, &result);
+    delete_context(ctx);
+    return result.has_cycle;
+}
+
+int topological_sort(Graph* g, int* order) {
+    // Check graph is valid
+    if (!g || !order) {
+        return 0;
+    }
+    DfsResult result = { 0 };
+    result.postorder = order;
+    TraversalContext* ctx = create_context(g->num_nodes);
+    dfs_order(g, -1, ctx, &result);
+    delete_context(ctx);
+    if (result.has_cycle) {
+        return 0;
+    }
+
+    // Every node finishes after everything it points to, so reversed
+    // postorder puts each node before its successors
+    for (int i = 0, j = g->num_nodes - 1; i < j; i++, j--) {
+        int temp = order[i];
+        order[i] = order[j];
+        order[j] = temp;
+    }
+    return 1;
+}
+
+void dfs_with_context(Graph* g, int origin, TraversalContext* ctx) {
+    if (!g || !ctx || origin < 0 || origin >= g->num_nodes) {
         printf("Error: Invalid origin node or graph for DFS.\n");
         return;
     }
 
-    int* visited = (int*)calloc(g->num_nodes, sizeof(int));
-    if (!visited) {
-        printf("Error: Memory allocation failed for visited array.\n");
-        exit(EXIT_FAILURE);
-    }
+    INSTR_RESET();
+    INSTR_PHASE_BEGIN(PHASE_SEARCH);
+    // The search uses queue as its stack, so the order goes in ctx->order
+    grow_context(ctx, g->num_nodes);
+    DfsResult result = { 0 };
+    result.preorder = ctx->order;
+    dfs_order(g, origin, ctx, &result);
+    INSTR_PHASE_END(PHASE_SEARCH);
 
-    printf("DFS Traversal: ");
-    dfs_util(g, origin, visited);
-    printf("\n");
+    INSTR_PHASE_BEGIN(PHASE_OUTPUT);
+    print_order("DFS Traversal: ", ctx->order, result.count);
+    INSTR_PHASE_END(PHASE_OUTPUT);
+    INSTR_DUMP("\"query\":\"dfs\",\"origin\":%d", origin);
+}
 
-    free(visited);
+void dfs(Graph* g, int origin) {
+    if (!g || origin < 0 || origin >= g->num_nodes) {
+        printf("Error: Invalid origin node or graph for DFS.\n");
+        return;
+    }
+
+    TraversalContext* ctx = create_context(g->num_nodes);
+    dfs_with_context(g, origin, ctx);
+    delete_context(ctx);
 }
 
 void delete_graph(Graph* g) {
@@ -148,14 +462,12 @@ void delete_graph(Graph* g) {
         return;
     }
 
-    // Free each node and free adjacency lists
-    for (int i = 0; i < g->num_nodes; i++) {
-        Node* current = g->adjacency_list[i];
-        while (current) {
-            Node* temp = current;
-            current = current->next;
-            free(temp);
-        }
+    // Nodes live in the slabs, freeing those frees every edge at once
+    NodeSlab* slab = g->slabs;
+    while (slab) {
+        NodeSlab* temp = slab;
+        slab = slab->next;
+        free(temp);
     }
 
     free(g->adjacency_list);
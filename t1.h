@@ -6,15 +6,70 @@ typedef struct Node {
     struct Node* next;
 } Node;
 
+// Block of list nodes, a graph takes its nodes from slabs instead of one
+// malloc per edge and frees them a slab at a time
+typedef struct NodeSlab {
+    struct NodeSlab* next; // older slab
+    int capacity;
+    int used;
+    Node nodes[];
+} NodeSlab;
+
 typedef struct Graph {
     int num_nodes;
     Node** adjacency_list;
+    NodeSlab* slabs; // newest first
 } Graph;
 
+// Reusable traversal state, a node counts as visited when its stamp equals
+// epoch so starting a new traversal doesn't have to clear anything
+typedef struct TraversalContext {
+    int capacity;
+    unsigned int *visited;
+    unsigned int *finished; // stamped like visited once DFS is done with a node
+    unsigned int epoch;
+    int *queue; // BFS queue, DFS stack
+    Node **edge; // next adjacency list entry of each DFS stack entry
+    int *order; // DFS order for dfs_with_context, the stack is in queue
+} TraversalContext;
+
+// What dfs_order records, every array is supplied by the caller and may be
+// NULL. preorder and postorder are filled up to count, the others are
+// indexed by node and only written for the nodes the search reached, so a
+// search costs nothing for the rest of the graph. Discovery
+// and finish times come from one clock that ticks on every discovery and
+// every finish.
+typedef struct DfsResult {
+    int *preorder; // nodes in the order they were discovered
+    int *postorder; // nodes in the order they were finished
+    int *discovery;
+    int *finish;
+    int *parent; // node the search came from, -1 for the roots
+    int count; // nodes reached
+    int post_count; // nodes finished, equal to count once the search returns
+    int has_cycle; // 1 if an edge led back to a node still being searched
+} DfsResult;
+
 Graph* create_graph(int num_nodes); // creates a graph with num_nodes nodes, assuming nodes are stored in alphabetical order (A, B, C..)
 void add_edge(Graph *g, int from, int to); // adds a directed edge
+int add_edges(Graph *g, const int *from, const int *to, int count); // adds from[i] -> to[i] for every i as add_edge would, returns the edges added
 void bfs(Graph* g, int origin); //implements breath first search and prints the results
 void dfs(Graph* g, int origin); //implements depth first search and prints the results
 void delete_graph(Graph *g); // Deletes graph
 
+TraversalContext* create_context(int num_nodes); // creates traversal state for graphs of up to num_nodes nodes, it grows if needed
+void delete_context(TraversalContext* ctx); // Deletes traversal state
+void bfs_with_context(Graph* g, int origin, TraversalContext* ctx); // bfs reusing ctx instead of allocating
+void dfs_with_context(Graph* g, int origin, TraversalContext* ctx); // dfs reusing ctx instead of allocating
+// breadth first search without printing, fills order (num_nodes entries, or
+// NULL to leave the order in ctx->queue) with the nodes in the order they
+// were visited. Returns the nodes reached, -1 if origin is invalid
+int bfs_order(Graph* g, int origin, TraversalContext* ctx, int* order);
+// depth first search without recursion or printing, origin -1 searches the
+// whole graph starting a new tree at each unreached node in index order.
+// Returns the nodes reached, -1 if origin is invalid
+int dfs_order(Graph* g, int origin, TraversalContext* ctx, DfsResult* result);
+int has_cycle(Graph* g); // returns 1 if the graph has a directed cycle
+int topological_sort(Graph* g, int* order); // fills order with every node before its successors, returns 0 if there is a cycle
+
 #endif
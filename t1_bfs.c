@@ -0,0 +1,330 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "t1_bfs.h"
+
+// Bitmap words (64 nodes each) or frontier nodes a thread takes at a time
+#define BFS_CHUNK_WORDS 16
+#define BFS_CHUNK_NODES 256
+// Nodes a thread collects before appending them to the next frontier
+#define BFS_FOUND_BLOCK 256
+// Frontiers with fewer out edges are expanded by a single thread
+#define BFS_SERIAL_EDGES 4096
+// Go bottom-up once the frontier has more than 1/ALPHA of the unexplored
+// edges, back to top-down once it holds less than 1/BETA of the nodes
+#define BFS_ALPHA 14
+#define BFS_BETA 24
+
+static void* checked_malloc(size_t size, const char* what) {
+    void* p = malloc(size ? size : 1);
+    // Check for failure
+    if (!p) {
+        fprintf(stderr, "Error: Memory allocation failed for %s.\n", what);
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+CsrGraph* create_csr(const Graph* g) {
+    int n = g->num_nodes;
+    CsrGraph* csr = (CsrGraph*)checked_malloc(sizeof(CsrGraph), "CSR graph");
+    csr->num_nodes = n;
+    csr->out_offsets = (int*)checked_malloc((n + 1) * sizeof(int), "CSR offsets");
+    csr->in_offsets = (int*)checked_malloc((n + 1) * sizeof(int), "CSR offsets");
+    memset(csr->out_offsets, 0, (n + 1) * sizeof(int));
+    memset(csr->in_offsets, 0, (n + 1) * sizeof(int));
+
+    // Count both degrees, then turn the counts into row starts
+    for (int u = 0; u < n; u++) {
+        for (Node* temp = g->adjacency_list[u]; temp; temp = temp->next) {
+            csr->out_offsets[u + 1]++;
+            csr->in_offsets[temp->dest + 1]++;
+        }
+    }
+    for (int u = 0; u < n; u++) {
+        csr->out_offsets[u + 1] += csr->out_offsets[u];
+        csr->in_offsets[u + 1] += csr->in_offsets[u];
+    }
+    csr->num_edges = csr->out_offsets[n];
+    csr->out_targets = (int*)checked_malloc(csr->num_edges * sizeof(int), "CSR edges");
+    csr->in_sources = (int*)checked_malloc(csr->num_edges * sizeof(int), "CSR edges");
+
+    // Sources are visited in increasing order, so every in row comes out sorted
+    int* cursor = (int*)checked_malloc(n * sizeof(int), "CSR cursor");
+    memcpy(cursor, csr->in_offsets, n * sizeof(int));
+    for (int u = 0; u < n; u++) {
+        int e = csr->out_offsets[u];
+        for (Node* temp = g->adjacency_list[u]; temp; temp = temp->next) {
+            csr->out_targets[e++] = temp->dest;
+            csr->in_sources[cursor[temp->dest]++] = u;
+        }
+    }
+    free(cursor);
+    return csr;
+}
+
+void delete_csr(CsrGraph* csr) {
+    // Check CSR exists
+    if (!csr) {
+        return;
+    }
+    free(csr->out_offsets);
+    free(csr->out_targets);
+    free(csr->in_offsets);
+    free(csr->in_sources);
+    free(csr);
+}
+
+// Shared by every thread of one search
+// The frontier is kept both as a list, read by the top-down steps, and as a
+// bitmap, read by the bottom-up steps.
+typedef struct BfsState {
+    const CsrGraph* csr;
+    int* level;
+    int* parent; // NULL when the caller doesn't want parents
+    int* queue; // nodes at level depth
+    int queue_size;
+    int* next_queue; // nodes found for level depth + 1
+    int next_size; // taken atomically
+    uint64_t* frontier;
+    uint64_t* next;
+    int num_words;
+    int depth;
+    int bottom_up;
+    int done;
+    int next_chunk; // next chunk of the step to hand out, taken atomically
+    long next_degree; // out edges of the nodes in next
+    long frontier_degree; // out edges of the nodes in the frontier
+    long unexplored; // out edges of nodes not reached yet
+    long reached;
+    pthread_barrier_t barrier;
+} BfsState;
+
+// Nodes a thread found, appended to next_queue in blocks
+typedef struct BfsFound {
+    int count;
+    long degree;
+    int nodes[BFS_FOUND_BLOCK];
+} BfsFound;
+
+static void flush_found(BfsState* s, BfsFound* found) {
+    int at = __atomic_fetch_add(&s->next_size, found->count, __ATOMIC_RELAXED);
+    memcpy(s->next_queue + at, found->nodes, found->count * sizeof(int));
+    found->count = 0;
+}
+
+static void add_found(BfsState* s, BfsFound* found, int v) {
+    if (found->count == BFS_FOUND_BLOCK) {
+        flush_found(s, found);
+    }
+    found->nodes[found->count++] = v;
+    found->degree += s->csr->out_offsets[v + 1] - s->csr->out_offsets[v];
+}
+
+// Expand the frontier nodes queue[i0..i1), several threads can find the same
+// node so level is claimed with a CAS and parent keeps the smallest candidate
+static void top_down(BfsState* s, int i0, int i1, BfsFound* found) {
+    const CsrGraph* csr = s->csr;
+    int next_level = s->depth + 1;
+    for (int i = i0; i < i1; i++) {
+        int u = s->queue[i];
+        for (int e = csr->out_offsets[u]; e < csr->out_offsets[u + 1]; e++) {
+            int v = csr->out_targets[e];
+            int lv = __atomic_load_n(&s->level[v], __ATOMIC_RELAXED);
+            if (lv == -1) {
+                if (__atomic_compare_exchange_n(&s->level[v], &lv, next_level, 0,
+                                                __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                    __atomic_fetch_or(&s->next[v >> 6], 1ULL << (v & 63), __ATOMIC_RELAXED);
+                    add_found(s, found, v);
+                    lv = next_level;
+                }
+            }
+            if (lv != next_level || !s->parent) {
+                continue;
+            }
+            int cur = __atomic_load_n(&s->parent[v], __ATOMIC_RELAXED);
+            while (u < cur && !__atomic_compare_exchange_n(&s->parent[v], &cur, u, 1,
+                                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            }
+        }
+    }
+}
+
+// Unvisited nodes of words [w0, w1) look for a parent in the frontier, each
+// node and word of next belongs to one thread so no atomics are needed
+static void bottom_up(BfsState* s, int w0, int w1, BfsFound* found) {
+    const CsrGraph* csr = s->csr;
+    int end = w1 * 64 < csr->num_nodes ? w1 * 64 : csr->num_nodes;
+    for (int v = w0 * 64; v < end; v++) {
+        if (s->level[v] != -1) {
+            continue;
+        }
+        // In rows are sorted, the first frontier node found is the smallest
+        for (int e = csr->in_offsets[v]; e < csr->in_offsets[v + 1]; e++) {
+            int u = csr->in_sources[e];
+            if (s->frontier[u >> 6] & (1ULL << (u & 63))) {
+                s->level[v] = s->depth + 1;
+                if (s->parent) {
+                    s->parent[v] = u;
+                }
+                s->next[v >> 6] |= 1ULL << (v & 63);
+                add_found(s, found, v);
+                break;
+            }
+        }
+    }
+}
+
+// One level, run by every thread taking chunks until none are left
+static void run_step(BfsState* s) {
+    BfsFound found;
+    found.count = 0;
+    found.degree = 0;
+    int units = s->bottom_up ? s->num_words : s->queue_size;
+    int chunk = s->bottom_up ? BFS_CHUNK_WORDS : BFS_CHUNK_NODES;
+    int i;
+    while ((i = __atomic_fetch_add(&s->next_chunk, chunk, __ATOMIC_RELAXED)) < units) {
+        int end = i + chunk < units ? i + chunk : units;
+        if (s->bottom_up) {
+            bottom_up(s, i, end, &found);
+        } else {
+            top_down(s, i, end, &found);
+        }
+    }
+    flush_found(s, &found);
+    __atomic_fetch_add(&s->next_degree, found.degree, __ATOMIC_RELAXED);
+}
+
+// Run by one thread between steps: make next the frontier and pick the
+// direction of the following step
+static void finish_step(BfsState* s) {
+    // Only the words holding frontier nodes need clearing
+    for (int i = 0; i < s->queue_size; i++) {
+        s->frontier[s->queue[i] >> 6] = 0;
+    }
+    uint64_t* old = s->frontier;
+    s->frontier = s->next;
+    s->next = old;
+    int* old_queue = s->queue;
+    s->queue = s->next_queue;
+    s->next_queue = old_queue;
+    s->queue_size = s->next_size;
+
+    s->reached += s->queue_size;
+    s->unexplored -= s->next_degree;
+    s->frontier_degree = s->next_degree;
+    if (!s->bottom_up && s->frontier_degree > s->unexplored / BFS_ALPHA) {
+        s->bottom_up = 1;
+    } else if (s->bottom_up && s->queue_size < s->csr->num_nodes / BFS_BETA) {
+        s->bottom_up = 0;
+    }
+    s->done = s->queue_size == 0;
+    s->depth++;
+    s->next_chunk = 0;
+    s->next_size = 0;
+    s->next_degree = 0;
+}
+
+static void* bfs_worker(void* arg) {
+    BfsState* s = (BfsState*)arg;
+    while (1) {
+        run_step(s);
+        // Every thread has finished the step, one of them sets up the next
+        if (pthread_barrier_wait(&s->barrier) == PTHREAD_BARRIER_SERIAL_THREAD) {
+            finish_step(s);
+            // Thin frontiers aren't worth waking the other threads for
+            while (!s->done && !s->bottom_up && s->frontier_degree < BFS_SERIAL_EDGES) {
+                run_step(s);
+                finish_step(s);
+            }
+        }
+        pthread_barrier_wait(&s->barrier);
+        if (s->done) {
+            return NULL;
+        }
+    }
+}
+
+int bfs_levels(const CsrGraph* csr, int origin, int threads, int* level, int* parent) {
+    // Check origin is valid
+    if (!csr || origin < 0 || origin >= csr->num_nodes) {
+        fprintf(stderr, "Error: Invalid origin node for BFS.\n");
+        return -1;
+    }
+    int n = csr->num_nodes;
+    if (threads < 1) {
+        threads = 1;
+    }
+
+    BfsState s;
+    s.csr = csr;
+    s.level = level ? level : (int*)checked_malloc(n * sizeof(int), "BFS levels");
+    s.parent = parent;
+    s.num_words = (n + 63) / 64;
+    s.queue = (int*)checked_malloc(n * sizeof(int), "BFS frontier");
+    s.next_queue = (int*)checked_malloc(n * sizeof(int), "BFS frontier");
+    s.frontier = (uint64_t*)checked_malloc(s.num_words * sizeof(uint64_t), "BFS frontier");
+    s.next = (uint64_t*)checked_malloc(s.num_words * sizeof(uint64_t), "BFS frontier");
+    memset(s.frontier, 0, s.num_words * sizeof(uint64_t));
+    memset(s.next, 0, s.num_words * sizeof(uint64_t));
+    for (int v = 0; v < n; v++) {
+        s.level[v] = -1;
+    }
+    if (parent) {
+        // Larger than any node so the first candidate always wins
+        for (int v = 0; v < n; v++) {
+            parent[v] = INT_MAX;
+        }
+        parent[origin] = -1;
+    }
+
+    // The origin is the first frontier
+    s.level[origin] = 0;
+    s.frontier[origin >> 6] = 1ULL << (origin & 63);
+    s.queue[0] = origin;
+    s.queue_size = 1;
+    s.next_size = 0;
+    s.depth = 0;
+    s.bottom_up = 0;
+    s.done = 0;
+    s.next_chunk = 0;
+    s.next_degree = 0;
+    s.frontier_degree = csr->out_offsets[origin + 1] - csr->out_offsets[origin];
+    s.unexplored = csr->num_edges - s.frontier_degree;
+    s.reached = 1;
+
+    // The calling thread is one of the workers
+    pthread_t* workers = (pthread_t*)checked_malloc(threads * sizeof(pthread_t), "BFS threads");
+    pthread_barrier_init(&s.barrier, NULL, threads);
+    for (int t = 1; t < threads; t++) {
+        if (pthread_create(&workers[t], NULL, bfs_worker, &s) != 0) {
+            fprintf(stderr, "Error: Unable to start BFS thread.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    bfs_worker(&s);
+    for (int t = 1; t < threads; t++) {
+        pthread_join(workers[t], NULL);
+    }
+    pthread_barrier_destroy(&s.barrier);
+    free(workers);
+
+    if (parent) {
+        for (int v = 0; v < n; v++) {
+            if (parent[v] == INT_MAX) {
+                parent[v] = -1;
+            }
+        }
+    }
+    if (!level) {
+        free(s.level);
+    }
+    free(s.queue);
+    free(s.next_queue);
+    free(s.frontier);
+    free(s.next);
+    return (int)s.reached;
+}
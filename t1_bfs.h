@@ -0,0 +1,30 @@
+#ifndef T1_BFS_H_
+#define T1_BFS_H_
+
+#include "t1.h"
+
+// Compressed sparse row copy of a t1 Graph for the large traversals
+// Out edges keep the adjacency list order, in edges are sorted by source
+// so the bottom-up steps find the smallest parent first.
+typedef struct CsrGraph {
+    int num_nodes;
+    int num_edges;
+    int *out_offsets; // edges of u are out_targets[out_offsets[u]..out_offsets[u + 1])
+    int *out_targets;
+    int *in_offsets;
+    int *in_sources;
+} CsrGraph;
+
+CsrGraph* create_csr(const Graph* g); // builds the CSR arrays from g's adjacency lists
+void delete_csr(CsrGraph* csr); // Deletes the CSR arrays
+
+// Breadth first search from origin on threads threads, switching between
+// top-down steps (expand the frontier) and bottom-up steps (unvisited nodes
+// look for a parent in the frontier) depending on which has less to scan.
+// level[v] is the hop count from origin or -1 if v is unreachable, parent[v]
+// is the smallest numbered node one level closer, -1 for origin and
+// unreachable nodes. Either array may be NULL. Returns the nodes reached,
+// -1 if origin is invalid.
+int bfs_levels(const CsrGraph* csr, int origin, int threads, int* level, int* parent);
+
+#endif
@@ -1,4 +1,7 @@
+#include <stdio.h>
+#include <stdlib.h>
 #include "t1.h"
+#include "t1_bfs.h"
 
 // converts an upper case character (A-Z) to a numerical value (between 0 and 25) 
 static int char2val ( char c ) {
@@ -9,6 +12,231 @@ static int char2val ( char c ) {
 	return c-'A';
 }
 
+// Graph with num_edges random edges, duplicates and self loops included
+static Graph* random_graph(int num_nodes, int num_edges) {
+    Graph* g = create_graph(num_nodes);
+    for (int i = 0; i < num_edges; i++) {
+        add_edge(g, rand() % num_nodes, rand() % num_nodes);
+    }
+    return g;
+}
+
+// bfs_levels against bfs_order: same nodes reached, levels one more than
+// the level of the node that found them, and the smallest parent one level up
+static int check_bfs_levels(Graph* g, int origin, int threads) {
+    int n = g->num_nodes;
+    int* order = (int*)malloc(n * sizeof(int));
+    int* expected = (int*)malloc(n * sizeof(int));
+    int* level = (int*)malloc(n * sizeof(int));
+    int* parent = (int*)malloc(n * sizeof(int));
+    if (!order || !expected || !level || !parent) {
+        fprintf(stderr, "Error: Memory allocation failed for test.\n");
+        exit(EXIT_FAILURE);
+    }
+    TraversalContext* ctx = create_context(n);
+    int count = bfs_order(g, origin, ctx, order);
+    delete_context(ctx);
+    for (int v = 0; v < n; v++) {
+        expected[v] = -1;
+    }
+    expected[origin] = 0;
+    for (int i = 0; i < count; i++) {
+        for (Node* temp = g->adjacency_list[order[i]]; temp; temp = temp->next) {
+            if (expected[temp->dest] < 0) {
+                expected[temp->dest] = expected[order[i]] + 1;
+            }
+        }
+    }
+
+    CsrGraph* csr = create_csr(g);
+    int reached = bfs_levels(csr, origin, threads, level, parent);
+    delete_csr(csr);
+    int ok = reached == count;
+    for (int v = 0; v < n && ok; v++) {
+        ok = level[v] == expected[v];
+    }
+    for (int u = 0; u < n && ok; u++) {
+        for (Node* temp = g->adjacency_list[u]; temp && ok; temp = temp->next) {
+            int v = temp->dest;
+            // u would be a parent of v, there must be no smaller one
+            if (v != origin && expected[u] >= 0 && expected[u] + 1 == expected[v]) {
+                ok = parent[v] >= 0 && parent[v] <= u;
+            }
+        }
+    }
+    for (int v = 0; v < n && ok; v++) {
+        int p = parent[v];
+        ok = v == origin || expected[v] < 0 ? p == -1 : p >= 0 && expected[p] + 1 == expected[v];
+    }
+
+    free(order);
+    free(expected);
+    free(level);
+    free(parent);
+    return ok;
+}
+
+// Random graph whose edges all go from a lower to a higher position of a
+// shuffled node order, so it has no cycle
+static Graph* random_dag(int num_nodes, int num_edges) {
+    int* rank = (int*)malloc(num_nodes * sizeof(int));
+    if (!rank) {
+        fprintf(stderr, "Error: Memory allocation failed for test.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < num_nodes; i++) {
+        rank[i] = i;
+    }
+    for (int i = num_nodes - 1; i > 0; i--) {
+        int j = rand() % (i + 1);
+        int temp = rank[i];
+        rank[i] = rank[j];
+        rank[j] = temp;
+    }
+    Graph* g = create_graph(num_nodes);
+    for (int i = 0; i < num_edges && num_nodes > 1; i++) {
+        int a = rand() % num_nodes;
+        int b = rand() % num_nodes;
+        if (a != b) {
+            add_edge(g, rank[a < b ? a : b], rank[a < b ? b : a]);
+        }
+    }
+    free(rank);
+    return g;
+}
+
+// The recursive search dfs used to run, the order the printed DFS must keep
+static void reference_dfs(Graph* g, int vertex, int* seen, int* order, int* count) {
+    seen[vertex] = 1;
+    order[(*count)++] = vertex;
+    for (Node* temp = g->adjacency_list[vertex]; temp; temp = temp->next) {
+        if (!seen[temp->dest]) {
+            reference_dfs(g, temp->dest, seen, order, count);
+        }
+    }
+}
+
+// dfs_order from origin visits nodes in the recursive order, and over the
+// whole graph reaches every node once. has_cycle agrees with
+// topological_sort, whose order puts every edge forward.
+static int check_dfs(Graph* g, int origin) {
+    int n = g->num_nodes;
+    int* seen = (int*)calloc(n, sizeof(int));
+    int* expected = (int*)malloc(n * sizeof(int));
+    int* preorder = (int*)malloc(n * sizeof(int));
+    int* parent = (int*)malloc(n * sizeof(int));
+    int* position = (int*)malloc(n * sizeof(int));
+    if (!seen || !expected || !preorder || !parent || !position) {
+        fprintf(stderr, "Error: Memory allocation failed for test.\n");
+        exit(EXIT_FAILURE);
+    }
+    TraversalContext* ctx = create_context(n);
+    DfsResult result = { 0 };
+    result.preorder = preorder;
+    result.parent = parent;
+
+    int count = 0;
+    reference_dfs(g, origin, seen, expected, &count);
+    int ok = dfs_order(g, origin, ctx, &result) == count;
+    for (int i = 0; i < count && ok; i++) {
+        ok = preorder[i] == expected[i];
+    }
+
+    for (int v = 0; v < n; v++) {
+        seen[v] = 0;
+    }
+    ok = ok && dfs_order(g, -1, ctx, &result) == n && result.post_count == n;
+    for (int i = 0; i < n && ok; i++) {
+        int v = preorder[i];
+        ok = !seen[v] && (parent[v] == -1 || seen[parent[v]]);
+        seen[v] = 1;
+    }
+
+    int sorted = topological_sort(g, expected);
+    ok = ok && sorted == !has_cycle(g) && sorted == !result.has_cycle;
+    if (ok && sorted) {
+        for (int i = 0; i < n; i++) {
+            position[expected[i]] = i;
+        }
+        for (int u = 0; u < n && ok; u++) {
+            for (Node* temp = g->adjacency_list[u]; temp && ok; temp = temp->next) {
+                ok = position[u] < position[temp->dest];
+            }
+        }
+    }
+
+    delete_context(ctx);
+    free(seen);
+    free(expected);
+    free(preorder);
+    free(parent);
+    free(position);
+    return ok;
+}
+
+// add_edges in batches of the given sizes against one add_edge per edge.
+// Both graphs must end up with the same adjacency lists, so the same BFS
+// and DFS orders.
+static int check_add_edges(int num_nodes, const int* batches, int num_batches) {
+    int count = 0;
+    for (int b = 0; b < num_batches; b++) {
+        count += batches[b];
+    }
+    int* from = (int*)malloc(count * sizeof(int));
+    int* to = (int*)malloc(count * sizeof(int));
+    int* order = (int*)malloc(num_nodes * sizeof(int));
+    int* bulk_order = (int*)malloc(num_nodes * sizeof(int));
+    if (!from || !to || !order || !bulk_order) {
+        fprintf(stderr, "Error: Memory allocation failed for test.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < count; i++) {
+        from[i] = rand() % num_nodes;
+        to[i] = rand() % num_nodes;
+    }
+    Graph* single = create_graph(num_nodes);
+    Graph* bulk = create_graph(num_nodes);
+    for (int i = 0; i < count; i++) {
+        add_edge(single, from[i], to[i]);
+    }
+    int ok = 1;
+    for (int b = 0, i = 0; b < num_batches; i += batches[b++]) {
+        ok = ok && add_edges(bulk, from + i, to + i, batches[b]) == batches[b];
+    }
+
+    for (int u = 0; u < num_nodes && ok; u++) {
+        Node* a = single->adjacency_list[u];
+        Node* b = bulk->adjacency_list[u];
+        while (a && b && a->dest == b->dest) {
+            a = a->next;
+            b = b->next;
+        }
+        ok = !a && !b;
+    }
+    TraversalContext* ctx = create_context(num_nodes);
+    DfsResult result = { 0 };
+    DfsResult bulk_result = { 0 };
+    result.preorder = order;
+    bulk_result.preorder = bulk_order;
+    int origin = rand() % num_nodes;
+    for (int dfs = 0; dfs <= 1 && ok; dfs++) {
+        int reached = dfs ? dfs_order(single, origin, ctx, &result) : bfs_order(single, origin, ctx, order);
+        ok = reached == (dfs ? dfs_order(bulk, origin, ctx, &bulk_result) : bfs_order(bulk, origin, ctx, bulk_order));
+        for (int i = 0; i < reached && ok; i++) {
+            ok = order[i] == bulk_order[i];
+        }
+    }
+
+    delete_context(ctx);
+    delete_graph(single);
+    delete_graph(bulk);
+    free(from);
+    free(to);
+    free(order);
+    free(bulk_order);
+    return ok;
+}
+
 int main(){
     int num_nodes = 6;
     Graph *graph = create_graph(num_nodes);
@@ -29,4 +257,65 @@ int main(){
 
     delete_graph(graph);
 
+    int failed = 0;
+    srand(1);
+    // Sparse graphs leave nodes unreached, dense ones take bottom-up steps
+    int sizes[][2] = { { 10, 15 }, { 1000, 800 }, { 5000, 20000 }, { 20000, 400000 } };
+    for (int s = 0; s < 4; s++) {
+        Graph* g = random_graph(sizes[s][0], sizes[s][1]);
+        for (int threads = 1; threads <= 4; threads += 3) {
+            if (!check_bfs_levels(g, rand() % g->num_nodes, threads)) {
+                printf("bfs_levels differs from bfs_order: %d nodes, %d edges, %d threads\n", sizes[s][0], sizes[s][1], threads);
+                failed++;
+            }
+        }
+        delete_graph(g);
+    }
+
+    // Chains deeper than the call stack would allow, a DAG and a cycle
+    int chain = 1000000;
+    for (int cyclic = 0; cyclic <= 1; cyclic++) {
+        Graph* g = create_graph(chain);
+        for (int v = 0; v + 1 < chain; v++) {
+            add_edge(g, v, v + 1);
+        }
+        if (cyclic) {
+            add_edge(g, chain - 1, 0);
+        }
+        int* order = (int*)malloc(chain * sizeof(int));
+        if (!order) {
+            fprintf(stderr, "Error: Memory allocation failed for test.\n");
+            exit(EXIT_FAILURE);
+        }
+        if (has_cycle(g) != cyclic || topological_sort(g, order) != !cyclic || (!cyclic && order[0] != 0)) {
+            printf("DFS is wrong on a chain of %d nodes%s\n", chain, cyclic ? " with a cycle" : "");
+            failed++;
+        }
+        free(order);
+        delete_graph(g);
+    }
+    for (int s = 0; s < 4; s++) {
+        for (int dag = 0; dag <= 1; dag++) {
+            Graph* g = dag ? random_dag(sizes[s][0], sizes[s][1]) : random_graph(sizes[s][0], sizes[s][1]);
+            if (!check_dfs(g, rand() % g->num_nodes)) {
+                printf("DFS checks fail on a %s: %d nodes, %d edges\n", dag ? "DAG" : "graph", sizes[s][0], sizes[s][1]);
+                failed++;
+            }
+            delete_graph(g);
+        }
+    }
+
+    // Batches that fit the slab in use, cross into the next one and
+    // outgrow the largest slab
+    int batches[] = { 1, 200, 100, 255, 256, 1000, 70000, 3, 5000 };
+    int num_batches = sizeof(batches) / sizeof(batches[0]);
+    for (int b = 1; b <= num_batches; b++) {
+        if (!check_add_edges(b < num_batches ? 50 : 20000, batches, b)) {
+            printf("add_edges differs from add_edge with %d batches\n", b);
+            failed++;
+        }
+    }
+
+    printf("%s\n", failed ? "Checks FAILED" : "Checks passed");
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
 }
@@ -1,8 +1,26 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <limits.h>
 #include <stdbool.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#endif
 #include "t2.h"
+#include "instrument.h"
+
+// Aligned, zeroed block of count ints, count a multiple of ROW_ALIGN
+static int* alloc_row_aligned(size_t count) {
+    int* p = (int*)aligned_alloc(ROW_ALIGN * sizeof(int), count * sizeof(int));
+    // Check for failure
+    if (!p) {
+        printf("Memory allocation for graph failed\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(p, 0, count * sizeof(int));
+    return p;
+}
 
 Graph* create_graph(int num_nodes) {
     // Allocate memory for graph
@@ -14,12 +32,9 @@ Graph* create_graph(int num_nodes) {
     }
     // Set number of nodes
     g->num_nodes = num_nodes;
-
-    for (int i = 0; i < num_nodes; i++) {
-        for (int j = 0; j < num_nodes; j++) {
-            g->adj_matrix[i][j] = 0;
-        }
-    }
+    // Padding entries stay 0, no edge
+    g->stride = (num_nodes + ROW_ALIGN - 1) / ROW_ALIGN * ROW_ALIGN;
+    g->adj_matrix = alloc_row_aligned((size_t)num_nodes * g->stride + ROW_ALIGN);
     return g;
 }
 
@@ -29,80 +44,295 @@ void add_edge(Graph* g, int from, int to, int weight) {
         return;
     }
     // Both directions
-    g->adj_matrix[from][to] = weight;
-    g->adj_matrix[to][from] = weight;
+    g->adj_matrix[(size_t)from * g->stride + to] = weight;
+    g->adj_matrix[(size_t)to * g->stride + from] = weight;
 }
 
-void print_solution(int dist[], int perm_order[], int num_nodes, int origin) {
-    printf("Nodes in Graph: ");
-    for (int i = 0; i < num_nodes; i++) {
-        printf("%c ", 'A' + perm_order[i]);
+// Longest "- Shortest path A to B: -2147483648\n" line
+#define SOLUTION_LINE_MAX 40
+
+// Formats the whole report in memory and writes it with one fwrite, so
+// stdout is locked once instead of once per node
+void print_solution(int dist[], int perm_order[], int perm_count, int num_nodes, int origin) {
+    size_t capacity = 64 + 2 * (size_t)perm_count + SOLUTION_LINE_MAX * (size_t)num_nodes;
+    char* report = (char*)malloc(capacity);
+    if (!report) {
+        printf("Memory allocation for output failed\n");
+        exit(EXIT_FAILURE);
+    }
+    size_t used = 0;
+    used += snprintf(report + used, capacity - used, "Nodes in Graph: ");
+    for (int i = 0; i < perm_count; i++) {
+        report[used++] = 'A' + perm_order[i];
+        report[used++] = ' ';
     }
-    printf("\n");
-    printf("Dijkstra's Algorithm Finds: \n");
+    used += snprintf(report + used, capacity - used, "\nDijkstra's Algorithm Finds: \n");
     for (int i = 0; i < num_nodes; i++) {
-        printf("- Shortest path %c to %c: %d\n", 'A' + origin, 'A' + i, dist[i]);
+        used += snprintf(report + used, capacity - used, "- Shortest path %c to %c: %d\n",
+                         'A' + origin, 'A' + i, dist[i]);
     }
+    fwrite(report, 1, used, stdout);
+    free(report);
 }
 
-void dijkstra(Graph* g, int origin) {
-    int num_nodes = g->num_nodes;
-    // Set arrays to keep track of finalization
-    // And distance to node relative to given origin
-    int dist[MAX_VERTICES];
-    bool sptSet[MAX_VERTICES];
-    // Order of finalized nodes
-    int perm_order[MAX_VERTICES];
-    // We have finalized none to start
-    int perm_count = 0;
+/* ---------- dense kernels ----------
+ * The search keeps one key per node: its tentative distance while it is
+ * open (INT_MAX if not reached yet) and INT_MIN once it is permanent.
+ * Compared as unsigned, permanent nodes sort above every open one, so the
+ * next node is the unsigned minimum unless that is INT_MAX or more. Compared
+ * as signed, no path is shorter than INT_MIN, so relaxing a whole row never
+ * touches permanent nodes.
+ */
 
-    for (int i = 0; i < num_nodes; i++) {
-        // Infinite distance
-        dist[i] = INT_MAX;
-        // Not finalized
-        sptSet[i] = false;
+typedef struct DenseKernel {
+    const char* name;
+    // First node with the smallest open key, -1 if none is reachable
+    int (*select)(const int* key, int stride);
+    // key[v] = min(key[v], du + row[v]) over the edges of row, returns the
+    // number of keys lowered
+    int (*relax)(int* key, const int* row, int du, int stride);
+} DenseKernel;
+
+static int select_scalar(const int* key, int stride) {
+    unsigned int min_key = INT_MAX;
+    int u = -1;
+    // We must find the closest unfinalized node
+    for (int v = 0; v < stride; v++) {
+        if ((unsigned int)key[v] < min_key) {
+            min_key = key[v];
+            u = v;
+        }
     }
-    // Distance to origin is zero
-    dist[origin] = 0;
-
-    for (int count = 0; count < num_nodes; count++) {
-        int min_dist = INT_MAX, u = -1;
-        // We must find the closest unfinalized node
-        for (int v = 0; v < num_nodes; v++) {
-            if (!sptSet[v] && dist[v] < min_dist) {
-                // Get distance to node
-                min_dist = dist[v];
-                u = v;
-            }
+    return u;
+}
+
+static int relax_scalar(int* key, const int* row, int du, int stride) {
+    int relaxed = 0;
+    for (int v = 0; v < stride; v++) {
+        // Check edge exists and the node is actually reachable through it
+        if (row[v] != 0 && row[v] != INT_MAX &&
+            // If the distance through that path is smaller than our
+            // Current shortest path then update it
+            du + row[v] < key[v]) {
+            key[v] = du + row[v];
+            relaxed++;
+        }
+    }
+    return relaxed;
+}
+
+#ifdef HAVE_X86_KERNELS
+
+__attribute__((target("sse4.1")))
+static int select_sse41(const int* key, int stride) {
+    __m128i low = _mm_set1_epi32(-1);
+    for (int v = 0; v < stride; v += 4) {
+        low = _mm_min_epu32(low, _mm_load_si128((const __m128i*)(key + v)));
+    }
+    low = _mm_min_epu32(low, _mm_shuffle_epi32(low, 0x4E));
+    low = _mm_min_epu32(low, _mm_shuffle_epi32(low, 0xB1));
+    unsigned int min_key = (unsigned int)_mm_cvtsi128_si32(low);
+    if (min_key >= INT_MAX) {
+        return -1;
+    }
+    // Second pass for the first node holding it, same choice as the scalar scan
+    __m128i want = _mm_set1_epi32((int)min_key);
+    for (int v = 0; v < stride; v += 4) {
+        __m128i hit = _mm_cmpeq_epi32(_mm_load_si128((const __m128i*)(key + v)), want);
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(hit));
+        if (mask) {
+            return v + __builtin_ctz(mask);
         }
+    }
+    return -1;
+}
+
+__attribute__((target("sse4.1")))
+static int relax_sse41(int* key, const int* row, int du, int stride) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i none = _mm_set1_epi32(INT_MAX);
+    const __m128i base = _mm_set1_epi32(du);
+    int relaxed = 0;
+    for (int v = 0; v < stride; v += 4) {
+        __m128i w = _mm_load_si128((const __m128i*)(row + v));
+        __m128i k = _mm_load_si128((__m128i*)(key + v));
+        __m128i through = _mm_add_epi32(base, w);
+        __m128i shorter = _mm_cmpgt_epi32(k, through);
+        __m128i missing = _mm_or_si128(_mm_cmpeq_epi32(w, zero), _mm_cmpeq_epi32(w, none));
+        __m128i better = _mm_andnot_si128(missing, shorter);
+        _mm_store_si128((__m128i*)(key + v), _mm_blendv_epi8(k, through, better));
+        relaxed += __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(better)));
+    }
+    return relaxed;
+}
 
-        // If NO node found that is not finalized
-        // Then we should break since nothing more can be done
-        if (u == -1) { 
-            break;
+__attribute__((target("avx2")))
+static int select_avx2(const int* key, int stride) {
+    __m256i low = _mm256_set1_epi32(-1);
+    for (int v = 0; v < stride; v += 8) {
+        low = _mm256_min_epu32(low, _mm256_load_si256((const __m256i*)(key + v)));
+    }
+    __m128i half = _mm_min_epu32(_mm256_castsi256_si128(low), _mm256_extracti128_si256(low, 1));
+    half = _mm_min_epu32(half, _mm_shuffle_epi32(half, 0x4E));
+    half = _mm_min_epu32(half, _mm_shuffle_epi32(half, 0xB1));
+    unsigned int min_key = (unsigned int)_mm_cvtsi128_si32(half);
+    if (min_key >= INT_MAX) {
+        return -1;
+    }
+    __m256i want = _mm256_set1_epi32((int)min_key);
+    for (int v = 0; v < stride; v += 8) {
+        __m256i hit = _mm256_cmpeq_epi32(_mm256_load_si256((const __m256i*)(key + v)), want);
+        int mask = _mm256_movemask_ps(_mm256_castsi256_ps(hit));
+        if (mask) {
+            return v + __builtin_ctz(mask);
         }
+    }
+    return -1;
+}
+
+__attribute__((target("avx2")))
+static int relax_avx2(int* key, const int* row, int du, int stride) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i none = _mm256_set1_epi32(INT_MAX);
+    const __m256i base = _mm256_set1_epi32(du);
+    int relaxed = 0;
+    for (int v = 0; v < stride; v += 8) {
+        __m256i w = _mm256_load_si256((const __m256i*)(row + v));
+        __m256i k = _mm256_load_si256((__m256i*)(key + v));
+        __m256i through = _mm256_add_epi32(base, w);
+        __m256i shorter = _mm256_cmpgt_epi32(k, through);
+        __m256i missing = _mm256_or_si256(_mm256_cmpeq_epi32(w, zero), _mm256_cmpeq_epi32(w, none));
+        __m256i better = _mm256_andnot_si256(missing, shorter);
+        _mm256_store_si256((__m256i*)(key + v), _mm256_blendv_epi8(k, through, better));
+        relaxed += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(better)));
+    }
+    return relaxed;
+}
+
+#endif
+
+// Widest first, the first one the CPU supports is the default
+static const DenseKernel kernels[] = {
+#ifdef HAVE_X86_KERNELS
+    { "avx2", select_avx2, relax_avx2 },
+    { "sse4.1", select_sse41, relax_sse41 },
+#endif
+    { "scalar", select_scalar, relax_scalar },
+};
+#define NUM_KERNELS ((int)(sizeof(kernels) / sizeof(kernels[0])))
+
+static const DenseKernel* kernel;
+
+static int kernel_supported(const DenseKernel* k) {
+#ifdef HAVE_X86_KERNELS
+    __builtin_cpu_init();
+    if (strcmp(k->name, "avx2") == 0) {
+        return __builtin_cpu_supports("avx2");
+    }
+    if (strcmp(k->name, "sse4.1") == 0) {
+        return __builtin_cpu_supports("sse4.1");
+    }
+#endif
+    (void)k;
+    return 1;
+}
+
+static const DenseKernel* current_kernel(void) {
+    for (int i = 0; !kernel && i < NUM_KERNELS; i++) {
+        if (kernel_supported(&kernels[i])) {
+            kernel = &kernels[i];
+        }
+    }
+    return kernel;
+}
+
+const char* dijkstra_kernel(void) {
+    return current_kernel()->name;
+}
+
+int set_dijkstra_kernel(const char* name) {
+    for (int i = 0; i < NUM_KERNELS; i++) {
+        if (strcmp(kernels[i].name, name) == 0 && kernel_supported(&kernels[i])) {
+            kernel = &kernels[i];
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int dijkstra_distances(Graph* g, int origin, int* dist, int* perm_order) {
+    int num_nodes = g->num_nodes;
+    if (origin < 0 || origin >= num_nodes) {
+        printf("Invalid origin node\n");
+        return -1;
+    }
+    const DenseKernel* k = current_kernel();
+    // Open and permanent nodes in one array, see the kernels above
+    // Padding counts as permanent so the kernels can read whole vectors
+    int* key = alloc_row_aligned(g->stride);
+    for (int i = 0; i < g->stride; i++) {
+        // Infinite distance, not finalized
+        key[i] = i < num_nodes ? INT_MAX : INT_MIN;
+        if (i < num_nodes) {
+            dist[i] = INT_MAX;
+        }
+    }
+    // Distance to origin is zero
+    key[origin] = 0;
+    // We have finalized none to start
+    int perm_count = 0;
+
+    INSTR_PHASE_BEGIN(PHASE_SEARCH);
+    int u;
+    // Stops when no node that is not finalized can be reached
+    while ((u = k->select(key, g->stride)) != -1) {
         // Set as finalized
-        sptSet[u] = true;
+        dist[u] = key[u];
+        key[u] = INT_MIN;
+        INSTR_ADD(settled, 1);
+        // The matrix row is read whole, every entry counts as looked at
+        INSTR_ADD(scanned, num_nodes);
         // Add to perm array
-        perm_order[perm_count++] = u;
-
-        for (int v = 0; v < num_nodes; v++) {
-            // Check node isnt finalized and edge exists
-            if (!sptSet[v] && g->adj_matrix[u][v] != 0 && 
-                // Check node is actually reachable
-                g->adj_matrix[u][v] != INT_MAX &&
-                // If the distance through that path is smaller than our
-                // Current shortest path then update it
-                dist[u] + g->adj_matrix[u][v] < dist[v]) {
-                // Set new distance
-                dist[v] = dist[u] + g->adj_matrix[u][v];
-            }
+        if (perm_order) {
+            perm_order[perm_count] = u;
         }
+        perm_count++;
+
+        int relaxed = k->relax(key, g->adj_matrix + (size_t)u * g->stride, dist[u], g->stride);
+        INSTR_ADD(relaxed, relaxed);
+        (void)relaxed;
     }
-    // Print final solution
-    print_solution(dist, perm_order, num_nodes, origin);
+    INSTR_PHASE_END(PHASE_SEARCH);
+    free(key);
+    return perm_count;
+}
+
+void dijkstra(Graph* g, int origin) {
+    int* dist = (int*)malloc(g->num_nodes * sizeof(int));
+    // Order of finalized nodes
+    int* perm_order = (int*)malloc(g->num_nodes * sizeof(int));
+    if (!dist || !perm_order) {
+        printf("Memory allocation for dijkstra failed\n");
+        exit(EXIT_FAILURE);
+    }
+    INSTR_RESET();
+    int perm_count = dijkstra_distances(g, origin, dist, perm_order);
+    if (perm_count >= 0) {
+        // Print final solution
+        INSTR_PHASE_BEGIN(PHASE_OUTPUT);
+        print_solution(dist, perm_order, perm_count, g->num_nodes, origin);
+        INSTR_PHASE_END(PHASE_OUTPUT);
+        INSTR_DUMP("\"query\":\"dijkstra\",\"origin\":%d", origin);
+    }
+    free(dist);
+    free(perm_order);
 }
 
 void delete_graph(Graph* g) {
+    // Check graph exists
+    if (!g) {
+        return;
+    }
+    free(g->adj_matrix);
     free(g);
 }
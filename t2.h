@@ -1,16 +1,28 @@
 #ifndef T2_H_
 #define T2_H_
 
-#define MAX_VERTICES 10 // you can assume that the graph has at most 10 vertex
+// Rows are padded to a multiple of this many entries (32 bytes) and the
+// matrix is 32 byte aligned, so every row can be read with whole vectors
+#define ROW_ALIGN 8
+
 typedef struct Graph{
     int num_nodes;
-    int adj_matrix[MAX_VERTICES][MAX_VERTICES];
+    int stride; // entries per row, num_nodes rounded up to ROW_ALIGN
+    int *adj_matrix; // weight from i to j at adj_matrix[i * stride + j], 0 if there is no edge
 } Graph;
 
 Graph* create_graph(int num_nodes); // creates a graph with num_nodes nodes, assuming nodes are stored in alphabetical order (A, B, C..)
 void add_edge(Graph *g, int from, int to, int weight); // adds an undirected weighted edge between from and to
 
 void dijkstra(Graph* g, int origin); // implements the dijkstra algorithm and prints the order in which the nodes are made permament, and the length of the shortest path between the origin node and all the other nodes
+// dijkstra without printing: fills dist (INT_MAX if unreachable) and, unless
+// it is NULL, perm_order with the nodes in the order they were made
+// permanent. Returns the number of permanent nodes, -1 if origin is invalid
+int dijkstra_distances(Graph* g, int origin, int* dist, int* perm_order);
+// Vector width used by dijkstra: "avx2", "sse4.1" or "scalar", picked from
+// what the CPU supports unless set_dijkstra_kernel chose one
+const char* dijkstra_kernel(void);
+int set_dijkstra_kernel(const char* name); // returns 0 if the name is unknown or the CPU can't run it
 void delete_graph(Graph* g);
 
 #endif
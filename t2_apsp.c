@@ -0,0 +1,283 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#include "t2_apsp.h"
+
+// Tiles are APSP_TILE x APSP_TILE entries, three of them (16 KB each) fit
+// in L2 while one is updated from the other two
+#define APSP_TILE 64
+// No path yet, small enough that adding two of them can't overflow
+#define APSP_INF (INT_MAX / 2)
+
+typedef struct ApspState ApspState;
+typedef void (*RowKernel)(int* restrict out, const int* restrict in, int dik,
+                          int* restrict next_out, int next_k, int count);
+typedef void (*TileKernel)(ApspState* s, int ti, int tj, int kb);
+
+// Shared by every thread of one run
+struct ApspState {
+    TileKernel update_tile;
+    int* dist;
+    int* next; // NULL when no paths are wanted
+    int n;
+    int stride;
+    int tiles; // tiles per side
+    int threads;
+    pthread_barrier_t barrier;
+};
+
+typedef struct ApspWorker {
+    pthread_t thread;
+    ApspState* s;
+    int id;
+} ApspWorker;
+
+/* ---------- row kernels ----------
+ * out[j] = min(out[j], dik + in[j]) for count entries, count a multiple of
+ * ROW_ALIGN. The rows come from the caller's matrices, which needn't be
+ * aligned, so the loads are unaligned. When next_out isn't NULL every lowered
+ * entry also gets next_k. Each is inlined into the tile update compiled
+ * for the same instruction set below.
+ */
+
+static inline __attribute__((always_inline))
+void relax_row_scalar(int* restrict out, const int* restrict in, int dik,
+                             int* restrict next_out, int next_k, int count) {
+    for (int j = 0; j < count; j++) {
+        int via = dik + in[j];
+        if (via < out[j]) {
+            out[j] = via;
+            if (next_out) {
+                next_out[j] = next_k;
+            }
+        }
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+__attribute__((target("sse4.1"), always_inline))
+static inline void relax_row_sse41(int* restrict out, const int* restrict in, int dik,
+                            int* restrict next_out, int next_k, int count) {
+    const __m128i base = _mm_set1_epi32(dik);
+    const __m128i hop = _mm_set1_epi32(next_k);
+    for (int j = 0; j < count; j += 4) {
+        __m128i via = _mm_add_epi32(base, _mm_loadu_si128((const __m128i*)(in + j)));
+        __m128i cur = _mm_loadu_si128((__m128i*)(out + j));
+        _mm_storeu_si128((__m128i*)(out + j), _mm_min_epi32(cur, via));
+        if (next_out) {
+            __m128i better = _mm_cmpgt_epi32(cur, via);
+            __m128i nx = _mm_loadu_si128((__m128i*)(next_out + j));
+            _mm_storeu_si128((__m128i*)(next_out + j), _mm_blendv_epi8(nx, hop, better));
+        }
+    }
+}
+
+__attribute__((target("avx2"), always_inline))
+static inline void relax_row_avx2(int* restrict out, const int* restrict in, int dik,
+                           int* restrict next_out, int next_k, int count) {
+    const __m256i base = _mm256_set1_epi32(dik);
+    const __m256i hop = _mm256_set1_epi32(next_k);
+    for (int j = 0; j < count; j += 8) {
+        __m256i via = _mm256_add_epi32(base, _mm256_loadu_si256((const __m256i*)(in + j)));
+        __m256i cur = _mm256_loadu_si256((__m256i*)(out + j));
+        _mm256_storeu_si256((__m256i*)(out + j), _mm256_min_epi32(cur, via));
+        if (next_out) {
+            __m256i better = _mm256_cmpgt_epi32(cur, via);
+            __m256i nx = _mm256_loadu_si256((__m256i*)(next_out + j));
+            _mm256_storeu_si256((__m256i*)(next_out + j), _mm256_blendv_epi8(nx, hop, better));
+        }
+    }
+}
+
+#endif
+
+// Relax tile (ti, tj) through every k of tile column kb
+// Row i of the tile reads dist[i][k] and row k reads dist[k][j], for the
+// first two phases of a round those lie in the tile being updated, which
+// Floyd-Warshall allows as long as k goes in order.
+static inline __attribute__((always_inline))
+void tile_loop(ApspState* s, int ti, int tj, int kb, RowKernel relax_row) {
+    int i0 = ti * APSP_TILE;
+    int i1 = i0 + APSP_TILE < s->n ? i0 + APSP_TILE : s->n;
+    int j0 = tj * APSP_TILE;
+    // The last tile runs into the row padding, which holds APSP_INF
+    int j1 = j0 + APSP_TILE < s->stride ? j0 + APSP_TILE : s->stride;
+    int k0 = kb * APSP_TILE;
+    int k1 = k0 + APSP_TILE < s->n ? k0 + APSP_TILE : s->n;
+
+    for (int k = k0; k < k1; k++) {
+        const int* row_k = s->dist + (size_t)k * s->stride;
+        for (int i = i0; i < i1; i++) {
+            // Row k can't get shorter through k, skipping it means the two
+            // rows never overlap
+            if (i == k) {
+                continue;
+            }
+            int* row_i = s->dist + (size_t)i * s->stride;
+            int dik = row_i[k];
+            if (dik >= APSP_INF) {
+                continue;
+            }
+            int* next_i = s->next ? s->next + (size_t)i * s->stride : NULL;
+            relax_row(row_i + j0, row_k + j0, dik, next_i ? next_i + j0 : NULL,
+                      next_i ? next_i[k] : 0, j1 - j0);
+        }
+    }
+}
+
+static void update_tile_scalar(ApspState* s, int ti, int tj, int kb) {
+    tile_loop(s, ti, tj, kb, relax_row_scalar);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+__attribute__((target("sse4.1")))
+static void update_tile_sse41(ApspState* s, int ti, int tj, int kb) {
+    tile_loop(s, ti, tj, kb, relax_row_sse41);
+}
+
+__attribute__((target("avx2")))
+static void update_tile_avx2(ApspState* s, int ti, int tj, int kb) {
+    tile_loop(s, ti, tj, kb, relax_row_avx2);
+}
+
+#endif
+
+// Same vector width as dijkstra, see set_dijkstra_kernel
+static TileKernel tile_kernel(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    if (strcmp(dijkstra_kernel(), "avx2") == 0) {
+        return update_tile_avx2;
+    }
+    if (strcmp(dijkstra_kernel(), "sse4.1") == 0) {
+        return update_tile_sse41;
+    }
+#endif
+    return update_tile_scalar;
+}
+
+// Tile index t of the tiles other than kb
+static int skip_tile(int t, int kb) {
+    return t < kb ? t : t + 1;
+}
+
+// Each round finishes the tile on the diagonal, then the rest of its tile
+// row and column, then every other tile. Threads split each phase by tile
+// and wait for each other between phases.
+static void* apsp_worker(void* arg) {
+    ApspWorker* w = (ApspWorker*)arg;
+    ApspState* s = w->s;
+    int others = s->tiles - 1;
+    for (int kb = 0; kb < s->tiles; kb++) {
+        if (w->id == 0) {
+            s->update_tile(s, kb, kb, kb);
+        }
+        pthread_barrier_wait(&s->barrier);
+
+        for (int e = w->id; e < 2 * others; e += s->threads) {
+            int t = skip_tile(e / 2, kb);
+            if (e % 2 == 0) {
+                s->update_tile(s, kb, t, kb);
+            } else {
+                s->update_tile(s, t, kb, kb);
+            }
+        }
+        pthread_barrier_wait(&s->barrier);
+
+        for (int e = w->id; e < others * others; e += s->threads) {
+            s->update_tile(s, skip_tile(e / others, kb), skip_tile(e % others, kb), kb);
+        }
+        pthread_barrier_wait(&s->barrier);
+    }
+    return NULL;
+}
+
+int all_pairs_shortest_paths(const Graph* g, int* dist, int* next, int threads) {
+    if (!g || !dist) {
+        return 0;
+    }
+    int n = g->num_nodes;
+    int stride = g->stride;
+    if (threads < 1) {
+        threads = 1;
+    }
+
+    // Start from the edges, 0 and INT_MAX in the matrix both mean no edge
+    for (int i = 0; i < n; i++) {
+        const int* row = g->adj_matrix + (size_t)i * stride;
+        int* d = dist + (size_t)i * stride;
+        int* nx = next ? next + (size_t)i * stride : NULL;
+        // Padding too, the kernels read whole vectors
+        for (int j = 0; j < stride; j++) {
+            int edge = j < n && row[j] != 0 && row[j] != INT_MAX;
+            d[j] = i == j ? 0 : edge ? row[j] : APSP_INF;
+            if (nx) {
+                nx[j] = i == j ? i : edge ? j : -1;
+            }
+        }
+    }
+
+    ApspState s;
+    s.update_tile = tile_kernel();
+    s.dist = dist;
+    s.next = next;
+    s.n = n;
+    s.stride = stride;
+    s.tiles = (n + APSP_TILE - 1) / APSP_TILE;
+    s.threads = threads;
+    ApspWorker* workers = (ApspWorker*)malloc(threads * sizeof(ApspWorker));
+    if (!workers) {
+        printf("Memory allocation for all pairs workers failed\n");
+        return 0;
+    }
+    pthread_barrier_init(&s.barrier, NULL, threads);
+    // The calling thread is worker 0
+    for (int t = 0; t < threads; t++) {
+        workers[t].s = &s;
+        workers[t].id = t;
+    }
+    for (int t = 1; t < threads; t++) {
+        if (pthread_create(&workers[t].thread, NULL, apsp_worker, &workers[t]) != 0) {
+            printf("Unable to start all pairs worker\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    apsp_worker(&workers[0]);
+    for (int t = 1; t < threads; t++) {
+        pthread_join(workers[t].thread, NULL);
+    }
+    pthread_barrier_destroy(&s.barrier);
+    free(workers);
+
+    // Back to the INT_MAX the rest of t2 uses for unreachable
+    for (int i = 0; i < n; i++) {
+        int* d = dist + (size_t)i * stride;
+        for (int j = 0; j < n; j++) {
+            if (d[j] >= APSP_INF) {
+                d[j] = INT_MAX;
+            }
+        }
+    }
+    return 1;
+}
+
+int apsp_path(const Graph* g, const int* next, int from, int to, int* path) {
+    int n = g->num_nodes;
+    if (from < 0 || from >= n || to < 0 || to >= n || next[(size_t)from * g->stride + to] == -1) {
+        return 0;
+    }
+    int length = 0;
+    path[length++] = from;
+    // A shortest path visits each node at most once
+    while (from != to && length < n) {
+        from = next[(size_t)from * g->stride + to];
+        path[length++] = from;
+    }
+    return length;
+}
@@ -0,0 +1,20 @@
+#ifndef T2_APSP_H_
+#define T2_APSP_H_
+
+#include "t2.h"
+
+// All pairs shortest paths for the matrix graph
+// dist has the same layout as g->adj_matrix (num_nodes rows of g->stride
+// entries) and gets the length of the shortest path from i to j at
+// dist[i * stride + j], INT_MAX if there is none. Path lengths have to stay
+// below INT_MAX / 2. next is optional, when it isn't NULL it gets the node
+// after i on that path (-1 if there is none) for apsp_path.
+// Runs a tiled Floyd-Warshall on threads threads, returns 0 on failure.
+int all_pairs_shortest_paths(const Graph* g, int* dist, int* next, int threads);
+
+// Writes the nodes of the shortest path from..to into path (up to
+// num_nodes entries) using the next matrix, returns how many, 0 if to
+// can't be reached
+int apsp_path(const Graph* g, const int* next, int from, int to, int* path);
+
+#endif
@@ -1,4 +1,8 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
 #include "t2.h"
+#include "t2_apsp.h"
 
 // converts an upper case character (A-Z) to a numerical value (between 0 and 25) 
 static int char2val ( char c ) {
@@ -9,6 +13,96 @@ static int char2val ( char c ) {
 	return c-'A';
 }
 
+// Graph where each pair has an edge with chance percent in 100, weights 1..100
+static Graph* random_graph(int num_nodes, int percent) {
+    Graph* g = create_graph(num_nodes);
+    for (int i = 0; i < num_nodes; i++) {
+        for (int j = i + 1; j < num_nodes; j++) {
+            if (rand() % 100 < percent) {
+                add_edge(g, i, j, 1 + rand() % 100);
+            }
+        }
+    }
+    return g;
+}
+
+// all_pairs_shortest_paths against a dijkstra_distances run from every node,
+// and the paths of apsp_path against the distances
+static int check_apsp(Graph* g, int threads) {
+    int n = g->num_nodes;
+    size_t size = (size_t)n * g->stride;
+    int* dist = (int*)malloc(size * sizeof(int));
+    int* next = (int*)malloc(size * sizeof(int));
+    int* row = (int*)malloc(n * sizeof(int));
+    int* path = (int*)malloc(n * sizeof(int));
+    if (!dist || !next || !row || !path) {
+        printf("Memory allocation for test failed\n");
+        exit(EXIT_FAILURE);
+    }
+    int ok = all_pairs_shortest_paths(g, dist, next, threads);
+    for (int i = 0; i < n && ok; i++) {
+        dijkstra_distances(g, i, row, NULL);
+        for (int j = 0; j < n && ok; j++) {
+            ok = dist[(size_t)i * g->stride + j] == row[j];
+            int length = apsp_path(g, next, i, j, path);
+            if (!ok || row[j] == INT_MAX) {
+                ok = ok && length == 0;
+                continue;
+            }
+            // Starts at i, ends at j and its edges add up to the distance
+            int sum = 0;
+            for (int k = 1; k < length && ok; k++) {
+                int weight = g->adj_matrix[(size_t)path[k - 1] * g->stride + path[k]];
+                ok = weight > 0;
+                sum += weight;
+            }
+            ok = ok && length > 0 && path[0] == i && path[length - 1] == j && sum == row[j];
+        }
+    }
+    free(dist);
+    free(next);
+    free(row);
+    free(path);
+    return ok;
+}
+
+// Every vector kernel the CPU runs against the scalar one, from every
+// origin: the same distances and the same nodes made permanent in the same
+// order. Kernels the CPU can't run are skipped.
+static int check_kernels(Graph* g) {
+    const char* names[] = { "sse4.1", "avx2" };
+    const char* original = dijkstra_kernel();
+    int n = g->num_nodes;
+    int* dist = (int*)malloc(n * sizeof(int));
+    int* order = (int*)malloc(n * sizeof(int));
+    int* kernel_dist = (int*)malloc(n * sizeof(int));
+    int* kernel_order = (int*)malloc(n * sizeof(int));
+    if (!dist || !order || !kernel_dist || !kernel_order) {
+        printf("Memory allocation for test failed\n");
+        exit(EXIT_FAILURE);
+    }
+    int ok = 1;
+    for (int origin = 0; origin < n && ok; origin++) {
+        set_dijkstra_kernel("scalar");
+        int count = dijkstra_distances(g, origin, dist, order);
+        for (int k = 0; k < 2 && ok; k++) {
+            if (!set_dijkstra_kernel(names[k])) {
+                continue;
+            }
+            ok = dijkstra_distances(g, origin, kernel_dist, kernel_order) == count;
+            for (int i = 0; i < n && ok; i++) {
+                ok = kernel_dist[i] == dist[i] && (i >= count || kernel_order[i] == order[i]);
+            }
+        }
+    }
+    set_dijkstra_kernel(original);
+    free(dist);
+    free(order);
+    free(kernel_dist);
+    free(kernel_order);
+    return ok;
+}
+
 int main(){
     int num_nodes = 7;
     Graph *graph = create_graph(num_nodes);
@@ -31,4 +125,38 @@ int main(){
     
     delete_graph(graph);
 
+    int failed = 0;
+    srand(1);
+    // Sizes on and off the 64 node tiles and the 8 entry rows, sparse
+    // graphs leave pairs unreachable
+    int sizes[] = { 1, 5, 8, 63, 64, 65, 130, 200 };
+    for (int s = 0; s < 8; s++) {
+        for (int percent = 3; percent <= 30; percent += 27) {
+            Graph* g = random_graph(sizes[s], percent);
+            for (int threads = 1; threads <= 3; threads += 2) {
+                if (!check_apsp(g, threads)) {
+                    printf("all_pairs_shortest_paths differs from dijkstra: %d nodes, %d threads\n", sizes[s], threads);
+                    failed++;
+                }
+            }
+            delete_graph(g);
+        }
+    }
+
+    // Ties between equal distances have to break the same way in every
+    // kernel, small weights make plenty of them
+    for (int s = 0; s < 8; s++) {
+        Graph* g = random_graph(sizes[s], 20);
+        for (int i = 0; i < 3 * sizes[s]; i++) {
+            add_edge(g, rand() % sizes[s], rand() % sizes[s], 1 + rand() % 3);
+        }
+        if (!check_kernels(g)) {
+            printf("Dijkstra kernels disagree: %d nodes\n", sizes[s]);
+            failed++;
+        }
+        delete_graph(g);
+    }
+
+    printf("%s\n", failed ? "Checks FAILED" : "Checks passed");
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
 }
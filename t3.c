@@ -3,325 +3,941 @@
 #include <limits.h>
 #include <stdbool.h>
 #include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
 #include "t3.h"
+#include "t3_csv.h"
+#include "t3_load.h"
+#include "t3_stops.h"
+#include "t3_spatial.h"
+#include "t3_spt.h"
+#include "t3_snapshot.h"
+#include "t3_ch.h"
+#include "t3_delta.h"
+#include "t3_writer.h"
+#include "instrument.h"
 
-Stops *Vertexs[MAX_GRAPH];
 Graph *g;
 
-int next_field(FILE *f, char *buf, int max) {
-    int i = 0, quoted = 0;
-    int c;
+// Every loaded stop, graph node i is entry i of the table
+static StopTable stops;
 
-    while (1) {
-        c = fgetc(f);
+// k-d tree over the stop coordinates, rebuilt whenever the stops are loaded
+static SpatialIndex spatial;
 
-        // Check if char is EOF
-        // If this is first entry in buffer then
-        // Return fail, otherwise break to return
-        if (c == EOF) {
-            if (i == 0) {
-                return NEXT_FIELD_FAIL;
-            }
-            // i > 0, EOF reached
-            break;
-        }
+// Snapshot the graph and stops were mapped from, if any
+static Snapshot snapshot;
 
-        // Enter or exit quotes
-        if (c == '"') {
-            quoted = !quoted;
-            // We don't actually add quotes to buffer
-            continue;
-        }
+// A* heuristic scale for the current graph, -1 until it is worked out
+static double astar_scale = -1;
 
+// Search engine used by shortest_path, see set_search_mode
+static SearchMode search_mode = SEARCH_DIJKSTRA;
 
-        // We have reached seperator and not in quotes!
-        if (c == ',' && !quoted) {
-            // Hmmm first character was a seperator
-            // This should not happen, return fail
-            if (i == 0) {
-                return NEXT_FIELD_FAIL;
-            }
-            // Otherwize, we have just reached EOF
-            break;
-        }
-        // Same as seperator, '\n' indicates EOF
-        if (c == '\n') {
-            break;
-        }
-        if (i < max - 1) {
-            buf[i++] = c;
-        }
-    }
+// Contraction hierarchy for the current graph, built by prepare_search or
+// taken from the snapshot
+static ContractionHierarchy *hierarchy;
 
-    buf[i] = '\0';
-    return 0;
-}
+// Workspace behind shortest_path and the other single threaded calls
+static SearchWorkspace *shared_ws;
 
-// Function to parse a stop from the CSV file
-Stops *createStop(FILE *f) {
-    char buf[MAX_STRING_SIZE];
-    Stops *temp_stop = malloc(sizeof(Stops));
-    if (!temp_stop) {
-        printf("Memory allocation failed for Stops\n");
-        return NULL;
-    }
+// Delta stepping threads for path_tree_parallel, started on first use
+static DeltaPool *tree_pool;
+static int tree_threads;
+static int tree_delta;
 
-    // Read stop_no
-    if (next_field(f, buf, MAX_STRING_SIZE) == NEXT_FIELD_FAIL) {
-        free(temp_stop);
-        return NULL;
-    }
-    temp_stop->stop_no = atoi(buf);
+// Threads the CSV loaders parse on, 0 for every online CPU
+static int load_threads;
 
-    // Read Name
-    if (next_field(f, buf, MAX_STRING_SIZE) == NEXT_FIELD_FAIL) {
-        free(temp_stop);
-        return NULL;
-    }
-    strncpy(temp_stop->Name, buf, MAX_STRING_SIZE);
-    temp_stop->Name[MAX_STRING_SIZE - 1] = '\0'; // Ensure null-termination
+// Shortest path trees of the origins passed to cache_tree
+static ShortestPathTree **trees;
+static int num_trees;
 
-    // Read Latitude
-    if (next_field(f, buf, MAX_STRING_SIZE) == NEXT_FIELD_FAIL) {
-        free(temp_stop);
-        return NULL;
-    }
-    temp_stop->Latitude = atof(buf);
+// Formats what dijkstra prints
+static PathWriter *stdout_writer;
 
-    // Read Longitude
-    if (next_field(f, buf, MAX_STRING_SIZE) == NEXT_FIELD_FAIL) {
-        free(temp_stop);
-        return NULL;
-    }
-    temp_stop->Longitude = atof(buf);
+// Forget anything derived from the graph once it changes
+static void drop_derived(void) {
+    astar_scale = -1;
+    workspace_free(shared_ws);
+    ch_free(hierarchy);
+    delta_free(tree_pool);
+    shared_ws = NULL;
+    hierarchy = NULL;
+    tree_pool = NULL;
+}
 
-    return temp_stop;
+int num_stops(void) {
+    return stops.count;
 }
 
-// Function to parse an edge from the CSV file
-Edge *createEdge(FILE *f) {
-    char buf[MAX_STRING_SIZE];
-    Edge *temp_edge = malloc(sizeof(Edge));
-    if (!temp_edge) {
-        printf("Memory allocation failed for Edge\n");
-        return NULL;
-    }
+int num_edges(void) {
+    return g ? (g->num_edges - g->num_removed) / 2 : 0;
+}
 
-    // Read from
-    if (next_field(f, buf, MAX_STRING_SIZE) == NEXT_FIELD_FAIL) {
-        free(temp_edge);
-        return NULL;
-    }
-    temp_edge->from = atoi(buf);
+int stop_index(int stop_no) {
+    return stops_find(&stops, stop_no);
+}
 
-    // Read to
-    if (next_field(f, buf, MAX_STRING_SIZE) == NEXT_FIELD_FAIL) {
-        free(temp_edge);
-        return NULL;
-    }
-    temp_edge->to = atoi(buf);
+int stop_number(int index) {
+    return stops.ids[index];
+}
 
-    // Read weight
-    if (next_field(f, buf, MAX_STRING_SIZE) == NEXT_FIELD_FAIL) {
-        free(temp_edge);
-        return NULL;
-    }
-    temp_edge->weight = atoi(buf);
+const char *stop_name(int index) {
+    return stops.names + stops.name[index];
+}
+
+float stop_latitude(int index) {
+    return stops.latitude[index];
+}
 
-    return temp_edge;
+float stop_longitude(int index) {
+    return stops.longitude[index];
 }
 
-// Initialize the graph with no edges
+// Initialize the graph with no edges, one node per loaded stop
 void init_graph() {
     g = malloc(sizeof(Graph));
     if (!g) {
         printf("Memory allocation failed for Graph\n");
         exit(EXIT_FAILURE);
     }
-    for (int i = 0; i < MAX_GRAPH; i++) {
-        for (int j = 0; j < MAX_GRAPH; j++) {
-            g->graph_ar[i][j] = 0; // No edge initially
-        }
+    g->num_nodes = stops.count;
+    g->num_edges = 0;
+    // Every row starts out empty
+    g->offsets = calloc(stops.count + 1, sizeof(int));
+    g->neighbors = NULL;
+    g->weights = NULL;
+    g->borrowed = 0;
+    g->num_removed = 0;
+    g->pending = NULL;
+    g->num_pending = 0;
+    g->pending_cap = 0;
+    if (!g->offsets) {
+        printf("Memory allocation failed for Graph\n");
+        exit(EXIT_FAILURE);
     }
 }
 
-// Add an undirected edge to the graph
+// Add an undirected edge between two stop indices
+// The edge is queued and only becomes visible once build_graph is called
 void add_edge(Graph *g, int from, int to, int weight) {
-    if (from >= MAX_GRAPH || to >= MAX_GRAPH || from < 0 || to < 0) {
+    if (from >= g->num_nodes || to >= g->num_nodes || from < 0 || to < 0) {
         printf("Edge nodes %d-%d out of bounds\n", from, to);
         return;
     }
+    // Grow the pending list geometrically
+    if (g->num_pending == g->pending_cap) {
+        int cap = g->pending_cap ? g->pending_cap * 2 : 1024;
+        Edge *grown = realloc(g->pending, cap * sizeof(Edge));
+        if (!grown) {
+            printf("Memory allocation failed for Edge\n");
+            exit(EXIT_FAILURE);
+        }
+        g->pending = grown;
+        g->pending_cap = cap;
+    }
     // Esentially links two stops, provides path between them
-    g->graph_ar[from][to] = weight;
-    g->graph_ar[to][from] = weight;
+    Edge *e = &g->pending[g->num_pending++];
+    e->from = from;
+    e->to = to;
+    e->weight = weight;
+}
+
+// Merge the pending edges into the CSR arrays
+// Matches the old matrix semantics, the last weight written for a pair wins
+// and a weight of zero means there is no edge
+void build_graph(Graph *g) {
+    int n = g->num_nodes;
+    int *degree = calloc(n + 1, sizeof(int));
+    int *last = malloc(n * sizeof(int));
+    if (!degree || !last) {
+        printf("Memory allocation failed for Graph\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Snapshot arrays are read only, take a private copy of the offsets
+    if (g->borrowed) {
+        int *offsets = malloc((n + 1) * sizeof(int));
+        if (!offsets) {
+            printf("Memory allocation failed for Graph\n");
+            exit(EXIT_FAILURE);
+        }
+        memcpy(offsets, g->offsets, (n + 1) * sizeof(int));
+        g->offsets = offsets;
+    }
+
+    // Count existing entries plus both directions of every pending edge
+    for (int i = 0; i < n; i++) {
+        degree[i + 1] = g->offsets[i + 1] - g->offsets[i];
+    }
+    for (int i = 0; i < g->num_pending; i++) {
+        degree[g->pending[i].from + 1]++;
+        degree[g->pending[i].to + 1]++;
+    }
+    for (int i = 0; i < n; i++) {
+        degree[i + 1] += degree[i];
+    }
+
+    int total = degree[n];
+    int *neighbors = malloc((total ? total : 1) * sizeof(int));
+    int *weights = malloc((total ? total : 1) * sizeof(int));
+    if (!neighbors || !weights) {
+        printf("Memory allocation failed for Graph\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Scatter in insertion order, existing entries first so newer edges win
+    for (int u = 0; u < n; u++) {
+        for (int e = g->offsets[u]; e < g->offsets[u + 1]; e++) {
+            neighbors[degree[u]] = g->neighbors[e];
+            weights[degree[u]++] = g->weights[e];
+        }
+    }
+    for (int i = 0; i < g->num_pending; i++) {
+        Edge *e = &g->pending[i];
+        neighbors[degree[e->from]] = e->to;
+        weights[degree[e->from]++] = e->weight;
+        neighbors[degree[e->to]] = e->from;
+        weights[degree[e->to]++] = e->weight;
+    }
+
+    // degree[u] now holds the end of row u, compact each row in place
+    // keeping only the last entry for every neighbour
+    int out = 0;
+    int row_start = 0;
+    for (int u = 0; u < n; u++) {
+        int row_end = degree[u];
+        for (int e = row_start; e < row_end; e++) {
+            last[neighbors[e]] = e;
+        }
+        g->offsets[u] = out;
+        for (int e = row_start; e < row_end; e++) {
+            if (last[neighbors[e]] == e && weights[e] != 0) {
+                neighbors[out] = neighbors[e];
+                weights[out++] = weights[e];
+            }
+        }
+        row_start = row_end;
+    }
+    g->offsets[n] = out;
+
+    if (!g->borrowed) {
+        free(g->neighbors);
+        free(g->weights);
+    }
+    g->borrowed = 0;
+    // Trim the arrays down to the deduplicated size
+    g->neighbors = realloc(neighbors, (out ? out : 1) * sizeof(int));
+    g->weights = realloc(weights, (out ? out : 1) * sizeof(int));
+    g->num_edges = out;
+    g->num_removed = 0;
+    drop_derived();
+
+    free(g->pending);
+    g->pending = NULL;
+    g->num_pending = 0;
+    g->pending_cap = 0;
+
+    free(degree);
+    free(last);
+}
+
+void set_load_threads(int threads) {
+    load_threads = threads;
+}
+
+// wanted, or every online CPU if it is 0
+static int thread_count(int wanted) {
+    if (wanted > 0) {
+        return wanted;
+    }
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    return online > 0 ? (int)online : 1;
 }
 
 // Load edges from a CSV file
 int load_edges(char *fname) {
-    FILE *f = fopen(fname, "r");
-    if (!f) {
+    CsvReader r;
+    if (!csv_open(&r, fname)) {
         printf("Unable to open %s\n", fname);
         return 0;
     }
+    INSTR_PHASE_BEGIN(PHASE_LOAD);
 
     // Skip header
-    char header[MAX_STRING_SIZE];
-    fgets(header, sizeof(header), f);
+    csv_skip_line(&r);
 
     init_graph();
 
-    int num_edges = 0;
-    while (!feof(f)) {
-        Edge *temp = createEdge(f);
-        if (!temp) {
-            break; // End of file or error
-        }
-        add_edge(g, temp->from, temp->to, temp->weight);
-        num_edges++;
-        free(temp);
-    }
+    // Parsed in parallel and sorted straight into the CSR arrays
+    int num_edges = load_edge_records(&r, &stops, g, thread_count(load_threads));
+    drop_derived();
 
-    fclose(f);
+    INSTR_ADD(bytes_parsed, r.pos);
+    csv_close(&r);
+    INSTR_PHASE_END(PHASE_LOAD);
     printf("Loaded %d edges\n", num_edges);
     return 1;
 }
 
 // Load vertices from a CSV file
 int load_vertices(char *fname) {
-    FILE *f = fopen(fname, "r");
-    if (!f) {
+    CsvReader r;
+    if (!csv_open(&r, fname)) {
         printf("Unable to open %s\n", fname);
         return 0;
     }
+    INSTR_PHASE_BEGIN(PHASE_LOAD);
 
     // Skip header
-    char header[MAX_STRING_SIZE];
-    fgets(header, sizeof(header), f);
-
-    int num_vertices = 0;
-    while (!feof(f)) {
-        Stops *temp = createStop(f);
-        if (!temp) {
-            break; // End of file or error
-        }
-        if (temp->stop_no >= MAX_GRAPH || temp->stop_no < 0) {
-            printf("Stop number %d out of bounds\n", temp->stop_no);
-            free(temp);
-            continue;
-        }
-        Vertexs[temp->stop_no] = temp;
-        num_vertices++;
-    }
+    csv_skip_line(&r);
 
-    fclose(f);
+    int num_vertices = load_stop_records(&r, &stops, thread_count(load_threads));
+
+    INSTR_ADD(bytes_parsed, r.pos);
+    csv_close(&r);
+    spatial_free(&spatial);
+    spatial_build(&spatial, stops.latitude, stops.longitude, stops.count);
+    INSTR_PHASE_END(PHASE_LOAD);
     printf("Loaded %d vertices\n", num_vertices);
     return 1;
 }
 
-// Find the vertex with the minimum distance value
-int min_distance(int distance[MAX_GRAPH], bool shortestpath[MAX_GRAPH]) {
-    int min = INT_MAX;
-    int min_index = -1;
-    for (int i = 0; i < MAX_GRAPH; i++) {
-        // Skip finallized nodes and make sure node is reachable
-        if (!shortestpath[i] && distance[i] < min) {
-            min = distance[i];
-            min_index = i;
+// Write the loaded graph and stops to a snapshot file
+int save_snapshot(char *fname) {
+    if (!g || !stops.count) {
+        printf("Nothing loaded to write to %s\n", fname);
+        return 0;
+    }
+    // Compact away pending edges and anything update_edge removed
+    if (g->num_pending || g->num_removed) {
+        build_graph(g);
+    }
+    // The hierarchy goes in when the ch engine is selected
+    if (search_mode == SEARCH_CH) {
+        prepare_search();
+    }
+    return snapshot_write(fname, g, &stops, search_mode == SEARCH_CH ? hierarchy : NULL);
+}
+
+// Use a snapshot in place of load_vertices and load_edges
+// The arrays, stop number hash included, are used straight from the mapping
+int load_snapshot(char *fname) {
+    Snapshot s;
+    INSTR_PHASE_BEGIN(PHASE_LOAD);
+    if (!snapshot_map(fname, &s)) {
+        return 0;
+    }
+    if (s.header->num_nodes != s.header->num_stops) {
+        printf("Snapshot %s does not have one node per stop\n", fname);
+        snapshot_unmap(&s);
+        return 0;
+    }
+
+    free_memory();
+    snapshot = s;
+
+    g = malloc(sizeof(Graph));
+    if (!g) {
+        printf("Memory allocation failed for Graph\n");
+        exit(EXIT_FAILURE);
+    }
+    g->num_nodes = s.header->num_nodes;
+    g->num_edges = s.header->num_edges;
+    g->offsets = s.offsets;
+    g->neighbors = s.neighbors;
+    g->weights = s.weights;
+    g->borrowed = 1;
+    g->num_removed = 0;
+    drop_derived();
+    g->pending = NULL;
+    g->num_pending = 0;
+    g->pending_cap = 0;
+
+    stops = s.stops;
+
+    spatial_build(&spatial, stops.latitude, stops.longitude, stops.count);
+    if (s.hierarchy.num_nodes) {
+        hierarchy = malloc(sizeof(ContractionHierarchy));
+        if (!hierarchy) {
+            printf("Memory allocation failed for contraction hierarchy\n");
+            exit(EXIT_FAILURE);
         }
+        *hierarchy = s.hierarchy;
+    }
+    // Nothing is parsed, the whole mapping is what the load touched
+    INSTR_ADD(bytes_parsed, s.size);
+    INSTR_PHASE_END(PHASE_LOAD);
+    printf("Loaded %d vertices\n", stops.count);
+    printf("Loaded %d edges\n", g->num_edges / 2);
+    return 1;
+}
+
+// Priority queue used by dijkstra, see set_queue_kind
+static PQKind queue_kind = PQ_BINARY;
+
+void set_queue_kind(PQKind kind) {
+    queue_kind = kind;
+    // Workspaces pick their queue when they are created
+    workspace_free(shared_ws);
+    shared_ws = NULL;
+}
+
+void set_search_mode(SearchMode mode) {
+    search_mode = mode;
+}
+
+int search_mode_from_name(const char *name) {
+    if (strcmp(name, "dijkstra") == 0) {
+        return SEARCH_DIJKSTRA;
+    }
+    if (strcmp(name, "astar") == 0) {
+        return SEARCH_ASTAR;
+    }
+    if (strcmp(name, "bidir") == 0) {
+        return SEARCH_BIDIRECTIONAL;
     }
-    return min_index;
+    if (strcmp(name, "ch") == 0) {
+        return SEARCH_CH;
+    }
+    return -1;
 }
 
-// Implement Dijkstra's algorithm
-void dijkstra(int start, int end) {
-    // Array to keep track of distance
-    int distance[MAX_GRAPH];
-    // Array to keep track of shortest path
-    bool shortestpath[MAX_GRAPH];
-    // Array to keep track of nodes traversed
-    int prev[MAX_GRAPH];
+// Great circle distance between stops a and b in metres
+static double stop_distance(int a, int b) {
+    const double to_rad = M_PI / 180.0;
+    double lat1 = stops.latitude[a] * to_rad;
+    double lat2 = stops.latitude[b] * to_rad;
+    double dlat = lat2 - lat1;
+    double dlon = (stops.longitude[b] - stops.longitude[a]) * to_rad;
+    double h = sin(dlat / 2) * sin(dlat / 2) +
+               cos(lat1) * cos(lat2) * sin(dlon / 2) * sin(dlon / 2);
+    return 2 * EARTH_RADIUS_M * asin(sqrt(h < 1 ? h : 1));
+}
 
-    // Initialize distances and shortestpath set
-    for (int i = 0; i < MAX_GRAPH; i++) {
-        // Set all disatances to INT_MAX aka unknown
-        distance[i] = INT_MAX;
-        // Shortest path is not found for app
-        shortestpath[i] = false;
-        // -1 is essentially the origin, when reconstructing
-        // The path we can use it to signify the end of path
-        prev[i] = -1;
+// Weight units per metre that no edge undercuts, so scale times the great
+// circle distance to the target never overestimates the remaining cost
+static double heuristic_scale(void) {
+    if (astar_scale >= 0) {
+        return astar_scale;
     }
+    double scale = INFINITY;
+    for (int u = 0; u < g->num_nodes; u++) {
+        for (int e = g->offsets[u]; e < g->offsets[u + 1]; e++) {
+            double metres = stop_distance(u, g->neighbors[e]);
+            if (metres > 0 && g->weights[e] / metres < scale) {
+                scale = g->weights[e] / metres;
+            }
+        }
+    }
+    // Leave some room for rounding in the trigonometry
+    astar_scale = isinf(scale) ? 0 : scale * 0.999;
+    return astar_scale;
+}
+
+// Lower bound on the cost from node to target
+static int heuristic(int node, int target, double scale) {
+    if (scale == 0) {
+        return 0;
+    }
+    // Rounding down keeps the bound consistent with integer weights
+    return (int)floor(scale * stop_distance(node, target));
+}
+
+static void *search_alloc(size_t size) {
+    void *p = malloc(size ? size : 1);
+    if (!p) {
+        printf("Memory allocation failed for SearchWorkspace\n");
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+SearchWorkspace *workspace_create(void) {
+    int n = g ? g->num_nodes : 0;
+    SearchWorkspace *ws = search_alloc(sizeof(SearchWorkspace));
+    ws->num_nodes = n;
+    ws->distance = search_alloc(n * sizeof(int));
+    ws->prev = search_alloc(n * sizeof(int));
+    ws->distance_back = search_alloc(n * sizeof(int));
+    ws->next = search_alloc(n * sizeof(int));
+    ws->estimate = search_alloc(n * sizeof(int));
+    ws->done[0] = search_alloc(n * sizeof(bool));
+    ws->done[1] = search_alloc(n * sizeof(bool));
+    ws->path = search_alloc(n * sizeof(int));
+    // Zeroed stamps never match an epoch, so every entry starts out untouched
+    ws->stamp[0] = calloc(n ? n : 1, sizeof(unsigned int));
+    ws->stamp[1] = calloc(n ? n : 1, sizeof(unsigned int));
+    if (!ws->stamp[0] || !ws->stamp[1]) {
+        printf("Memory allocation failed for SearchWorkspace\n");
+        exit(EXIT_FAILURE);
+    }
+    ws->epoch = 0;
+    ws->queue[0] = pq_create(queue_kind, n);
+    ws->queue[1] = pq_create(queue_kind, n);
+    ws->hierarchy = NULL;
+    ws->settled = 0;
+    return ws;
+}
+
+void workspace_free(SearchWorkspace *ws) {
+    if (!ws) {
+        return;
+    }
+    free(ws->distance);
+    free(ws->prev);
+    free(ws->distance_back);
+    free(ws->next);
+    free(ws->estimate);
+    free(ws->done[0]);
+    free(ws->done[1]);
+    free(ws->path);
+    free(ws->stamp[0]);
+    free(ws->stamp[1]);
+    pq_free(ws->queue[0]);
+    pq_free(ws->queue[1]);
+    ch_workspace_free(ws->hierarchy);
+    free(ws);
+}
+
+// Start a new search in O(1), anything stamped with an older epoch now
+// reads as untouched
+static void workspace_reset(SearchWorkspace *ws) {
+    ws->epoch++;
+    if (ws->epoch == 0) {
+        // Wrapped around, old stamps could match again
+        memset(ws->stamp[0], 0, ws->num_nodes * sizeof(unsigned int));
+        memset(ws->stamp[1], 0, ws->num_nodes * sizeof(unsigned int));
+        ws->epoch = 1;
+    }
+    pq_clear(ws->queue[0]);
+    pq_clear(ws->queue[1]);
+    ws->settled = 0;
+}
+
+// Give v its starting state on one side the first time this search sees it
+// Side 0 is distance, prev and done[0], side 1 distance_back, next and done[1]
+static inline void touch(SearchWorkspace *ws, int side, int v) {
+    if (ws->stamp[side][v] == ws->epoch) {
+        return;
+    }
+    ws->stamp[side][v] = ws->epoch;
+    if (side == 0) {
+        ws->distance[v] = INT_MAX;
+        ws->prev[v] = -1;
+    } else {
+        ws->distance_back[v] = INT_MAX;
+        ws->next[v] = -1;
+    }
+    ws->done[side][v] = false;
+}
+
+// Point to point search filling distance and prev for start..end
+// Keys are distance plus the heuristic when A* is used, plain Dijkstra otherwise
+static void search_directed(SearchWorkspace *ws, int start, int end, bool astar) {
+    int *distance = ws->distance;
+    int *prev = ws->prev;
+    // Array to keep track of shortest path
+    bool *shortestpath = ws->done[0];
+    // Heuristic of every reached node, worked out once
+    int *estimate = ws->estimate;
+    double scale = astar ? heuristic_scale() : 0;
+
+    // Nodes read as unknown distance, unfinalized and with no prev (-1
+    // marks the origin when reconstructing) until the search touches them
+    touch(ws, 0, start);
 
     // Distance to origin from origin is zero
     distance[start] = 0;
+    estimate[start] = heuristic(start, end, scale);
 
-    for (int count = 0; count < MAX_GRAPH; count++) {
-        int u = min_distance(distance, shortestpath);
-        if (u == -1) {
-            break; // No more reachable vertices
-        }
+    // Queue of reached but not yet finalized nodes
+    PQueue *queue = ws->queue[0];
+    pq_push(queue, start, estimate[start]);
 
+    int u;
+    // Stops when there are no more reachable vertices
+    while ((u = pq_pop(queue, NULL)) != -1) {
         shortestpath[u] = true;
+        ws->settled++;
+        INSTR_ADD(settled, 1);
+
+        // Early exit if we reached the destination node
+        if (u == end) {
+            break;
+        }
 
         // Update distance value of adjacent vertices
-        for (int v = 0; v < MAX_GRAPH; v++) {
-            // Skip finallized nodes and make sure edge exists
-            if (g->graph_ar[u][v] && !shortestpath[v] &&
-                // Distance must be less than INT_MAX (unreachable)
-                distance[u] != INT_MAX &&
+        INSTR_ADD(scanned, g->offsets[u + 1] - g->offsets[u]);
+        for (int e = g->offsets[u]; e < g->offsets[u + 1]; e++) {
+            int v = g->neighbors[e];
+            touch(ws, 0, v);
+            // Skip finallized nodes
+            if (!shortestpath[v] &&
                 // If the distance we can travel is less, better path is found
-                distance[u] + g->graph_ar[u][v] < distance[v]) {
-                distance[v] = distance[u] + g->graph_ar[u][v];
+                distance[u] + g->weights[e] < distance[v]) {
+                if (distance[v] == INT_MAX) {
+                    estimate[v] = heuristic(v, end, scale);
+                }
+                distance[v] = distance[u] + g->weights[e];
                 prev[v] = u;
+                pq_push(queue, v, distance[v] + estimate[v]);
+                INSTR_ADD(relaxed, 1);
             }
         }
+    }
+}
 
-        // Early exit if we reached the destination node
-        if (u == end) {
+// Grow one Dijkstra ball from start and one from end until they meet
+// The edges are undirected so the backward search walks the same CSR rows.
+// On return distance[end] and the prev chain from end describe the path.
+// Of several equally short paths it keeps the one through the first
+// meeting point found, which need not be the one Dijkstra's search picks.
+static void search_bidirectional(SearchWorkspace *ws, int start, int end) {
+    // The forward search uses distance and prev, the backward one
+    // distance_back and next
+    int *dist[2] = { ws->distance, ws->distance_back };
+    int *link[2] = { ws->prev, ws->next };
+    bool **done = ws->done;
+
+    PQueue **queue = ws->queue;
+    touch(ws, 0, start);
+    touch(ws, 1, end);
+    dist[0][start] = 0;
+    dist[1][end] = 0;
+    pq_push(queue[0], start, 0);
+    pq_push(queue[1], end, 0);
+
+    // Best path length seen so far and the node where the two halves meet
+    int best = start == end ? 0 : INT_MAX;
+    int meet = start == end ? start : -1;
+    // Key last taken from each queue, neither queue holds anything smaller
+    int last_key[2] = { 0, 0 };
+
+    while (queue[0]->size > 0 || queue[1]->size > 0) {
+        // Expand the smaller frontier
+        int side = queue[0]->size == 0 || (queue[1]->size > 0 && queue[1]->size < queue[0]->size);
+        int key;
+        int u = pq_pop(queue[side], &key);
+        last_key[side] = key;
+
+        // Nothing left in either queue can beat the best meeting point
+        if (best != INT_MAX && last_key[0] + last_key[1] >= best) {
             break;
         }
+        done[side][u] = true;
+        ws->settled++;
+        INSTR_ADD(settled, 1);
+
+        int *d = dist[side];
+        int *other = dist[!side];
+        INSTR_ADD(scanned, g->offsets[u + 1] - g->offsets[u]);
+        for (int e = g->offsets[u]; e < g->offsets[u + 1]; e++) {
+            int v = g->neighbors[e];
+            touch(ws, 0, v);
+            touch(ws, 1, v);
+            if (done[side][v]) {
+                continue;
+            }
+            if (d[u] + g->weights[e] < d[v]) {
+                d[v] = d[u] + g->weights[e];
+                link[side][v] = u;
+                pq_push(queue[side], v, d[v]);
+                INSTR_ADD(relaxed, 1);
+            }
+            // The searches touch, remember the shortest connection
+            if (other[v] != INT_MAX && d[v] + other[v] < best) {
+                best = d[v] + other[v];
+                meet = v;
+            }
+        }
+    }
+
+    if (meet == -1) {
+        return;
+    }
+    // Stitch the backward half onto the forward prev chain
+    for (int x = meet; x != end; x = ws->next[x]) {
+        touch(ws, 0, ws->next[x]);
+        ws->prev[ws->next[x]] = x;
+    }
+    touch(ws, 0, end);
+    ws->distance[end] = best;
+}
+
+// Fold pending edges into the CSR arrays before searches share the graph
+void prepare_graph(void) {
+    if (g && g->num_pending) {
+        build_graph(g);
+    }
+}
+
+// Build whatever the selected engine needs before the first query
+// Searches on several threads need this done up front
+void prepare_search(void) {
+    if (!g) {
+        return;
+    }
+    prepare_graph();
+    if (search_mode == SEARCH_ASTAR) {
+        heuristic_scale();
+    }
+    if (search_mode == SEARCH_CH && !hierarchy) {
+        hierarchy = ch_build(g);
+        printf("Built contraction hierarchy in %.3f s: %d shortcuts, %.1f KB extra\n",
+               hierarchy->build_seconds, hierarchy->num_shortcuts,
+               hierarchy->extra_bytes / 1024.0);
+    }
+}
+
+// Answer from the contraction hierarchy, only the prev chain from end and
+// distance[end] are filled in since that is all the path reconstruction reads
+static void search_hierarchy(SearchWorkspace *ws, int start, int end) {
+    if (!hierarchy) {
+        SearchMode mode = search_mode;
+        search_mode = SEARCH_CH;
+        prepare_search();
+        search_mode = mode;
+    }
+    if (!ws->hierarchy) {
+        ws->hierarchy = ch_workspace_create(hierarchy);
     }
 
+    int path_length;
+    int total = ch_query(hierarchy, ws->hierarchy, start, end, ws->path, &path_length);
+    ws->settled = ws->hierarchy->settled;
+    INSTR_ADD(settled, ws->settled);
+    for (int i = 0; i < path_length; i++) {
+        touch(ws, 0, ws->path[i]);
+        ws->prev[ws->path[i]] = i ? ws->path[i - 1] : -1;
+    }
+    touch(ws, 0, end);
+    ws->distance[end] = total;
+}
+
+// Run the search engine selected by mode
+static void run_search(SearchWorkspace *ws, SearchMode mode, int start, int end) {
+    workspace_reset(ws);
+    switch (mode) {
+    case SEARCH_BIDIRECTIONAL:
+        search_bidirectional(ws, start, end);
+        break;
+    case SEARCH_CH:
+        search_hierarchy(ws, start, end);
+        break;
+    default:
+        search_directed(ws, start, end, mode == SEARCH_ASTAR);
+        break;
+    }
+}
+
+int find_path(SearchWorkspace *ws, int start, int end, PathResult *result) {
+    result->start = start;
+    result->end = end;
+    result->stops = ws->path;
+    result->length = 0;
+    result->total = INT_MAX;
+    result->settled = 0;
+    // Searches work on stop indices, the result keeps the stop numbers
+    start = stop_index(start);
+    end = stop_index(end);
+    if (start < 0 || start >= ws->num_nodes || end < 0 || end >= ws->num_nodes) {
+        return 0;
+    }
+
+    // A cached tree already holds the answer, otherwise search
+    const int *distance = ws->distance;
+    const int *prev = ws->prev;
+    const ShortestPathTree *tree = NULL;
+    for (int i = 0; i < num_trees && !tree; i++) {
+        if (trees[i]->source == start) {
+            tree = trees[i];
+        }
+    }
+    if (tree) {
+        distance = tree->distance;
+        prev = tree->parent;
+    } else {
+        INSTR_PHASE_BEGIN(PHASE_SEARCH);
+        run_search(ws, search_mode, start, end);
+        touch(ws, 0, end);
+        result->settled = ws->settled;
+        INSTR_PHASE_END(PHASE_SEARCH);
+    }
     // Check if there is a path
     if (distance[end] == INT_MAX) {
-        printf("No path exists between %d and %d\n", start, end);
-        return;
+        return 0;
     }
+    result->total = distance[end];
 
-    // Reconstruct the path
-    int path[MAX_GRAPH];
+    // Reconstruct the path, walking back from the end fills it in reverse
+    INSTR_PHASE_BEGIN(PHASE_PATH);
     int path_length = 0;
-    // Start at the end
-    int crawl = end;
-    // Add end node
-    path[path_length++] = crawl;
-    // Keep adding prev nodes until we get back to irigin
-    while (prev[crawl] != -1) {
-        crawl = prev[crawl];
-        path[path_length++] = crawl;
-    }
-
-    // Print the path in reverse order
-    printf("Shortest path from %d (%s) to %d (%s):\n",
-           start, Vertexs[start]->Name,
-           end, Vertexs[end]->Name);
-    for (int i = path_length - 1; i >= 0; i--) {
-        printf("%-10d %-30s %-12.8f %-12.8f\n",
-        Vertexs[path[i]]->stop_no,
-        Vertexs[path[i]]->Name,
-        Vertexs[path[i]]->Latitude,
-        Vertexs[path[i]]->Longitude);
-    }
-    printf("Total distance: %d\n", distance[end]);
+    for (int crawl = end; crawl != -1; crawl = prev[crawl]) {
+        path_length++;
+    }
+    int i = path_length;
+    for (int crawl = end; crawl != -1; crawl = prev[crawl]) {
+        ws->path[--i] = crawl;
+    }
+    result->length = path_length;
+    INSTR_PHASE_END(PHASE_PATH);
+    return 1;
+}
+
+int distances_from(SearchWorkspace *ws, int start, const int *targets, int num_targets,
+                   int *row, bool stop_early) {
+    int *distance = ws->distance;
+    bool *settled = ws->done[0];
+    // Targets still to be settled are flagged in done[1]
+    bool *wanted = ws->done[1];
+
+    workspace_reset(ws);
+
+    int remaining = 0;
+    for (int j = 0; j < num_targets; j++) {
+        int t = stop_index(targets[j]);
+        if (t < 0 || t >= ws->num_nodes) {
+            continue;
+        }
+        touch(ws, 1, t);
+        if (!wanted[t]) {
+            wanted[t] = true;
+            remaining++;
+        }
+    }
+
+    start = stop_index(start);
+    if (start >= 0 && start < ws->num_nodes) {
+        PQueue *queue = ws->queue[0];
+        touch(ws, 0, start);
+        distance[start] = 0;
+        pq_push(queue, start, 0);
+
+        int u;
+        while ((u = pq_pop(queue, NULL)) != -1) {
+            settled[u] = true;
+            ws->settled++;
+            INSTR_ADD(settled, 1);
+            touch(ws, 1, u);
+            if (wanted[u] && --remaining == 0 && stop_early) {
+                break;
+            }
+            INSTR_ADD(scanned, g->offsets[u + 1] - g->offsets[u]);
+            for (int e = g->offsets[u]; e < g->offsets[u + 1]; e++) {
+                int v = g->neighbors[e];
+                touch(ws, 0, v);
+                if (!settled[v] && distance[u] + g->weights[e] < distance[v]) {
+                    distance[v] = distance[u] + g->weights[e];
+                    pq_push(queue, v, distance[v]);
+                    INSTR_ADD(relaxed, 1);
+                }
+            }
+        }
+    }
+
+    // Only settled distances are final once the search stopped early
+    int reached = 0;
+    for (int j = 0; j < num_targets; j++) {
+        int t = stop_index(targets[j]);
+        if (t >= 0 && t < ws->num_nodes) {
+            touch(ws, 0, t);
+        }
+        bool known = t >= 0 && t < ws->num_nodes && settled[t];
+        row[j] = known ? distance[t] : INT_MAX;
+        reached += known;
+    }
+    return reached;
+}
+
+int isochrone(SearchWorkspace *ws, const int *origins, int num_origins, int budget,
+              int *stop_nos, int *distances, int max) {
+    int *distance = ws->distance;
+    bool *settled = ws->done[0];
+    PQueue *queue = ws->queue[0];
+
+    workspace_reset(ws);
+
+    // Every origin starts at 0, so one search gives the distance to the
+    // nearest of them
+    int known = 0;
+    for (int k = 0; k < num_origins; k++) {
+        int start = stop_index(origins[k]);
+        if (start < 0 || start >= ws->num_nodes || budget < 0) {
+            continue;
+        }
+        touch(ws, 0, start);
+        distance[start] = 0;
+        pq_push(queue, start, 0);
+        known++;
+    }
+    if (known == 0) {
+        return -1;
+    }
+
+    // Stops come off the queue closest first, nothing past the budget is
+    // ever queued so the search ends with the ball
+    int total = 0;
+    int u;
+    while ((u = pq_pop(queue, NULL)) != -1) {
+        settled[u] = true;
+        ws->settled++;
+        INSTR_ADD(settled, 1);
+        if (total < max) {
+            stop_nos[total] = stop_number(u);
+            distances[total] = distance[u];
+        }
+        total++;
+        INSTR_ADD(scanned, g->offsets[u + 1] - g->offsets[u]);
+        for (int e = g->offsets[u]; e < g->offsets[u + 1]; e++) {
+            int v = g->neighbors[e];
+            int through = distance[u] + g->weights[e];
+            if (through > budget) {
+                continue;
+            }
+            touch(ws, 0, v);
+            if (!settled[v] && through < distance[v]) {
+                distance[v] = through;
+                pq_push(queue, v, through);
+                INSTR_ADD(relaxed, 1);
+            }
+        }
+    }
+    return total;
+}
+
+// Workspace used by the single threaded entry points
+static SearchWorkspace *default_workspace(void) {
+    if (!shared_ws) {
+        shared_ws = workspace_create();
+    }
+    return shared_ws;
+}
+
+// Implement Dijkstra's algorithm, or whichever engine is selected
+void dijkstra(int start, int end) {
+    PathResult result;
+    INSTR_RESET();
+    find_path(default_workspace(), start, end, &result);
+    // Print the path found by the search
+    if (!stdout_writer) {
+        stdout_writer = writer_create(stdout, OUTPUT_TEXT);
+    }
+    writer_path(stdout_writer, &result);
+    writer_flush(stdout_writer);
+    INSTR_DUMP("\"query\":\"path\",\"start\":%d,\"end\":%d,\"total\":%d",
+               start, end, result.total == INT_MAX ? -1 : result.total);
 }
 
 // Function to find and print the shortest path
 void shortest_path(int startNode, int endNode) {
-    if (!Vertexs[startNode]) {
+    if (stop_index(startNode) < 0) {
         printf("Start node %d does not exist.\n", startNode);
         return;
     }
-    if (!Vertexs[endNode]) {
+    if (stop_index(endNode) < 0) {
         printf("End node %d does not exist.\n", endNode);
         return;
     }
@@ -329,15 +945,234 @@ void shortest_path(int startNode, int endNode) {
     dijkstra(startNode, endNode);
 }
 
+int nearest_stops(double latitude, double longitude, int k, int *stop_nos, double *metres) {
+    int found = spatial_nearest(&spatial, latitude, longitude, k, stop_nos, metres);
+    for (int i = 0; i < found; i++) {
+        stop_nos[i] = stop_number(stop_nos[i]);
+    }
+    return found;
+}
+
+int stops_within(double latitude, double longitude, double radius, int *stop_nos, double *metres, int max) {
+    int total = spatial_within(&spatial, latitude, longitude, radius, stop_nos, metres, max);
+    for (int i = 0; i < total && i < max; i++) {
+        stop_nos[i] = stop_number(stop_nos[i]);
+    }
+    return total;
+}
+
+// Snaps both positions to their nearest stop and prints the path between them
+void shortest_path_near(double startLat, double startLon, double endLat, double endLon) {
+    int ends[2];
+    double metres[2];
+    if (!spatial_nearest(&spatial, startLat, startLon, 1, &ends[0], &metres[0]) ||
+        !spatial_nearest(&spatial, endLat, endLon, 1, &ends[1], &metres[1])) {
+        printf("No stops loaded\n");
+        return;
+    }
+    printf("Nearest stop to %.6f, %.6f is %d (%s), %.0f m away\n",
+           startLat, startLon, stop_number(ends[0]), stop_name(ends[0]), metres[0]);
+    printf("Nearest stop to %.6f, %.6f is %d (%s), %.0f m away\n",
+           endLat, endLon, stop_number(ends[1]), stop_name(ends[1]), metres[1]);
+    shortest_path(stop_number(ends[0]), stop_number(ends[1]));
+}
+
+// Entry of v in the row of u, -1 if there is no such edge
+static int find_edge(int u, int v) {
+    for (int e = g->offsets[u]; e < g->offsets[u + 1]; e++) {
+        if (g->neighbors[e] == v) {
+            return e;
+        }
+    }
+    return -1;
+}
+
+int update_edge(int fromStop, int toStop, int weight, UpdateReport *report) {
+    struct timespec began, ended;
+    clock_gettime(CLOCK_MONOTONIC, &began);
+    memset(report, 0, sizeof(UpdateReport));
+    int u = stop_index(fromStop);
+    int v = stop_index(toStop);
+    if (!g || u < 0 || v < 0 || u == v || weight < 0) {
+        return 0;
+    }
+    if (g->num_pending) {
+        build_graph(g);
+    }
+
+    int forward = find_edge(u, v);
+    int backward = find_edge(v, u);
+    report->old_weight = forward >= 0 ? g->weights[forward] : 0;
+    report->in_place = forward >= 0 || weight == 0;
+    if (forward >= 0 && weight > 0) {
+        g->weights[forward] = weight;
+        g->weights[backward] = weight;
+    } else if (forward >= 0) {
+        // CSR rows can't shrink in place, a zero weight self loop is never
+        // relaxed and build_graph drops it
+        g->neighbors[forward] = u;
+        g->weights[forward] = 0;
+        g->neighbors[backward] = v;
+        g->weights[backward] = 0;
+        g->num_removed += 2;
+    } else if (weight > 0) {
+        add_edge(g, u, v, weight);
+        build_graph(g);
+    }
+
+    // The hierarchy is rebuilt on the next query that needs it, the A*
+    // scale only has to drop if the new edge is cheaper per metre
+    if (report->old_weight != weight) {
+        ch_free(hierarchy);
+        hierarchy = NULL;
+        if (shared_ws) {
+            ch_workspace_free(shared_ws->hierarchy);
+            shared_ws->hierarchy = NULL;
+        }
+        double metres = stop_distance(u, v);
+        if (astar_scale > 0 && weight > 0 && metres > 0 && weight / metres * 0.999 < astar_scale) {
+            astar_scale = weight / metres * 0.999;
+        }
+    }
+
+    for (int i = 0; i < num_trees; i++) {
+        spt_update(trees[i], g, u, v, report->old_weight, weight);
+        report->trees_repaired += trees[i]->repaired > 0;
+        report->nodes_repaired += trees[i]->repaired;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &ended);
+    report->seconds = (ended.tv_sec - began.tv_sec) + (ended.tv_nsec - began.tv_nsec) / 1e9;
+    return 1;
+}
+
+int edge_weight(int fromStop, int toStop) {
+    int u = stop_index(fromStop);
+    int v = stop_index(toStop);
+    if (!g || u < 0 || v < 0 || u == v) {
+        return 0;
+    }
+    if (g->num_pending) {
+        build_graph(g);
+    }
+    int e = find_edge(u, v);
+    return e >= 0 ? g->weights[e] : 0;
+}
+
+int cache_tree(int stop_no) {
+    int source = stop_index(stop_no);
+    if (!g || source < 0) {
+        return 0;
+    }
+    if (g->num_pending) {
+        build_graph(g);
+    }
+    for (int i = 0; i < num_trees; i++) {
+        if (trees[i]->source == source) {
+            return 1;
+        }
+    }
+    ShortestPathTree **grown = realloc(trees, (num_trees + 1) * sizeof(ShortestPathTree *));
+    if (!grown) {
+        printf("Memory allocation failed for ShortestPathTree\n");
+        return 0;
+    }
+    trees = grown;
+    trees[num_trees++] = spt_create(g, source, queue_kind);
+    return 1;
+}
+
+int last_settled(void) {
+    return shared_ws ? shared_ws->settled : 0;
+}
+
+int search_settled(int startNode, int endNode, SearchMode mode) {
+    int start = stop_index(startNode);
+    int end = stop_index(endNode);
+    if (start < 0 || end < 0) {
+        return 0;
+    }
+    SearchWorkspace *ws = default_workspace();
+    run_search(ws, mode, start, end);
+    return ws->settled;
+}
+
+int path_tree(SearchWorkspace *ws, int startNode, int *distance, int *prev) {
+    int start = stop_index(startNode);
+    if (!g || start < 0) {
+        return -1;
+    }
+    for (int v = 0; v < g->num_nodes; v++) {
+        distance[v] = INT_MAX;
+    }
+
+    // Every node is settled, there is no end to stop at
+    PQueue *queue = ws->queue[0];
+    pq_clear(queue);
+    distance[start] = 0;
+    pq_push(queue, start, 0);
+    int u;
+    while ((u = pq_pop(queue, NULL)) != -1) {
+        INSTR_ADD(settled, 1);
+        INSTR_ADD(scanned, g->offsets[u + 1] - g->offsets[u]);
+        for (int e = g->offsets[u]; e < g->offsets[u + 1]; e++) {
+            int v = g->neighbors[e];
+            // Settled nodes are never closer than u plus a positive weight
+            if (distance[u] + g->weights[e] < distance[v]) {
+                distance[v] = distance[u] + g->weights[e];
+                pq_push(queue, v, distance[v]);
+                INSTR_ADD(relaxed, 1);
+            }
+        }
+    }
+    return tree_parents(g, distance, prev, 0, g->num_nodes);
+}
+
+void set_tree_threads(int threads, int delta) {
+    if (threads != tree_threads) {
+        delta_free(tree_pool);
+        tree_pool = NULL;
+    }
+    tree_threads = threads;
+    tree_delta = delta;
+}
+
+int path_tree_parallel(int startNode, int *distance, int *prev) {
+    int start = stop_index(startNode);
+    if (!g || start < 0) {
+        return -1;
+    }
+    if (!tree_pool) {
+        tree_pool = delta_create(g, thread_count(tree_threads));
+    }
+    return delta_run(tree_pool, start, tree_delta, distance, prev);
+}
+
 // Free all allocated memory
 void free_memory(void) {
+    drop_derived();
+    for (int i = 0; i < num_trees; i++) {
+        spt_free(trees[i]);
+    }
+    free(trees);
+    trees = NULL;
+    num_trees = 0;
     if (g) {
+        if (!g->borrowed) {
+            free(g->offsets);
+            free(g->neighbors);
+            free(g->weights);
+        }
+        free(g->pending);
         free(g);
+        g = NULL;
     }
-    for (int i = 0; i < MAX_GRAPH; i++) {
-        if (Vertexs[i]) {
-            free(Vertexs[i]);
-            Vertexs[i] = NULL;
-        }
+    spatial_free(&spatial);
+    writer_free(stdout_writer);
+    stdout_writer = NULL;
+    // A borrowed table is only emptied, the mapping owns its arrays
+    stops_free(&stops);
+    if (snapshot.map) {
+        snapshot_unmap(&snapshot);
     }
 }
\ No newline at end of file
@@ -1,20 +1,24 @@
 #ifndef T3_H_
 #define T3_H_
 
-#define MAX_GRAPH 10000
+#include <stdio.h>
+#include <stdbool.h>
+#include "t3_heap.h"
+
 #define MAX_STRING_SIZE 100
 #define NEXT_FIELD_FAIL -5
+#define EARTH_RADIUS_M 6371008.8
 
-typedef struct Graph {
-    int graph_ar[MAX_GRAPH][MAX_GRAPH];
-} Graph;
-
-typedef struct Stops {
-    int stop_no;
-    char Name[MAX_STRING_SIZE];
-    float Latitude;
-    float Longitude;
-} Stops;
+// Engines shortest_path can use, they all find a shortest path. Of several
+// equally short ones the bidirectional search and the hierarchy can give
+// other stops than Dijkstra's search, they keep the first meeting point
+// and the path its shortcuts unpack to.
+typedef enum SearchMode {
+    SEARCH_DIJKSTRA,
+    SEARCH_ASTAR, // goal directed using the stop coordinates
+    SEARCH_BIDIRECTIONAL, // searches from both ends at once
+    SEARCH_CH // contraction hierarchy, preprocessed by prepare_search
+} SearchMode;
 
 typedef struct Edge {
     int from;
@@ -22,9 +26,117 @@ typedef struct Edge {
     int weight;
 } Edge;
 
+// Compressed sparse row adjacency store over stop indices, the neighbours of node i are
+// neighbors[offsets[i]] .. neighbors[offsets[i + 1] - 1] with matching weights
+typedef struct Graph {
+    int num_nodes;
+    int num_edges; // directed entries, every undirected edge is stored twice
+    int *offsets;
+    int *neighbors;
+    int *weights;
+    int borrowed; // the arrays belong to a snapshot mapping and are not freed
+    int num_removed; // entries update_edge turned into zero weight self loops
+    // Edges added since the last build, merged in by build_graph
+    Edge *pending;
+    int num_pending;
+    int pending_cap;
+} Graph;
+
+// Scratch space for one search at a time, give every thread its own
+// Entries are only valid where stamp matches epoch, so starting a search
+// costs O(1) instead of clearing every array
+typedef struct SearchWorkspace {
+    int num_nodes;
+    unsigned int *stamp[2]; // one per search direction
+    unsigned int epoch;
+    int *distance;
+    int *prev;
+    int *distance_back; // backward half of a bidirectional search
+    int *next;
+    int *estimate;      // A* heuristic of every reached node
+    bool *done[2];
+    int *path;
+    PQueue *queue[2];
+    struct ChWorkspace *hierarchy; // created on the first contraction hierarchy query
+    int settled;        // nodes settled by the last search
+} SearchWorkspace;
+
+// What one update_edge call did
+typedef struct UpdateReport {
+    int old_weight; // 0 if there was no edge
+    int in_place; // 0 when a new edge had to be merged in with build_graph
+    int trees_repaired; // cached trees the change reached
+    int nodes_repaired; // nodes those repairs looked at again
+    double seconds; // until every cached tree and the graph agree with the change
+} UpdateReport;
+
+// A path found by find_path, start and end are stop numbers and stops holds
+// stop indices. stops points into the workspace and is only valid until the
+// workspace is used again
+typedef struct PathResult {
+    int start;
+    int end;
+    int total;  // INT_MAX if there is no path
+    int length;
+    int *stops;
+    int settled;
+} PathResult;
+
 int load_edges ( char *fname ); //loads the edges from the CSV file of name fname
 int load_vertices ( char *fname );  //loads the vertices from the CSV file of name fname
+void set_load_threads ( int threads ); // threads load_vertices and load_edges parse on, every online CPU by default
+int save_snapshot ( char *fname ); // writes the loaded graph and stops to a binary snapshot
+int load_snapshot ( char *fname ); // maps a snapshot written by save_snapshot in place of the CSV files
+
+// Stops are numbered 0 .. num_stops() - 1 inside the graph, these convert
+// to and from the stop numbers used in the CSV files
+int num_stops ( void );
+int num_edges ( void ); // undirected edges in the loaded graph
+int stop_index ( int stop_no ); // index of a stop number, -1 if there is no such stop
+int stop_number ( int index );
+const char *stop_name ( int index );
+float stop_latitude ( int index );
+float stop_longitude ( int index );
 void shortest_path(int startNode, int endNode); // prints the shortest path between startNode and endNode, if there is any
+void shortest_path_near(double startLat, double startLon, double endLat, double endLon); // shortest_path between the stops nearest two positions
+// up to k stops nearest a position, closest first, metres gets their distance, returns how many
+int nearest_stops(double latitude, double longitude, int k, int *stop_nos, double *metres);
+// stops within radius metres of a position, closest first, writes at most max and returns how many there are
+int stops_within(double latitude, double longitude, double radius, int *stop_nos, double *metres, int max);
+void set_queue_kind(PQKind kind); // selects the priority queue used by shortest_path (binary heap by default)
+void set_search_mode(SearchMode mode); // selects the engine used by shortest_path (Dijkstra by default)
+void prepare_graph(void); // folds added edges into the graph, searches on several threads need it done first
+void prepare_search(void); // runs any preprocessing the selected engine needs, otherwise done on the first query
+int search_mode_from_name(const char *name); // parses an engine name such as "astar", -1 if unknown
+int last_settled(void); // number of nodes the last shortest_path settled
+int search_settled(int startNode, int endNode, SearchMode mode); // runs a search without printing and returns the nodes it settled
+
+SearchWorkspace *workspace_create(void); // allocates a workspace sized for the loaded graph
+void workspace_free(SearchWorkspace *ws);
+int find_path(SearchWorkspace *ws, int startNode, int endNode, PathResult *result); // fills result, returns 0 if there is no path
+// one search from start, row[j] gets the distance to targets[j] or INT_MAX, returns how many were reached
+// with stop_early the search ends as soon as every target is settled
+int distances_from(SearchWorkspace *ws, int start, const int *targets, int num_targets, int *row, bool stop_early);
+// stops within budget of the nearest of the origin stops, closest first and
+// then by stop index. Only that ball is searched. Writes at most max stop
+// numbers and distances and returns how many there are, -1 if no origin exists
+int isochrone(SearchWorkspace *ws, const int *origins, int num_origins, int budget,
+              int *stop_nos, int *distances, int max);
+// sets the weight of the edge between two stops, 0 removes it, returns 0 for unknown stops
+// not safe while other threads are searching
+int update_edge(int fromStop, int toStop, int weight, UpdateReport *report);
+int edge_weight(int fromStop, int toStop); // weight of the edge between two stops, 0 if there is none
+int cache_tree(int stop_no); // keeps a shortest path tree from stop_no up to date, find_path answers from it
+// Whole shortest path tree from a stop: distance[i] and prev[i] for every
+// stop index i, INT_MAX and -1 where it can't be reached. Of several
+// equally short ways into a stop prev takes the neighbour with the lowest
+// distance, then the lowest index, so both engines give the same tree.
+// Return the stops reached, -1 for an unknown stop.
+int path_tree(SearchWorkspace *ws, int startNode, int *distance, int *prev); // sequential Dijkstra
+int path_tree_parallel(int startNode, int *distance, int *prev); // delta stepping, one call at a time
+// threads and bucket width for path_tree_parallel, 0 picks every online CPU and the mean edge weight.
+// Widths under a quarter of the mean edge weight are raised to it.
+void set_tree_threads(int threads, int delta);
 void free_memory ( void ) ; // frees any memory that was used
 
 #endif
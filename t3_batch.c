@@ -0,0 +1,281 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include "t3.h"
+#include "t3_batch.h"
+#include "instrument.h"
+
+// Queries read and answered per round, bounds the memory held by answers
+#define BATCH_BLOCK 65536
+
+typedef struct BatchAnswer {
+    int total;
+    int length;
+    int *stops;
+} BatchAnswer;
+
+// Shared by the workers of one round
+typedef struct BatchRound {
+    RouteQuery *queries;
+    BatchAnswer *answers;
+    int count;
+    int next; // next query to hand out, taken atomically
+} BatchRound;
+
+typedef struct BatchWorker {
+    pthread_t thread;
+    SearchWorkspace *ws;
+    BatchRound *round;
+} BatchWorker;
+
+static void *batch_worker(void *arg) {
+    BatchWorker *worker = arg;
+    BatchRound *round = worker->round;
+    PathResult result;
+
+    while (1) {
+        int i = __atomic_fetch_add(&round->next, 1, __ATOMIC_RELAXED);
+        if (i >= round->count) {
+            break;
+        }
+        BatchAnswer *answer = &round->answers[i];
+        INSTR_RESET();
+        find_path(worker->ws, round->queries[i].start, round->queries[i].end, &result);
+        INSTR_DUMP("\"query\":\"batch\",\"start\":%d,\"end\":%d,\"total\":%d",
+                   result.start, result.end, result.total == INT_MAX ? -1 : result.total);
+        answer->total = result.total;
+        answer->length = result.length;
+        answer->stops = NULL;
+        if (result.length > 0) {
+            // The path lives in the workspace, keep a copy until it is written
+            answer->stops = malloc(result.length * sizeof(int));
+            if (!answer->stops) {
+                printf("Memory allocation failed for batch answer\n");
+                exit(EXIT_FAILURE);
+            }
+            memcpy(answer->stops, result.stops, result.length * sizeof(int));
+        }
+    }
+    return NULL;
+}
+
+int parse_route_query(const char *line, RouteQuery *query) {
+    char *end;
+    while (*line && *line != '-' && (*line < '0' || *line > '9')) {
+        line++;
+    }
+    long start = strtol(line, &end, 10);
+    if (end == line) {
+        return 0;
+    }
+    line = end;
+    while (*line && *line != '-' && (*line < '0' || *line > '9')) {
+        line++;
+    }
+    long finish = strtol(line, &end, 10);
+    if (end == line) {
+        return 0;
+    }
+    query->start = (int)start;
+    query->end = (int)finish;
+    return 1;
+}
+
+long answer_batch(FILE *in, FILE *out, OutputFormat format, int threads) {
+    if (threads < 1) {
+        threads = 1;
+    }
+    // Lazy preprocessing is not thread safe, get it out of the way
+    prepare_search();
+
+    BatchRound round;
+    round.queries = malloc(BATCH_BLOCK * sizeof(RouteQuery));
+    round.answers = malloc(BATCH_BLOCK * sizeof(BatchAnswer));
+    BatchWorker *workers = malloc(threads * sizeof(BatchWorker));
+    if (!round.queries || !round.answers || !workers) {
+        printf("Memory allocation failed for batch\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int t = 0; t < threads; t++) {
+        workers[t].ws = workspace_create();
+        workers[t].round = &round;
+    }
+
+    PathWriter *writer = writer_create(out, format);
+    char line[256];
+    long answered = 0;
+    int more = 1;
+    while (more) {
+        // Read the next block of queries
+        round.count = 0;
+        round.next = 0;
+        while (round.count < BATCH_BLOCK) {
+            if (!fgets(line, sizeof(line), in)) {
+                more = 0;
+                break;
+            }
+            if (parse_route_query(line, &round.queries[round.count])) {
+                round.count++;
+            }
+        }
+        if (round.count == 0) {
+            break;
+        }
+
+        for (int t = 0; t < threads; t++) {
+            if (pthread_create(&workers[t].thread, NULL, batch_worker, &workers[t]) != 0) {
+                printf("Unable to start batch worker\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        for (int t = 0; t < threads; t++) {
+            pthread_join(workers[t].thread, NULL);
+        }
+
+        // Write the answers back in input order
+        PathResult result;
+        for (int i = 0; i < round.count; i++) {
+            result.start = round.queries[i].start;
+            result.end = round.queries[i].end;
+            result.total = round.answers[i].total;
+            result.length = round.answers[i].length;
+            result.stops = round.answers[i].stops;
+            result.settled = 0;
+            writer_path(writer, &result);
+            free(round.answers[i].stops);
+        }
+        answered += round.count;
+    }
+
+    if (!writer_free(writer)) {
+        printf("Failed to write batch results\n");
+    }
+    for (int t = 0; t < threads; t++) {
+        workspace_free(workers[t].ws);
+    }
+    free(workers);
+    free(round.queries);
+    free(round.answers);
+    return answered;
+}
+
+// Shared by the workers building a distance table
+typedef struct TableJob {
+    const int *sources;
+    int num_sources;
+    const int *targets;
+    int num_targets;
+    int *table;
+    int stop_early;
+    int next; // next source to hand out, taken atomically
+} TableJob;
+
+typedef struct TableWorker {
+    pthread_t thread;
+    TableJob *job;
+} TableWorker;
+
+static void *table_worker(void *arg) {
+    TableJob *job = ((TableWorker *)arg)->job;
+    SearchWorkspace *ws = workspace_create();
+    while (1) {
+        int i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if (i >= job->num_sources) {
+            break;
+        }
+        distances_from(ws, job->sources[i], job->targets, job->num_targets,
+                       job->table + (long)i * job->num_targets, job->stop_early);
+    }
+    workspace_free(ws);
+    return NULL;
+}
+
+void distance_table(const int *sources, int num_sources, const int *targets, int num_targets,
+                    int *table, int threads, int stop_early) {
+    if (threads < 1) {
+        threads = 1;
+    }
+    if (threads > num_sources) {
+        threads = num_sources > 0 ? num_sources : 1;
+    }
+    // Tables run their own searches whatever the engine, only the graph
+    // has to be ready
+    prepare_graph();
+
+    TableJob job = { sources, num_sources, targets, num_targets, table, stop_early, 0 };
+    TableWorker *workers = malloc(threads * sizeof(TableWorker));
+    if (!workers) {
+        printf("Memory allocation failed for distance table\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int t = 0; t < threads; t++) {
+        workers[t].job = &job;
+        if (pthread_create(&workers[t].thread, NULL, table_worker, &workers[t]) != 0) {
+            printf("Unable to start distance table worker\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int t = 0; t < threads; t++) {
+        pthread_join(workers[t].thread, NULL);
+    }
+    free(workers);
+}
+
+void write_distance_table(FILE *out, const int *sources, int num_sources, const int *targets,
+                          int num_targets, const int *table) {
+    fputs("source", out);
+    for (int j = 0; j < num_targets; j++) {
+        fprintf(out, ",%d", targets[j]);
+    }
+    fputc('\n', out);
+    for (int i = 0; i < num_sources; i++) {
+        fprintf(out, "%d", sources[i]);
+        for (int j = 0; j < num_targets; j++) {
+            int d = table[(long)i * num_targets + j];
+            fprintf(out, ",%d", d == INT_MAX ? -1 : d);
+        }
+        fputc('\n', out);
+    }
+}
+
+int read_stop_list(FILE *in, int **stops) {
+    int count = 0;
+    int cap = 64;
+    int *list = malloc(cap * sizeof(int));
+    int c;
+    int value = 0;
+    int in_number = 0;
+    if (!list) {
+        printf("Memory allocation failed for stop list\n");
+        exit(EXIT_FAILURE);
+    }
+    // Any run of digits is a stop number, everything else separates them
+    while (1) {
+        c = fgetc(in);
+        if (c >= '0' && c <= '9') {
+            value = value * 10 + (c - '0');
+            in_number = 1;
+            continue;
+        }
+        if (in_number) {
+            if (count == cap) {
+                cap *= 2;
+                list = realloc(list, cap * sizeof(int));
+                if (!list) {
+                    printf("Memory allocation failed for stop list\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            list[count++] = value;
+            value = 0;
+            in_number = 0;
+        }
+        if (c == EOF) {
+            break;
+        }
+    }
+    *stops = list;
+    return count;
+}
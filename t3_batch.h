@@ -0,0 +1,30 @@
+#ifndef T3_BATCH_H_
+#define T3_BATCH_H_
+
+#include <stdio.h>
+#include "t3_writer.h"
+
+typedef struct RouteQuery {
+    int start;
+    int end;
+} RouteQuery;
+
+// Pulls two numbers out of a line, separated by anything that isn't a digit
+// Returns 0 if the line doesn't have two
+int parse_route_query(const char *line, RouteQuery *query);
+
+// Reads "start,end" lines from in, answers them on threads workers and
+// writes one result per query to out in input order, in the given format
+// Lines without two numbers are skipped. Returns the number of queries answered.
+long answer_batch(FILE *in, FILE *out, OutputFormat format, int threads);
+
+// Fills table[i * num_targets + j] with the distance from sources[i] to
+// targets[j], INT_MAX where there is no path. Runs one search per source,
+// spread over threads; with stop_early a search ends once all targets are settled.
+void distance_table(const int *sources, int num_sources, const int *targets, int num_targets,
+                    int *table, int threads, int stop_early);
+void write_distance_table(FILE *out, const int *sources, int num_sources, const int *targets,
+                          int num_targets, const int *table); // CSV with a header row, -1 for no path
+int read_stop_list(FILE *in, int **stops); // reads every number in the file, returns the count
+
+#endif
@@ -0,0 +1,341 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "t3.h"
+#include "t3_gen.h"
+
+// Benchmark for the t3 route engines
+//   bus_bench VERTICES EDGES [OPTIONS]
+//   bus_bench --generate grid|geometric|scalefree --nodes N [OPTIONS]
+// Every run appends one JSON object per line to --out (bench.json by
+// default) so runs of different engines and builds can be compared.
+
+#ifndef BENCH_CFLAGS
+#define BENCH_CFLAGS ""
+#endif
+
+static void usage(void) {
+    printf("usage: ./bus_bench VERTICES EDGES [OPTIONS]\n");
+    printf("       ./bus_bench --generate grid|geometric|scalefree --nodes N [OPTIONS]\n");
+    printf("options:\n");
+    printf("  --engine dijkstra|astar|bidir|ch  search engine (default dijkstra)\n");
+    printf("  --heap binary|4ary|radix          priority queue (default binary)\n");
+    printf("  --queries N                       random queries to time (default 1000)\n");
+    printf("  --seed N                          seed for the queries and generated graphs\n");
+    printf("  --out FILE                        JSON lines file to append to (default bench.json)\n");
+    printf("  --trees N                         also time N whole shortest path trees, Dijkstra against\n");
+    printf("                                    delta stepping on every thread count 1 .. --threads\n");
+    printf("  --threads N                       most threads for --trees (default every online CPU)\n");
+    printf("  --delta N                         delta stepping bucket width (default the mean edge weight,\n");
+    printf("                                    at least a quarter of it)\n");
+    printf("  --verify                          check every query gives a path as short as dijkstra's\n");
+}
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+// Resident set size in KB, peak when peak is set
+static long memory_kb(int peak) {
+    if (peak) {
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_maxrss;
+    }
+    long pages = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f) {
+        if (fscanf(f, "%*s %ld", &pages) != 1) {
+            pages = 0;
+        }
+        fclose(f);
+    }
+    return pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Percentile of sorted values, nearest rank
+static double percentile(const double *sorted, int count, double p) {
+    int rank = (int)(p / 100.0 * count + 0.999999);
+    if (rank < 1) {
+        rank = 1;
+    }
+    return sorted[(rank > count ? count : rank) - 1];
+}
+
+// Runs the benchmark's queries again with the engine and with Dijkstra and
+// counts those where the engine's answer is not a shortest path: a wrong
+// total, or stops that don't run from start to end over edges adding up
+// to it. Equally short paths through other stops are fine.
+static int verify_paths(int queries, unsigned int seed, int mode) {
+    int n = num_stops();
+    SearchWorkspace *ws = workspace_create();
+    SearchWorkspace *reference = workspace_create();
+    int differ = 0;
+    srand(seed);
+    for (int q = 0; q < queries; q++) {
+        int start = stop_number(rand() % n);
+        int end = stop_number(rand() % n);
+        PathResult result;
+        PathResult expected;
+        set_search_mode(mode);
+        find_path(ws, start, end, &result);
+        set_search_mode(SEARCH_DIJKSTRA);
+        find_path(reference, start, end, &expected);
+        int valid = result.total == expected.total;
+        if (valid && result.total != INT_MAX) {
+            int length = 0;
+            valid = result.length > 0 && stop_number(result.stops[0]) == start &&
+                    stop_number(result.stops[result.length - 1]) == end;
+            for (int i = 1; valid && i < result.length; i++) {
+                int w = edge_weight(stop_number(result.stops[i - 1]), stop_number(result.stops[i]));
+                valid = w > 0;
+                length += w;
+            }
+            valid = valid && length == result.total;
+        }
+        if (!valid && differ++ < 10) {
+            printf("Path %d -> %d is not a shortest path\n", start, end);
+        }
+    }
+    set_search_mode(mode);
+    workspace_free(ws);
+    workspace_free(reference);
+    return differ;
+}
+
+// Times path_tree against path_tree_parallel from the same random stops
+// and checks they give the same trees, one JSON line per engine and thread
+// count
+static void bench_trees(FILE *out, const char *graph_name, int trees, int max_threads,
+                        int delta, unsigned int seed) {
+    int n = num_stops();
+    int *distance[2];
+    int *prev[2];
+    int *sources = malloc(trees * sizeof(int));
+    distance[0] = malloc(n * sizeof(int));
+    distance[1] = malloc(n * sizeof(int));
+    prev[0] = malloc(n * sizeof(int));
+    prev[1] = malloc(n * sizeof(int));
+    if (!sources || !distance[0] || !distance[1] || !prev[0] || !prev[1]) {
+        printf("Memory allocation failed for trees\n");
+        exit(EXIT_FAILURE);
+    }
+    srand(seed + 1);
+    for (int q = 0; q < trees; q++) {
+        sources[q] = stop_number(rand() % n);
+    }
+
+    // Every thread count from 1 up, 0 stands for the sequential engine
+    SearchWorkspace *ws = workspace_create();
+    double sequential = 0;
+    for (int threads = 0; threads <= max_threads; threads++) {
+        double seconds = 0;
+        long reached = 0;
+        int mismatches = 0;
+        set_tree_threads(threads, delta);
+        for (int q = 0; q < trees; q++) {
+            double t = now();
+            if (threads == 0) {
+                reached += path_tree(ws, sources[q], distance[0], prev[0]);
+            } else {
+                reached += path_tree_parallel(sources[q], distance[1], prev[1]);
+            }
+            seconds += now() - t;
+            if (threads == 0) {
+                continue;
+            }
+            // Every tree has to match the sequential one exactly
+            path_tree(ws, sources[q], distance[0], prev[0]);
+            mismatches += memcmp(distance[0], distance[1], n * sizeof(int)) != 0 ||
+                          memcmp(prev[0], prev[1], n * sizeof(int)) != 0;
+        }
+        if (threads == 0) {
+            sequential = seconds;
+        }
+        const char *engine = threads ? "tree-delta" : "tree-dijkstra";
+        fprintf(out, "{\"graph\":\"%s\",\"nodes\":%d,\"edges\":%d,\"engine\":\"%s\",\"threads\":%d,"
+                     "\"delta\":%d,\"cflags\":\"%s\",\"trees\":%d,\"mean_reached\":%.1f,"
+                     "\"mean_ms\":%.3f,\"speedup\":%.2f,\"mismatches\":%d}\n",
+                graph_name, n, num_edges(), engine, threads ? threads : 1, delta, BENCH_CFLAGS,
+                trees, (double)reached / trees, seconds / trees * 1e3,
+                seconds > 0 ? sequential / seconds : 0, mismatches);
+        printf("%s %s on %d threads: %.3f ms per tree, %.2fx, %d mismatches\n",
+               graph_name, engine, threads ? threads : 1, seconds / trees * 1e3,
+               seconds > 0 ? sequential / seconds : 0, mismatches);
+    }
+    workspace_free(ws);
+    free(sources);
+    free(distance[0]);
+    free(distance[1]);
+    free(prev[0]);
+    free(prev[1]);
+}
+
+int main(int argc, char *argv[]) {
+    char *files[2];
+    int num_files = 0;
+    const char *kind = NULL;
+    int nodes = 0;
+    const char *engine = "dijkstra";
+    const char *heap = "binary";
+    int queries = 1000;
+    unsigned int seed = 1;
+    const char *out_name = "bench.json";
+    int trees = 0;
+    int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int delta = 0;
+    int verify = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--generate") == 0 && i + 1 < argc) {
+            kind = argv[++i];
+        } else if (strcmp(argv[i], "--nodes") == 0 && i + 1 < argc) {
+            nodes = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--engine") == 0 && i + 1 < argc) {
+            engine = argv[++i];
+        } else if (strcmp(argv[i], "--heap") == 0 && i + 1 < argc) {
+            heap = argv[++i];
+        } else if (strcmp(argv[i], "--queries") == 0 && i + 1 < argc) {
+            queries = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+            out_name = argv[++i];
+        } else if (strcmp(argv[i], "--trees") == 0 && i + 1 < argc) {
+            trees = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--delta") == 0 && i + 1 < argc) {
+            delta = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--verify") == 0) {
+            verify = 1;
+        } else if (argv[i][0] != '-' && num_files < 2) {
+            files[num_files++] = argv[i];
+        } else {
+            usage();
+            return EXIT_FAILURE;
+        }
+    }
+    int mode = search_mode_from_name(engine);
+    int queue = pq_kind_from_name(heap);
+    if ((kind ? nodes < 1 : num_files < 2) || mode < 0 || queue < 0 || queries < 1 ||
+        trees < 0 || threads < 1 || delta < 0) {
+        usage();
+        return EXIT_FAILURE;
+    }
+    set_search_mode(mode);
+    set_queue_kind(queue);
+
+    // Generated graphs go through the same CSV loader as the real data
+    char generated[2][256];
+    const char *graph_name = files[1];
+    double generate_seconds = 0;
+    if (kind) {
+        const char *dir = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+        snprintf(generated[0], sizeof(generated[0]), "%s/bench_%s_%d_vertices.csv", dir, kind, nodes);
+        snprintf(generated[1], sizeof(generated[1]), "%s/bench_%s_%d_edges.csv", dir, kind, nodes);
+        double began = now();
+        if (generate_graph(kind, nodes, seed, generated[0], generated[1]) < 0) {
+            return EXIT_FAILURE;
+        }
+        generate_seconds = now() - began;
+        files[0] = generated[0];
+        files[1] = generated[1];
+        graph_name = kind;
+    }
+
+    long base_kb = memory_kb(0);
+    double began = now();
+    if (!load_vertices(files[0]) || !load_edges(files[1])) {
+        printf("Failed to load the graph\n");
+        return EXIT_FAILURE;
+    }
+    double load_seconds = now() - began;
+    long loaded_kb = memory_kb(0);
+    if (kind) {
+        remove(generated[0]);
+        remove(generated[1]);
+    }
+
+    began = now();
+    prepare_search();
+    double prepare_seconds = now() - began;
+    long prepared_kb = memory_kb(0);
+
+    // Random stop pairs, the same for every engine with the same seed
+    int n = num_stops();
+    double *latency = malloc(queries * sizeof(double));
+    SearchWorkspace *ws = workspace_create();
+    if (!latency || n == 0) {
+        printf("Nothing to benchmark\n");
+        return EXIT_FAILURE;
+    }
+    srand(seed);
+    long settled = 0;
+    int reached = 0;
+    long long checksum = 0;
+    for (int q = 0; q < queries; q++) {
+        int start = stop_number(rand() % n);
+        int end = stop_number(rand() % n);
+        PathResult result;
+        double t = now();
+        find_path(ws, start, end, &result);
+        latency[q] = now() - t;
+        settled += result.settled;
+        if (result.total != INT_MAX) {
+            reached++;
+            checksum += result.total;
+        }
+    }
+    workspace_free(ws);
+
+    double total = 0;
+    for (int q = 0; q < queries; q++) {
+        total += latency[q];
+    }
+    qsort(latency, queries, sizeof(double), compare_double);
+
+    FILE *out = fopen(out_name, "a");
+    if (!out) {
+        printf("Unable to open %s\n", out_name);
+        return EXIT_FAILURE;
+    }
+    fprintf(out, "{\"graph\":\"%s\",\"nodes\":%d,\"edges\":%d,\"engine\":\"%s\",\"heap\":\"%s\","
+                 "\"cflags\":\"%s\",\"generate_s\":%.4f,\"load_s\":%.4f,\"prepare_s\":%.4f,"
+                 "\"graph_kb\":%ld,\"prepared_kb\":%ld,\"peak_kb\":%ld,"
+                 "\"queries\":%d,\"reached\":%d,\"mean_settled\":%.1f,\"distance_sum\":%lld,"
+                 "\"mean_us\":%.2f,\"p50_us\":%.2f,\"p99_us\":%.2f,\"max_us\":%.2f}\n",
+            graph_name, n, num_edges(), engine, heap, BENCH_CFLAGS,
+            generate_seconds, load_seconds, prepare_seconds,
+            loaded_kb - base_kb, prepared_kb - base_kb, memory_kb(1),
+            queries, reached, (double)settled / queries, checksum,
+            total / queries * 1e6, percentile(latency, queries, 50) * 1e6,
+            percentile(latency, queries, 99) * 1e6, latency[queries - 1] * 1e6);
+    printf("%s %s/%s: load %.3f s, p50 %.1f us, p99 %.1f us, max %.1f us\n",
+           graph_name, engine, heap, load_seconds, percentile(latency, queries, 50) * 1e6,
+           percentile(latency, queries, 99) * 1e6, latency[queries - 1] * 1e6);
+    if (trees > 0) {
+        bench_trees(out, graph_name, trees, threads, delta, seed);
+    }
+    fclose(out);
+    int differ = verify ? verify_paths(queries, seed, mode) : 0;
+    if (verify) {
+        printf("%s %s: %d of %d paths are not shortest paths\n", graph_name, engine, differ, queries);
+    }
+
+    free(latency);
+    free_memory();
+    return differ ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,523 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include "t3_ch.h"
+
+// Nodes settled by one witness search before it gives up and arcs a
+// witness may have, a search that stops early only costs an unnecessary
+// shortcut
+#define WITNESS_SETTLE_LIMIT 500
+#define WITNESS_HOP_LIMIT 5
+// The same for the searches that only estimate a node's priority
+#define ESTIMATE_SETTLE_LIMIT 100
+#define ESTIMATE_HOP_LIMIT 2
+// Weight of the edge difference against the contracted neighbours
+#define EDGE_DIFFERENCE_WEIGHT 5
+// Priorities can be negative, the queue wants non-negative keys
+#define PRIORITY_OFFSET (1 << 20)
+
+typedef struct ChArc {
+    int to;
+    int weight;
+    int middle;
+} ChArc;
+
+typedef struct ChList {
+    ChArc *arcs;
+    int size;
+    int cap;
+} ChList;
+
+// Working state while contracting
+typedef struct ChBuilder {
+    int n;
+    ChList *lists;      // arcs to every uncontracted neighbour
+    int *deleted;       // contracted neighbours of every node
+    int *priority;      // current priority of every uncontracted node
+    char *stale;        // a neighbour was contracted since the priority was worked out
+    // Witness search scratch space
+    int *dist;
+    int *hops;          // arcs on the path dist was found over
+    int *touched;
+    int num_touched;
+    char *target;       // nodes the search is looking for
+    PQueue *queue;
+    // Shortcuts found by the last contract_node call
+    ChArc *found;
+    int *found_from;
+    int num_found;
+    int found_cap;
+} ChBuilder;
+
+static void *ch_alloc(size_t size) {
+    void *p = malloc(size ? size : 1);
+    if (!p) {
+        printf("Memory allocation failed for contraction hierarchy\n");
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Slot of the arc to node to in a list kept sorted by target, or the slot
+// it would go in
+static int list_find(const ChList *list, int to) {
+    int low = 0;
+    int high = list->size;
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (list->arcs[mid].to < to) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+// Add an arc or lower the weight of the existing one
+static void list_put(ChList *list, int to, int weight, int middle) {
+    int at = list_find(list, to);
+    if (at < list->size && list->arcs[at].to == to) {
+        if (weight < list->arcs[at].weight) {
+            list->arcs[at].weight = weight;
+            list->arcs[at].middle = middle;
+        }
+        return;
+    }
+    if (list->size == list->cap) {
+        list->cap = list->cap ? list->cap * 2 : 4;
+        list->arcs = realloc(list->arcs, list->cap * sizeof(ChArc));
+        if (!list->arcs) {
+            printf("Memory allocation failed for contraction hierarchy\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    memmove(&list->arcs[at + 1], &list->arcs[at], (list->size - at) * sizeof(ChArc));
+    list->arcs[at].to = to;
+    list->arcs[at].weight = weight;
+    list->arcs[at].middle = middle;
+    list->size++;
+}
+
+// Drop the arc to a contracted node
+static void list_remove(ChList *list, int to) {
+    int at = list_find(list, to);
+    if (at < list->size && list->arcs[at].to == to) {
+        memmove(&list->arcs[at], &list->arcs[at + 1], (list->size - at - 1) * sizeof(ChArc));
+        list->size--;
+    }
+}
+
+// Dijkstra from source over uncontracted nodes, never entering skip and
+// following at most max_hops arcs, until the targets or everything within
+// limit is settled or the settle budget runs out
+static void witness_search(ChBuilder *b, int source, int skip, int limit, int targets, int budget,
+                           int max_hops) {
+    // Undo the previous search
+    for (int i = 0; i < b->num_touched; i++) {
+        b->dist[b->touched[i]] = INT_MAX;
+    }
+    b->num_touched = 0;
+    pq_clear(b->queue);
+
+    b->dist[source] = 0;
+    b->hops[source] = 0;
+    b->touched[b->num_touched++] = source;
+    pq_push(b->queue, source, 0);
+
+    int settled = 0;
+    int key;
+    int u;
+    while ((u = pq_pop(b->queue, &key)) != -1) {
+        if (key > limit || ++settled > budget) {
+            break;
+        }
+        if (b->target[u] && --targets == 0) {
+            break;
+        }
+        if (b->hops[u] == max_hops) {
+            continue;
+        }
+        ChList *list = &b->lists[u];
+        for (int i = 0; i < list->size; i++) {
+            int v = list->arcs[i].to;
+            if (v == skip) {
+                continue;
+            }
+            int d = key + list->arcs[i].weight;
+            // Nothing past limit can be a witness
+            if (d <= limit && d < b->dist[v]) {
+                if (b->dist[v] == INT_MAX) {
+                    b->touched[b->num_touched++] = v;
+                }
+                b->dist[v] = d;
+                b->hops[v] = b->hops[u] + 1;
+                // At the hop limit only the targets need to be settled
+                if (b->hops[v] < max_hops || b->target[v]) {
+                    pq_push(b->queue, v, d);
+                }
+            }
+        }
+    }
+}
+
+// Work out the shortcuts needed to remove v, they are left in b->found
+static void find_shortcuts(ChBuilder *b, int v, int budget, int max_hops) {
+    ChList *list = &b->lists[v];
+    b->num_found = 0;
+
+    for (int i = 0; i < list->size; i++) {
+        int u = list->arcs[i].to;
+        // Each pair is checked once, from its lower numbered end, which
+        // comes first in the sorted list
+        int limit = -1;
+        for (int j = i + 1; j < list->size; j++) {
+            b->target[list->arcs[j].to] = 1;
+            if (list->arcs[i].weight + list->arcs[j].weight > limit) {
+                limit = list->arcs[i].weight + list->arcs[j].weight;
+            }
+        }
+        if (limit < 0) {
+            continue;
+        }
+
+        witness_search(b, u, v, limit, list->size - i - 1, budget, max_hops);
+        for (int j = i + 1; j < list->size; j++) {
+            int w = list->arcs[j].to;
+            b->target[w] = 0;
+            int via = list->arcs[i].weight + list->arcs[j].weight;
+            // No path around v is as short, so the path through v must be kept
+            if (b->dist[w] > via) {
+                if (b->num_found == b->found_cap) {
+                    b->found_cap = b->found_cap ? b->found_cap * 2 : 16;
+                    b->found = realloc(b->found, b->found_cap * sizeof(ChArc));
+                    b->found_from = realloc(b->found_from, b->found_cap * sizeof(int));
+                    if (!b->found || !b->found_from) {
+                        printf("Memory allocation failed for contraction hierarchy\n");
+                        exit(EXIT_FAILURE);
+                    }
+                }
+                b->found_from[b->num_found] = u;
+                b->found[b->num_found].to = w;
+                b->found[b->num_found].weight = via;
+                b->found[b->num_found].middle = v;
+                b->num_found++;
+            }
+        }
+    }
+}
+
+// Edge difference plus contracted neighbours, lower is contracted sooner
+static int node_priority(ChBuilder *b, int v) {
+    find_shortcuts(b, v, ESTIMATE_SETTLE_LIMIT, ESTIMATE_HOP_LIMIT);
+    return EDGE_DIFFERENCE_WEIGHT * (b->num_found - b->lists[v].size) + b->deleted[v] + PRIORITY_OFFSET;
+}
+
+ContractionHierarchy *ch_build(const Graph *g) {
+    double started = now_seconds();
+    int n = g->num_nodes;
+
+    ChBuilder b;
+    memset(&b, 0, sizeof(b));
+    b.n = n;
+    b.lists = calloc(n, sizeof(ChList));
+    b.deleted = calloc(n, sizeof(int));
+    b.priority = ch_alloc(n * sizeof(int));
+    b.dist = ch_alloc(n * sizeof(int));
+    b.hops = ch_alloc(n * sizeof(int));
+    b.touched = ch_alloc(n * sizeof(int));
+    b.target = calloc(n ? n : 1, 1);
+    b.stale = calloc(n ? n : 1, 1);
+    b.queue = pq_create(PQ_QUATERNARY, n);
+    if (!b.lists || !b.deleted || !b.target || !b.stale) {
+        printf("Memory allocation failed for contraction hierarchy\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < n; i++) {
+        b.dist[i] = INT_MAX;
+        for (int e = g->offsets[i]; e < g->offsets[i + 1]; e++) {
+            // Edges removed by update_edge are left as self loops
+            if (g->neighbors[e] != i) {
+                list_put(&b.lists[i], g->neighbors[e], g->weights[e], -1);
+            }
+        }
+    }
+
+    ContractionHierarchy *ch = ch_alloc(sizeof(ContractionHierarchy));
+    ch->num_nodes = n;
+    ch->num_shortcuts = 0;
+    ch->borrowed = 0;
+    ch->rank = ch_alloc(n * sizeof(int));
+    ch->order = ch_alloc(n * sizeof(int));
+
+    // Upward arcs are collected per node as it is contracted
+    ChList *up = calloc(n, sizeof(ChList));
+    PQueue *order = pq_create(PQ_BINARY, n);
+    if (!up) {
+        printf("Memory allocation failed for contraction hierarchy\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int v = 0; v < n; v++) {
+        b.priority[v] = node_priority(&b, v);
+        pq_push(order, v, b.priority[v]);
+    }
+
+    int next_rank = 0;
+    int key;
+    int v;
+    while ((v = pq_pop(order, &key)) != -1) {
+        // Priorities are only worked out again once a node comes up, one
+        // that went up is put back
+        if (b.stale[v]) {
+            b.stale[v] = 0;
+            b.priority[v] = node_priority(&b, v);
+            if (b.priority[v] > key) {
+                pq_push(order, v, b.priority[v]);
+                continue;
+            }
+        }
+
+        // The estimate may have given up on a witness too soon
+        find_shortcuts(&b, v, WITNESS_SETTLE_LIMIT, WITNESS_HOP_LIMIT);
+        for (int i = 0; i < b.num_found; i++) {
+            ChArc *s = &b.found[i];
+            list_put(&b.lists[b.found_from[i]], s->to, s->weight, s->middle);
+            list_put(&b.lists[s->to], b.found_from[i], s->weight, s->middle);
+        }
+
+        // Whatever v still links to is ranked above it
+        ChList *list = &b.lists[v];
+        for (int i = 0; i < list->size; i++) {
+            int u = list->arcs[i].to;
+            list_put(&up[v], u, list->arcs[i].weight, list->arcs[i].middle);
+            list_remove(&b.lists[u], v);
+            b.deleted[u]++;
+            b.stale[u] = 1;
+        }
+        ch->order[next_rank] = v;
+        ch->rank[v] = next_rank++;
+    }
+
+    // Pack the upward arcs into CSR arrays
+    ch->offsets = ch_alloc((n + 1) * sizeof(int));
+    ch->offsets[0] = 0;
+    for (int i = 0; i < n; i++) {
+        ch->offsets[i + 1] = ch->offsets[i] + up[i].size;
+    }
+    ch->num_arcs = ch->offsets[n];
+    ch->targets = ch_alloc(ch->num_arcs * sizeof(int));
+    ch->weights = ch_alloc(ch->num_arcs * sizeof(int));
+    ch->middle = ch_alloc(ch->num_arcs * sizeof(int));
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < up[i].size; j++) {
+            int at = ch->offsets[i] + j;
+            ch->targets[at] = up[i].arcs[j].to;
+            ch->weights[at] = up[i].arcs[j].weight;
+            ch->middle[at] = up[i].arcs[j].middle;
+            if (up[i].arcs[j].middle != -1) {
+                ch->num_shortcuts++;
+            }
+        }
+        free(up[i].arcs);
+        free(b.lists[i].arcs);
+    }
+    free(up);
+    pq_free(order);
+
+    free(b.lists);
+    free(b.deleted);
+    free(b.priority);
+    free(b.dist);
+    free(b.hops);
+    free(b.touched);
+    free(b.target);
+    free(b.stale);
+    free(b.found);
+    free(b.found_from);
+    pq_free(b.queue);
+
+    ch->extra_bytes = (long)(3 * n + 1) * sizeof(int) + (long)ch->num_arcs * 3 * sizeof(int);
+    ch->build_seconds = now_seconds() - started;
+    return ch;
+}
+
+void ch_free(ContractionHierarchy *ch) {
+    if (!ch) {
+        return;
+    }
+    if (!ch->borrowed) {
+        free(ch->rank);
+        free(ch->order);
+        free(ch->offsets);
+        free(ch->targets);
+        free(ch->weights);
+        free(ch->middle);
+    }
+    free(ch);
+}
+
+ChWorkspace *ch_workspace_create(const ContractionHierarchy *ch) {
+    int n = ch->num_nodes;
+    ChWorkspace *ws = ch_alloc(sizeof(ChWorkspace));
+    for (int side = 0; side < 2; side++) {
+        ws->dist[side] = ch_alloc(n * sizeof(int));
+        ws->parent[side] = ch_alloc(n * sizeof(int));
+        ws->touched[side] = ch_alloc(n * sizeof(int));
+        ws->num_touched[side] = 0;
+        ws->queue[side] = pq_create(PQ_BINARY, n);
+        for (int i = 0; i < n; i++) {
+            ws->dist[side][i] = INT_MAX;
+        }
+    }
+    ws->chain = ch_alloc(n * sizeof(int));
+    ws->stack = ch_alloc(3 * (n + 1) * sizeof(int));
+    ws->settled = 0;
+    return ws;
+}
+
+void ch_workspace_free(ChWorkspace *ws) {
+    if (!ws) {
+        return;
+    }
+    for (int side = 0; side < 2; side++) {
+        free(ws->dist[side]);
+        free(ws->parent[side]);
+        free(ws->touched[side]);
+        pq_free(ws->queue[side]);
+    }
+    free(ws->chain);
+    free(ws->stack);
+    free(ws);
+}
+
+// Index of the arc between a and b, it is stored at the lower ranked end
+static int find_arc(const ContractionHierarchy *ch, int a, int b) {
+    int low = ch->rank[a] < ch->rank[b] ? a : b;
+    int high = low == a ? b : a;
+    for (int e = ch->offsets[low]; e < ch->offsets[low + 1]; e++) {
+        if (ch->targets[e] == high) {
+            return e;
+        }
+    }
+    return -1;
+}
+
+// Appends the stops after from on the arc from -> to, shortcuts are
+// replaced by their two arcs until only original edges are left
+static void unpack_arc(const ContractionHierarchy *ch, int from, int to, int *path, int *length,
+                       int *stack) {
+    // Pending (from, to, middle) triples, handled left to right
+    int top = 0;
+    stack[top++] = from;
+    stack[top++] = to;
+    stack[top++] = ch->middle[find_arc(ch, from, to)];
+    while (top > 0) {
+        int m = stack[--top];
+        int y = stack[--top];
+        int x = stack[--top];
+        if (m == -1) {
+            path[(*length)++] = y;
+            continue;
+        }
+        // Right half goes on first so the left half is unpacked first
+        stack[top++] = m;
+        stack[top++] = y;
+        stack[top++] = ch->middle[find_arc(ch, m, y)];
+        stack[top++] = x;
+        stack[top++] = m;
+        stack[top++] = ch->middle[find_arc(ch, x, m)];
+    }
+}
+
+int ch_query(const ContractionHierarchy *ch, ChWorkspace *ws, int start, int end,
+             int *path, int *path_length) {
+    // Reset only what the last query touched
+    for (int side = 0; side < 2; side++) {
+        for (int i = 0; i < ws->num_touched[side]; i++) {
+            ws->dist[side][ws->touched[side][i]] = INT_MAX;
+        }
+        ws->num_touched[side] = 0;
+        pq_clear(ws->queue[side]);
+    }
+    ws->settled = 0;
+    *path_length = 0;
+
+    int roots[2] = { start, end };
+    for (int side = 0; side < 2; side++) {
+        ws->dist[side][roots[side]] = 0;
+        ws->parent[side][roots[side]] = -1;
+        ws->touched[side][ws->num_touched[side]++] = roots[side];
+        pq_push(ws->queue[side], roots[side], 0);
+    }
+
+    int best = INT_MAX;
+    int meet = -1;
+    int side = 0;
+    // Both searches only climb, a side is finished once its next key can't
+    // improve on the best meeting point
+    while (ws->queue[0]->size > 0 || ws->queue[1]->size > 0) {
+        if (ws->queue[side]->size == 0) {
+            side = !side;
+        }
+        int key;
+        int u = pq_pop(ws->queue[side], &key);
+        if (key >= best) {
+            pq_clear(ws->queue[side]);
+            side = !side;
+            continue;
+        }
+        ws->settled++;
+
+        if (ws->dist[!side][u] != INT_MAX && key + ws->dist[!side][u] < best) {
+            best = key + ws->dist[!side][u];
+            meet = u;
+        }
+
+        int *dist = ws->dist[side];
+        for (int e = ch->offsets[u]; e < ch->offsets[u + 1]; e++) {
+            int v = ch->targets[e];
+            int d = key + ch->weights[e];
+            if (d < dist[v]) {
+                if (dist[v] == INT_MAX) {
+                    ws->touched[side][ws->num_touched[side]++] = v;
+                }
+                dist[v] = d;
+                ws->parent[side][v] = u;
+                pq_push(ws->queue[side], v, d);
+            }
+        }
+        side = !side;
+    }
+
+    if (meet == -1) {
+        return INT_MAX;
+    }
+
+    // Walk down from the meeting point to the start, then unpack the arcs
+    // from the start end so the stops come out in travel order
+    int hops = 0;
+    for (int x = meet; x != start; x = ws->parent[0][x]) {
+        ws->chain[hops++] = x;
+    }
+    path[(*path_length)++] = start;
+    int x = start;
+    for (int i = hops - 1; i >= 0; i--) {
+        int y = ws->chain[i];
+        unpack_arc(ch, x, y, path, path_length, ws->stack);
+        x = y;
+    }
+    // The backward parents already point towards the end
+    for (int y = meet; y != end; y = ws->parent[1][y]) {
+        int z = ws->parent[1][y];
+        unpack_arc(ch, y, z, path, path_length, ws->stack);
+    }
+    return best;
+}
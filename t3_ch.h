@@ -0,0 +1,48 @@
+#ifndef T3_CH_H_
+#define T3_CH_H_
+
+#include "t3.h"
+#include "t3_heap.h"
+
+// Contraction hierarchy over a t3 Graph
+// Every node keeps only the arcs to higher ranked nodes. An arc with a
+// middle node is a shortcut standing for middle's two arcs.
+typedef struct ContractionHierarchy {
+    int num_nodes;
+    int num_arcs;
+    int num_shortcuts;
+    int *rank;    // contraction order of every node
+    int *order;   // node of every rank
+    int *offsets; // upward arcs of node i are offsets[i] .. offsets[i + 1] - 1
+    int *targets;
+    int *weights;
+    int *middle;  // -1 for original edges
+    double build_seconds;
+    long extra_bytes; // memory held by the hierarchy
+    int borrowed; // arrays point into a snapshot mapping, ch_free leaves them
+} ContractionHierarchy;
+
+// Per query scratch space, reset in time proportional to what a query touched
+typedef struct ChWorkspace {
+    int *dist[2];
+    int *parent[2]; // node a node was reached from, -1 at the search roots
+    int *touched[2];
+    int num_touched[2];
+    PQueue *queue[2];
+    int *chain; // path unpacking scratch space
+    int *stack;
+    int settled;  // nodes settled by the last query
+} ChWorkspace;
+
+ContractionHierarchy *ch_build(const Graph *g); // contracts every node of g
+void ch_free(ContractionHierarchy *ch); // frees ch and the arrays it owns
+ChWorkspace *ch_workspace_create(const ContractionHierarchy *ch);
+void ch_workspace_free(ChWorkspace *ws);
+// finds the shortest path from start to end, writes the unpacked stops into path
+// (room for num_nodes entries) and returns its length, INT_MAX if there is none.
+// Of several equally short paths it gives the one its shortcuts unpack to,
+// which need not be the one Dijkstra's search picks.
+int ch_query(const ContractionHierarchy *ch, ChWorkspace *ws, int start, int end,
+             int *path, int *path_length);
+
+#endif
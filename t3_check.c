@@ -0,0 +1,440 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <unistd.h>
+#include "t3.h"
+#include "t3_batch.h"
+
+// Spatial lookups are compared with a scan over every stop, the two work
+// the distance out differently so they only have to agree to a millimetre
+#define METRES_TOLERANCE 1e-3
+
+// Great circle distance in metres from a position to a stop
+static double metres_to_stop(double latitude, double longitude, int index) {
+    const double to_rad = M_PI / 180.0;
+    double lat1 = latitude * to_rad;
+    double lat2 = stop_latitude(index) * to_rad;
+    double dlat = lat2 - lat1;
+    double dlon = (stop_longitude(index) - longitude) * to_rad;
+    double h = sin(dlat / 2) * sin(dlat / 2) +
+               cos(lat1) * cos(lat2) * sin(dlon / 2) * sin(dlon / 2);
+    return 2 * EARTH_RADIUS_M * asin(sqrt(h < 1 ? h : 1));
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void *check_alloc(size_t size) {
+    void *p = malloc(size ? size : 1);
+    if (!p) {
+        printf("Memory allocation for test failed\n");
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+// Stops listed by a lookup: distinct, closest first, each at the distance
+// reported for it
+static int check_listed(double latitude, double longitude, const int *stop_nos,
+                        const double *metres, int count, char *seen) {
+    int ok = 1;
+    for (int i = 0; i < count && ok; i++) {
+        int index = stop_index(stop_nos[i]);
+        ok = index >= 0 && !seen[index] && (i == 0 || metres[i - 1] <= metres[i]) &&
+             fabs(metres_to_stop(latitude, longitude, index) - metres[i]) < METRES_TOLERANCE;
+        if (index >= 0) {
+            seen[index] = 1;
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        int index = stop_index(stop_nos[i]);
+        if (index >= 0) {
+            seen[index] = 0;
+        }
+    }
+    return ok;
+}
+
+// nearest_stops and stops_within at random positions against every stop's
+// distance, sorted
+static int check_lookups(int positions) {
+    int n = num_stops();
+    double *all = check_alloc(n * sizeof(double));
+    double *metres = check_alloc(n * sizeof(double));
+    int *stop_nos = check_alloc(n * sizeof(int));
+    char *seen = calloc(n ? n : 1, 1);
+    if (!seen) {
+        printf("Memory allocation for test failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Positions spread a little past the stops on every side
+    double low[2] = { 90, 180 };
+    double high[2] = { -90, -180 };
+    for (int i = 0; i < n; i++) {
+        low[0] = fmin(low[0], stop_latitude(i));
+        high[0] = fmax(high[0], stop_latitude(i));
+        low[1] = fmin(low[1], stop_longitude(i));
+        high[1] = fmax(high[1], stop_longitude(i));
+    }
+
+    int ok = 1;
+    int sizes[] = { 1, 5, 50 };
+    double radii[] = { 50, 300, 2000 };
+    for (int p = 0; p < positions && ok; p++) {
+        double latitude = low[0] + (high[0] - low[0]) * (rand() / (double)RAND_MAX * 1.2 - 0.1);
+        double longitude = low[1] + (high[1] - low[1]) * (rand() / (double)RAND_MAX * 1.2 - 0.1);
+        for (int i = 0; i < n; i++) {
+            all[i] = metres_to_stop(latitude, longitude, i);
+        }
+        qsort(all, n, sizeof(double), compare_double);
+
+        // The k-th stop found is as far as the k-th closest stop
+        for (int s = 0; s < 3 && ok; s++) {
+            int k = sizes[s];
+            int found = nearest_stops(latitude, longitude, k, stop_nos, metres);
+            ok = found == (k < n ? k : n) && check_listed(latitude, longitude, stop_nos, metres, found, seen) &&
+                 (found == 0 || fabs(metres[found - 1] - all[found - 1]) < METRES_TOLERANCE);
+            if (!ok) {
+                printf("nearest_stops differs from a scan: %d stops near %.6f, %.6f\n", k, latitude, longitude);
+            }
+        }
+
+        // Every stop inside the radius and no other, stops within a
+        // millimetre of the edge may go either way
+        for (int s = 0; s < 3 && ok; s++) {
+            double radius = radii[s];
+            int total = stops_within(latitude, longitude, radius, stop_nos, metres, n);
+            int inside = 0;
+            int edge = 0;
+            for (int i = 0; i < n; i++) {
+                inside += all[i] <= radius - METRES_TOLERANCE;
+                edge += all[i] <= radius + METRES_TOLERANCE;
+            }
+            ok = total >= inside && total <= edge && check_listed(latitude, longitude, stop_nos, metres, total, seen);
+            if (!ok) {
+                printf("stops_within differs from a scan: %.0f m around %.6f, %.6f\n", radius, latitude, longitude);
+            }
+        }
+    }
+
+    free(all);
+    free(metres);
+    free(stop_nos);
+    free(seen);
+    return ok;
+}
+
+// Stop number of a random stop
+static int random_stop(void) {
+    return stop_number(rand() % num_stops());
+}
+
+// distance_table on one and three threads, with and without stopping
+// early, against one path_tree per source
+static int check_distance_table(SearchWorkspace *ws, int num_sources, int num_targets) {
+    int n = num_stops();
+    int *sources = check_alloc(num_sources * sizeof(int));
+    int *targets = check_alloc(num_targets * sizeof(int));
+    int *table = check_alloc((size_t)num_sources * num_targets * sizeof(int));
+    int *expected = check_alloc((size_t)num_sources * num_targets * sizeof(int));
+    int *distance = check_alloc(n * sizeof(int));
+    int *prev = check_alloc(n * sizeof(int));
+    for (int i = 0; i < num_sources; i++) {
+        sources[i] = random_stop();
+    }
+    for (int j = 0; j < num_targets; j++) {
+        targets[j] = random_stop();
+    }
+    // A stop that doesn't exist is reached from nowhere
+    sources[0] = targets[0] = -1;
+    for (int i = 0; i < num_sources; i++) {
+        int found = path_tree(ws, sources[i], distance, prev) >= 0;
+        for (int j = 0; j < num_targets; j++) {
+            int t = stop_index(targets[j]);
+            expected[(size_t)i * num_targets + j] = found && t >= 0 ? distance[t] : INT_MAX;
+        }
+    }
+
+    int ok = 1;
+    for (int threads = 1; threads <= 3 && ok; threads += 2) {
+        for (int stop_early = 0; stop_early <= 1 && ok; stop_early++) {
+            distance_table(sources, num_sources, targets, num_targets, table, threads, stop_early);
+            ok = memcmp(table, expected, (size_t)num_sources * num_targets * sizeof(int)) == 0;
+            if (!ok) {
+                printf("distance_table differs from path_tree: %d threads, stop_early %d\n", threads, stop_early);
+            }
+        }
+    }
+    free(sources);
+    free(targets);
+    free(table);
+    free(expected);
+    free(distance);
+    free(prev);
+    return ok;
+}
+
+// isochrone against the nearest origin's path_tree distance of every stop,
+// filtered by the budget and sorted by distance and then stop index
+static int check_isochrone(SearchWorkspace *ws, int rounds) {
+    int n = num_stops();
+    int *nearest = check_alloc(n * sizeof(int));
+    int *distance = check_alloc(n * sizeof(int));
+    int *prev = check_alloc(n * sizeof(int));
+    int *stop_nos = check_alloc(n * sizeof(int));
+    int *distances = check_alloc(n * sizeof(int));
+    int budgets[] = { 0, 2000, 10000, 50000 };
+    int ok = 1;
+    for (int r = 0; r < rounds && ok; r++) {
+        int origins[3];
+        int num_origins = 1 + r % 3;
+        for (int i = 0; i < n; i++) {
+            nearest[i] = INT_MAX;
+        }
+        for (int k = 0; k < num_origins; k++) {
+            origins[k] = random_stop();
+            path_tree(ws, origins[k], distance, prev);
+            for (int i = 0; i < n; i++) {
+                nearest[i] = distance[i] < nearest[i] ? distance[i] : nearest[i];
+            }
+        }
+        int budget = budgets[r % 4];
+        // Only the first max stops are written, the count is all of them
+        int max = r % 2 ? n : 5;
+        int total = isochrone(ws, origins, num_origins, budget, stop_nos, distances, max);
+        int expected = 0;
+        int last = -1;
+        // Stop indices in increasing order of (distance, index) are the
+        // ones isochrone lists, taken one distance at a time
+        while (ok) {
+            int next = -1;
+            for (int i = 0; i < n; i++) {
+                if (nearest[i] > budget) {
+                    continue;
+                }
+                int after = last < 0 || nearest[i] > nearest[last] || (nearest[i] == nearest[last] && i > last);
+                if (after && (next < 0 || nearest[i] < nearest[next])) {
+                    next = i;
+                }
+            }
+            if (next < 0) {
+                break;
+            }
+            if (expected < max && expected < total) {
+                ok = stop_nos[expected] == stop_number(next) && distances[expected] == nearest[next];
+            }
+            expected++;
+            last = next;
+        }
+        ok = ok && total == expected;
+        if (!ok) {
+            printf("isochrone differs from path_tree: %d origins, budget %d\n", num_origins, budget);
+        }
+    }
+    free(nearest);
+    free(distance);
+    free(prev);
+    free(stop_nos);
+    free(distances);
+    return ok;
+}
+
+// Every path find_path gives from origin, which answers from its cached
+// tree, against a fresh path_tree: the same distance and the same stops
+static int check_cached_tree(SearchWorkspace *ws, SearchWorkspace *cached, int origin,
+                             int *distance, int *prev) {
+    int n = num_stops();
+    path_tree(ws, origin, distance, prev);
+    for (int t = 0; t < n; t++) {
+        PathResult result;
+        if (!find_path(cached, origin, stop_number(t), &result)) {
+            if (distance[t] != INT_MAX) {
+                return 0;
+            }
+            continue;
+        }
+        if (result.total != distance[t]) {
+            return 0;
+        }
+        int at = t;
+        for (int i = result.length - 1; i >= 0; i--) {
+            if (at != result.stops[i]) {
+                return 0;
+            }
+            at = prev[at];
+        }
+        if (at != -1) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// update_edge on random edges with trees cached from three origins, one on
+// every queue kind. After every change each cached tree has to match a
+// tree built from scratch. Half the changes hit an edge on a cached path,
+// so most of them repair the trees, the rest land anywhere and add edges.
+static int check_updates(SearchWorkspace *ws, int updates) {
+    int n = num_stops();
+    int *distance = check_alloc(n * sizeof(int));
+    int *prev = check_alloc(n * sizeof(int));
+    SearchWorkspace *cached = workspace_create();
+    int origins[3];
+    PQKind kinds[] = { PQ_BINARY, PQ_QUATERNARY, PQ_RADIX };
+    for (int k = 0; k < 3; k++) {
+        origins[k] = random_stop();
+        set_queue_kind(kinds[k]);
+        cache_tree(origins[k]);
+    }
+    set_queue_kind(PQ_BINARY);
+
+    int ok = 1;
+    for (int u = 0; u < updates && ok; u++) {
+        int from = random_stop();
+        int to = random_stop();
+        PathResult result;
+        if (u % 2 == 0 && find_path(cached, origins[u % 3], to, &result) && result.length > 1) {
+            int at = rand() % (result.length - 1);
+            from = stop_number(result.stops[at]);
+            to = stop_number(result.stops[at + 1]);
+        }
+        int old_weight = edge_weight(from, to);
+        int weight;
+        switch (rand() % 4) {
+        case 0:
+            weight = 0;
+            break;
+        case 1:
+            weight = old_weight > 1 ? old_weight / 2 : 1 + rand() % 1000;
+            break;
+        case 2:
+            weight = old_weight ? old_weight * 3 : 1 + rand() % 1000;
+            break;
+        default:
+            weight = 1 + rand() % 5000;
+            break;
+        }
+        UpdateReport report;
+        if (from == to || !update_edge(from, to, weight, &report)) {
+            continue;
+        }
+        ok = report.old_weight == old_weight && edge_weight(from, to) == weight;
+        for (int k = 0; k < 3 && ok; k++) {
+            ok = check_cached_tree(ws, cached, origins[k], distance, prev);
+        }
+        if (!ok) {
+            printf("Cached trees differ from path_tree after %d-%d %d -> %d\n", from, to, old_weight, weight);
+        }
+    }
+    workspace_free(cached);
+    free(distance);
+    free(prev);
+    return ok;
+}
+
+// save_snapshot then load_snapshot, with the contraction hierarchy in it:
+// the same stops, and the same distances from Dijkstra and from the loaded
+// hierarchy
+static int check_snapshot(int origins) {
+    int n = num_stops();
+    int edges = num_edges();
+    int *numbers = check_alloc(n * sizeof(int));
+    float *position = check_alloc(2 * n * sizeof(float));
+    char (*names)[MAX_STRING_SIZE] = check_alloc(n * sizeof(*names));
+    int *sources = check_alloc(origins * sizeof(int));
+    int *before = check_alloc((size_t)origins * n * sizeof(int));
+    int *prev = check_alloc(n * sizeof(int));
+    SearchWorkspace *ws = workspace_create();
+    for (int i = 0; i < n; i++) {
+        numbers[i] = stop_number(i);
+        position[2 * i] = stop_latitude(i);
+        position[2 * i + 1] = stop_longitude(i);
+        snprintf(names[i], MAX_STRING_SIZE, "%s", stop_name(i));
+    }
+    for (int k = 0; k < origins; k++) {
+        sources[k] = random_stop();
+        path_tree(ws, sources[k], &before[(size_t)k * n], prev);
+    }
+    workspace_free(ws);
+
+    char fname[] = "/tmp/bus_check_XXXXXX";
+    int fd = mkstemp(fname);
+    if (fd < 0) {
+        printf("Unable to create a snapshot file\n");
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+    set_search_mode(SEARCH_CH);
+    int ok = save_snapshot(fname) && load_snapshot(fname);
+    ok = ok && num_stops() == n && num_edges() == edges;
+    for (int i = 0; i < n && ok; i++) {
+        ok = stop_number(i) == numbers[i] && stop_latitude(i) == position[2 * i] &&
+             stop_longitude(i) == position[2 * i + 1] && strcmp(stop_name(i), names[i]) == 0;
+    }
+
+    int *distance = check_alloc(n * sizeof(int));
+    ws = ok ? workspace_create() : NULL;
+    for (int k = 0; k < origins && ok; k++) {
+        path_tree(ws, sources[k], distance, prev);
+        ok = memcmp(distance, &before[(size_t)k * n], n * sizeof(int)) == 0;
+        for (int t = 0; t < n && ok; t++) {
+            PathResult result;
+            find_path(ws, sources[k], stop_number(t), &result);
+            ok = result.total == distance[t];
+        }
+    }
+    if (!ok) {
+        printf("Snapshot %s does not load back what was saved\n", fname);
+    }
+    set_search_mode(SEARCH_DIJKSTRA);
+    workspace_free(ws);
+    unlink(fname);
+    free(numbers);
+    free(position);
+    free(names);
+    free(sources);
+    free(before);
+    free(prev);
+    free(distance);
+    return ok;
+}
+
+int main(int argc, char *argv[]) {
+    char *vertices = argc > 2 ? argv[1] : "vertices.csv";
+    char *edges = argc > 2 ? argv[2] : "edges.csv";
+    if (!load_vertices(vertices) || !load_edges(edges)) {
+        printf("Failed to load %s and %s\n", vertices, edges);
+        return EXIT_FAILURE;
+    }
+
+    int failed = 0;
+    srand(1);
+    if (!check_lookups(200)) {
+        failed++;
+    }
+    SearchWorkspace *ws = workspace_create();
+    if (!check_distance_table(ws, 20, 30)) {
+        failed++;
+    }
+    if (!check_isochrone(ws, 40)) {
+        failed++;
+    }
+    // Updates last, they change the graph under the other checks
+    if (!check_updates(ws, 300)) {
+        failed++;
+    }
+    workspace_free(ws);
+    if (!check_snapshot(5)) {
+        failed++;
+    }
+
+    free_memory();
+    printf("%s\n", failed ? "Checks FAILED" : "Checks passed");
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,301 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// Client and load generator for bus --server
+//   bus_client SOCKET                  sends start,end lines from stdin, prints the answers
+//   bus_client SOCKET --load VERTICES  random queries between the stops in VERTICES
+//     --clients N   connections, one thread each (default 4)
+//     --queries N   queries per connection (default 10000)
+//     --depth N     requests in flight per connection (default 16)
+//     --seed N      random seed (default 1)
+
+static void usage(void) {
+    printf("usage: ./bus_client SOCKET\n");
+    printf("       ./bus_client SOCKET --load VERTICES [--clients N] [--queries N] [--depth N] [--seed N]\n");
+}
+
+static int connect_to(const char *path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        printf("Socket path %s is too long\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        printf("Unable to connect to %s\n", path);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    return fd;
+}
+
+static int write_all(int fd, const char *data, size_t size) {
+    while (size > 0) {
+        ssize_t put = write(fd, data, size);
+        if (put < 0 && errno == EINTR) {
+            continue;
+        }
+        if (put <= 0) {
+            return 0;
+        }
+        data += put;
+        size -= put;
+    }
+    return 1;
+}
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+// Copies stdin to the socket on its own thread so reading the answers
+// never waits for the whole input to be sent
+static void *send_input(void *arg) {
+    int fd = *(int *)arg;
+    char buffer[65536];
+    size_t got;
+    while ((got = fread(buffer, 1, sizeof(buffer), stdin)) > 0) {
+        if (!write_all(fd, buffer, got)) {
+            break;
+        }
+    }
+    shutdown(fd, SHUT_WR);
+    return NULL;
+}
+
+static int run_interactive(const char *path) {
+    int fd = connect_to(path);
+    if (fd < 0) {
+        return EXIT_FAILURE;
+    }
+    pthread_t sender;
+    if (pthread_create(&sender, NULL, send_input, &fd) != 0) {
+        printf("Unable to start sender\n");
+        close(fd);
+        return EXIT_FAILURE;
+    }
+    char buffer[65536];
+    ssize_t got;
+    while ((got = read(fd, buffer, sizeof(buffer))) > 0 || (got < 0 && errno == EINTR)) {
+        if (got > 0) {
+            fwrite(buffer, 1, got, stdout);
+        }
+    }
+    pthread_join(sender, NULL);
+    close(fd);
+    return EXIT_SUCCESS;
+}
+
+typedef struct LoadClient {
+    pthread_t thread;
+    const char *path;
+    const int *stops;
+    int num_stops;
+    int queries;
+    int depth;
+    unsigned int seed;
+    double *latency; // seconds from sending each query to its answer
+    int answered;
+    int failed;
+} LoadClient;
+
+static void *load_client(void *arg) {
+    LoadClient *c = arg;
+    int fd = connect_to(c->path);
+    if (fd < 0) {
+        c->failed = 1;
+        return NULL;
+    }
+    FILE *in = fdopen(fd, "r");
+    double *sent_at = malloc(c->queries * sizeof(double));
+    if (!in || !sent_at) {
+        printf("Unable to set up load client\n");
+        c->failed = 1;
+        free(sent_at);
+        if (in) {
+            fclose(in);
+        } else {
+            close(fd);
+        }
+        return NULL;
+    }
+
+    char request[64];
+    char answer[1 << 16];
+    int sent = 0;
+    while (c->answered < c->queries) {
+        // Keep depth requests in flight
+        while (sent < c->queries && sent - c->answered < c->depth) {
+            int start = c->stops[rand_r(&c->seed) % c->num_stops];
+            int end = c->stops[rand_r(&c->seed) % c->num_stops];
+            int len = snprintf(request, sizeof(request), "%d,%d\n", start, end);
+            sent_at[sent++] = now();
+            if (!write_all(fd, request, len)) {
+                c->failed = 1;
+                break;
+            }
+        }
+        if (c->failed || !fgets(answer, sizeof(answer), in)) {
+            c->failed = 1;
+            break;
+        }
+        // Long paths can span several reads, the answer ends at the newline
+        while (!strchr(answer, '\n') && fgets(answer, sizeof(answer), in)) {
+        }
+        c->latency[c->answered] = now() - sent_at[c->answered];
+        c->answered++;
+    }
+    free(sent_at);
+    fclose(in);
+    return NULL;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Stop numbers from the first column of a vertices CSV, skipping the header
+static int read_stops(const char *fname, int **stops) {
+    FILE *f = fopen(fname, "r");
+    if (!f) {
+        printf("Unable to open %s\n", fname);
+        return 0;
+    }
+    char line[512];
+    int count = 0, cap = 1024;
+    *stops = malloc(cap * sizeof(int));
+    if (!*stops) {
+        fclose(f);
+        return 0;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        // The number may be quoted
+        char *start = line[0] == '"' ? line + 1 : line;
+        char *end;
+        long stop = strtol(start, &end, 10);
+        if (end == start) {
+            continue;
+        }
+        if (count == cap) {
+            int *grown = realloc(*stops, 2 * cap * sizeof(int));
+            if (!grown) {
+                break;
+            }
+            *stops = grown;
+            cap *= 2;
+        }
+        (*stops)[count++] = (int)stop;
+    }
+    fclose(f);
+    return count;
+}
+
+static int run_load(const char *path, const char *vertices, int clients, int queries, int depth, unsigned int seed) {
+    int *stops;
+    int num_stops = read_stops(vertices, &stops);
+    if (num_stops == 0) {
+        printf("No stops in %s\n", vertices);
+        return EXIT_FAILURE;
+    }
+    LoadClient *c = malloc(clients * sizeof(LoadClient));
+    double *latency = malloc((size_t)clients * queries * sizeof(double));
+    if (!c || !latency) {
+        printf("Memory allocation failed for load generator\n");
+        return EXIT_FAILURE;
+    }
+
+    double began = now();
+    for (int i = 0; i < clients; i++) {
+        c[i].path = path;
+        c[i].stops = stops;
+        c[i].num_stops = num_stops;
+        c[i].queries = queries;
+        c[i].depth = depth;
+        c[i].seed = seed + i;
+        c[i].latency = latency + (size_t)i * queries;
+        c[i].answered = 0;
+        c[i].failed = 0;
+        if (pthread_create(&c[i].thread, NULL, load_client, &c[i]) != 0) {
+            printf("Unable to start load client\n");
+            return EXIT_FAILURE;
+        }
+    }
+    long answered = 0;
+    int failed = 0;
+    for (int i = 0; i < clients; i++) {
+        pthread_join(c[i].thread, NULL);
+        // Pack the answered latencies together
+        memmove(latency + answered, c[i].latency, c[i].answered * sizeof(double));
+        answered += c[i].answered;
+        failed += c[i].failed;
+    }
+    double elapsed = now() - began;
+
+    qsort(latency, answered, sizeof(double), compare_double);
+    printf("%ld queries on %d connections (depth %d) in %.3f s, %.0f queries/s\n",
+           answered, clients, depth, elapsed, answered / elapsed);
+    if (answered > 0) {
+        printf("latency us: p50 %.1f  p90 %.1f  p99 %.1f  max %.1f\n",
+               latency[answered / 2] * 1e6, latency[answered * 9 / 10] * 1e6,
+               latency[answered * 99 / 100] * 1e6, latency[answered - 1] * 1e6);
+    }
+    if (failed) {
+        printf("%d connections failed\n", failed);
+    }
+    free(latency);
+    free(c);
+    free(stops);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        usage();
+        return EXIT_FAILURE;
+    }
+    const char *vertices = NULL;
+    int clients = 4;
+    int queries = 10000;
+    int depth = 16;
+    unsigned int seed = 1;
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--load") == 0 && i + 1 < argc) {
+            vertices = argv[++i];
+        } else if (strcmp(argv[i], "--clients") == 0 && i + 1 < argc) {
+            clients = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--queries") == 0 && i + 1 < argc) {
+            queries = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--depth") == 0 && i + 1 < argc) {
+            depth = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = strtoul(argv[++i], NULL, 10);
+        } else {
+            usage();
+            return EXIT_FAILURE;
+        }
+    }
+    if (!vertices) {
+        return run_interactive(argv[1]);
+    }
+    if (clients < 1 || queries < 1 || depth < 1) {
+        usage();
+        return EXIT_FAILURE;
+    }
+    return run_load(argv[1], vertices, clients, queries, depth, seed);
+}
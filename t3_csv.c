@@ -0,0 +1,287 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "t3.h"
+#include "t3_csv.h"
+
+int csv_open(CsvReader *r, const char *fname) {
+    r->data = NULL;
+    r->size = 0;
+    r->pos = 0;
+    r->mapped = 0;
+
+    int fd = open(fname, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return 0;
+    }
+    r->size = st.st_size;
+
+    // Empty files can't be mapped, there is nothing to read anyway
+    if (r->size == 0) {
+        r->data = "";
+        close(fd);
+        return 1;
+    }
+
+    void *map = mmap(NULL, r->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED) {
+        // We only ever walk forward through the file
+        madvise(map, r->size, MADV_SEQUENTIAL);
+        r->data = map;
+        r->mapped = 1;
+        close(fd);
+        return 1;
+    }
+
+    // Not mappable (a pipe for example), fall back to reading it in
+    char *buf = malloc(r->size);
+    if (!buf) {
+        close(fd);
+        return 0;
+    }
+    size_t got = 0;
+    while (got < r->size) {
+        ssize_t n = read(fd, buf + got, r->size - got);
+        if (n < 0) {
+            free(buf);
+            close(fd);
+            r->size = 0;
+            return 0;
+        }
+        if (n == 0) {
+            break;
+        }
+        got += n;
+    }
+    close(fd);
+    // csv_close only frees a copy that holds something
+    if (got == 0) {
+        free(buf);
+        r->data = "";
+        r->size = 0;
+        return 1;
+    }
+    r->data = buf;
+    r->size = got;
+    return 1;
+}
+
+void csv_close(CsvReader *r) {
+    if (r->mapped) {
+        munmap((void *)r->data, r->size);
+    } else if (r->size > 0) {
+        free((void *)r->data);
+    }
+    r->data = NULL;
+    r->size = 0;
+}
+
+void csv_skip_line(CsvReader *r) {
+    const char *nl = memchr(r->data + r->pos, '\n', r->size - r->pos);
+    r->pos = nl ? (size_t)(nl - r->data) + 1 : r->size;
+}
+
+int csv_count_lines(const CsvReader *r) {
+    int lines = 0;
+    const char *p = r->data + r->pos;
+    const char *end = r->data + r->size;
+    while (p < end) {
+        const char *nl = memchr(p, '\n', end - p);
+        lines++;
+        if (!nl) {
+            break;
+        }
+        p = nl + 1;
+    }
+    return lines;
+}
+
+// Find the next byte that can end or change the state of a field
+// Inside quotes only '"' and '\n' matter, outside ',' does too
+static const char *find_special(const char *p, const char *end, int quoted) {
+#ifdef __SSE2__
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i comma = _mm_set1_epi8(quoted ? '"' : ',');
+    const __m128i newline = _mm_set1_epi8('\n');
+    while (end - p >= 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)p);
+        __m128i hits = _mm_or_si128(_mm_cmpeq_epi8(chunk, quote),
+                       _mm_or_si128(_mm_cmpeq_epi8(chunk, comma),
+                                    _mm_cmpeq_epi8(chunk, newline)));
+        int mask = _mm_movemask_epi8(hits);
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
+    }
+#endif
+    while (p < end) {
+        if (*p == '"' || *p == '\n' || (*p == ',' && !quoted)) {
+            return p;
+        }
+        p++;
+    }
+    return end;
+}
+
+// Start of the first record after pos. csv_next_field ends a field at any
+// '\n', quoted or not, so every newline ends a record.
+static size_t next_record(const CsvReader *r, size_t pos) {
+    const char *nl = memchr(r->data + pos, '\n', r->size - pos);
+    return nl ? (size_t)(nl - r->data) + 1 : r->size;
+}
+
+void csv_split(const CsvReader *r, int parts, CsvReader *chunks) {
+    size_t begin = r->pos;
+    size_t length = r->size - begin;
+
+    // Cut the data into equal raw ranges and move every cut forward to the
+    // next record, a cut that runs past the following ones leaves them empty
+    size_t start = begin;
+    for (int k = 0; k < parts; k++) {
+        size_t cut = r->size;
+        if (k + 1 < parts) {
+            cut = next_record(r, begin + length * (k + 1) / parts);
+            if (cut < start) {
+                cut = start;
+            }
+        }
+        chunks[k].data = r->data;
+        chunks[k].pos = start;
+        chunks[k].size = cut;
+        chunks[k].mapped = 0;
+        start = cut;
+    }
+}
+
+// Same rules as the old fgetc based next_field: quotes toggle quoting and
+// are not part of the value, an unquoted ',' or any '\n' ends the field.
+// The field is returned in place, with a leading and trailing quote
+// trimmed off; quotes in the middle of a field are left as they are. The old
+// next_field dropped those too, but that takes a copy of the field, and the
+// loaders keep names pointing into the file until the stops are added.
+int csv_next_field(CsvReader *r, const char **field, int *len) {
+    const char *start = r->data + r->pos;
+    const char *end = r->data + r->size;
+    const char *p = start;
+    int quoted = 0;
+
+    if (p >= end) {
+        return NEXT_FIELD_FAIL;
+    }
+
+    while (1) {
+        p = find_special(p, end, quoted);
+        if (p < end && *p == '"') {
+            quoted = !quoted;
+            p++;
+            continue;
+        }
+        break;
+    }
+
+    // p is now at the terminator or the end of the data
+    const char *stop = p;
+    if (stop > start && *start == '"') {
+        start++;
+    }
+    if (stop > start && stop[-1] == '"') {
+        stop--;
+    }
+    *field = start;
+    *len = (int)(stop - start);
+
+    if (p >= end) {
+        r->pos = r->size;
+        return *len == 0 ? NEXT_FIELD_FAIL : 0;
+    }
+    r->pos = (size_t)(p - r->data) + 1;
+    // An empty field before a separator is malformed
+    if (*p == ',' && *len == 0) {
+        return NEXT_FIELD_FAIL;
+    }
+    return 0;
+}
+
+int csv_parse_int(const char *s, int len) {
+    const char *end = s + len;
+    while (s < end && (*s == ' ' || *s == '\t')) {
+        s++;
+    }
+    int negative = 0;
+    if (s < end && (*s == '-' || *s == '+')) {
+        negative = *s == '-';
+        s++;
+    }
+    int value = 0;
+    while (s < end && *s >= '0' && *s <= '9') {
+        value = value * 10 + (*s - '0');
+        s++;
+    }
+    return negative ? -value : value;
+}
+
+// Powers of ten that are exact in a double
+static const double pow10_table[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+double csv_parse_double(const char *s, int len) {
+    const char *begin = s;
+    const char *end = s + len;
+    while (s < end && (*s == ' ' || *s == '\t')) {
+        s++;
+    }
+    int negative = 0;
+    if (s < end && (*s == '-' || *s == '+')) {
+        negative = *s == '-';
+        s++;
+    }
+
+    // Collect the digits as one integer and remember where the point was
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    while (s < end && *s >= '0' && *s <= '9') {
+        mantissa = mantissa * 10 + (*s++ - '0');
+        digits++;
+    }
+    if (s < end && *s == '.') {
+        s++;
+        while (s < end && *s >= '0' && *s <= '9') {
+            mantissa = mantissa * 10 + (*s++ - '0');
+            digits++;
+            exponent--;
+        }
+    }
+    if (s < end && (*s == 'e' || *s == 'E')) {
+        // Rare enough to hand to the C library
+        digits = 100;
+    }
+
+    // One multiply or divide of exact values rounds correctly
+    if (digits <= 19 && mantissa < ((uint64_t)1 << 53) && exponent >= -22) {
+        double value = (double)mantissa / pow10_table[-exponent];
+        return negative ? -value : value;
+    }
+
+    char buf[MAX_STRING_SIZE];
+    int n = len < MAX_STRING_SIZE - 1 ? len : MAX_STRING_SIZE - 1;
+    memcpy(buf, begin, n);
+    buf[n] = '\0';
+    return atof(buf);
+}
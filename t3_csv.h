@@ -0,0 +1,30 @@
+#ifndef T3_CSV_H_
+#define T3_CSV_H_
+
+#include <stddef.h>
+
+// Read-only view of a whole CSV file, memory mapped when possible
+typedef struct CsvReader {
+    const char *data;
+    size_t size;
+    size_t pos;
+    int mapped; // 1 if data is an mmap, 0 if it is a malloc'd copy
+} CsvReader;
+
+int csv_open(CsvReader *r, const char *fname); // maps fname, returns 0 if it cannot be opened
+void csv_close(CsvReader *r); // unmaps the file
+void csv_skip_line(CsvReader *r); // skips past the next newline, used for headers
+int csv_count_lines(const CsvReader *r); // number of records left, counting a final unterminated line
+// Splits the records left in r into parts byte ranges that start and end on
+// record boundaries, every '\n' ends a record as it does for csv_next_field.
+// chunks[k] shares r's data with pos and size bounding its range, so
+// csv_next_field reads just that range; never csv_close a chunk. Trailing
+// chunks are empty when there are fewer records than parts.
+void csv_split(const CsvReader *r, int parts, CsvReader *chunks);
+// points field/len at the next field inside the mapping, returns 0 or NEXT_FIELD_FAIL
+int csv_next_field(CsvReader *r, const char **field, int *len);
+
+int csv_parse_int(const char *s, int len); // atoi without the copy or locale lookups
+double csv_parse_double(const char *s, int len); // atof without the copy or locale lookups
+
+#endif
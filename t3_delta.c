@@ -0,0 +1,434 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include "t3.h"
+#include "t3_delta.h"
+
+// Entries of the bucket being relaxed handed to a thread at a time
+#define DELTA_CHUNK 64
+// Narrowest bucket as a share of the mean edge weight. Every bucket holding
+// a node costs a barrier, so narrower buckets only add rounds
+#define DELTA_MIN_SHARE 4
+
+// Nodes one thread filed in one bucket, a node can be in there more than
+// once and in other buckets too if its distance dropped again
+typedef struct DeltaBin {
+    int *nodes;
+    int count;
+    int cap;
+} DeltaBin;
+
+// What a thread has for the bucket about to be relaxed
+typedef struct DeltaOffer {
+    int bucket; // its lowest non empty bucket, INT_MAX if it has none
+    const int *nodes;
+    int count;
+    int settled; // nodes whose heavy edges wait for the last bucket to empty
+} DeltaOffer;
+
+typedef struct DeltaThread {
+    pthread_t thread;
+    DeltaPool *p;
+    int id;
+    DeltaBin *bins; // by bucket number
+    int num_bins;
+    DeltaBin current; // taken out of bins, read by every thread this round
+    DeltaBin settled; // nodes this thread settled in the bucket being relaxed
+    int reached;
+} DeltaThread;
+
+struct DeltaPool {
+    const Graph *g;
+    int threads;
+    int mean_weight;
+    // g's edges with every row sorted by weight and removed edges left
+    // out, so the light edges of a row come before the heavy ones. The
+    // search and tree_parents both read this copy and never g.
+    Graph sorted;
+    int *heavy; // first edge of each row heavier than split_delta
+    int split_delta; // 0 until a run has split the rows
+    int *settled_in; // bucket a node's heavy edges were queued in, -1 if none
+    DeltaThread *workers;
+    pthread_barrier_t barrier;
+    int stopping;
+    // The run in progress
+    int source;
+    int delta;
+    int *distance;
+    int *prev;
+    // Indexed by round parity, a thread can be one round ahead of another
+    DeltaOffer *offers[2];
+    int claimed[2];
+};
+
+// Appends node to bin
+static void bin_append(DeltaBin *b, int node) {
+    if (b->count == b->cap) {
+        int cap = b->cap ? b->cap * 2 : 256;
+        int *nodes = realloc(b->nodes, cap * sizeof(int));
+        if (!nodes) {
+            printf("Memory allocation failed for delta stepping\n");
+            exit(EXIT_FAILURE);
+        }
+        b->nodes = nodes;
+        b->cap = cap;
+    }
+    b->nodes[b->count++] = node;
+}
+
+// Files node under bucket in t's own bins
+static void bin_push(DeltaThread *t, int bucket, int node) {
+    if (bucket >= t->num_bins) {
+        int num = t->num_bins ? t->num_bins : 64;
+        while (num <= bucket) {
+            num *= 2;
+        }
+        DeltaBin *bins = realloc(t->bins, num * sizeof(DeltaBin));
+        if (!bins) {
+            printf("Memory allocation failed for delta stepping\n");
+            exit(EXIT_FAILURE);
+        }
+        memset(bins + t->num_bins, 0, (num - t->num_bins) * sizeof(DeltaBin));
+        t->bins = bins;
+        t->num_bins = num;
+    }
+    bin_append(&t->bins[bucket], node);
+}
+
+// Relax edges first..last-1 of the sorted copy from a node at distance du
+static void relax(DeltaThread *t, int first, int last, int du) {
+    DeltaPool *p = t->p;
+    int *distance = p->distance;
+    int delta = p->delta;
+    for (int e = first; e < last; e++) {
+        int v = p->sorted.neighbors[e];
+        int dv = du + p->sorted.weights[e];
+        int old = __atomic_load_n(&distance[v], __ATOMIC_RELAXED);
+        while (dv < old) {
+            if (__atomic_compare_exchange_n(&distance[v], &old, dv, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                bin_push(t, dv / delta, v);
+                break;
+            }
+        }
+    }
+}
+
+// Orders the edges of a row by weight
+static int compare_edges(const void *a, const void *b) {
+    const int *x = a;
+    const int *y = b;
+    if (x[1] != y[1]) {
+        return x[1] < y[1] ? -1 : 1;
+    }
+    return x[0] < y[0] ? -1 : x[0] > y[0];
+}
+
+// Copies g's edges into p->sorted with every row sorted by weight
+static void sort_edges(DeltaPool *p) {
+    const Graph *g = p->g;
+    int n = g->num_nodes;
+    int m = g->offsets[n] ? g->offsets[n] : 1;
+    int *pairs = malloc(m * 2 * sizeof(int));
+    Graph *sorted = &p->sorted;
+    memset(sorted, 0, sizeof(Graph));
+    sorted->num_nodes = n;
+    sorted->offsets = malloc((n + 1) * sizeof(int));
+    sorted->neighbors = malloc(m * sizeof(int));
+    sorted->weights = malloc(m * sizeof(int));
+    p->heavy = malloc((n ? n : 1) * sizeof(int));
+    p->settled_in = malloc((n ? n : 1) * sizeof(int));
+    if (!pairs || !sorted->offsets || !sorted->neighbors || !sorted->weights || !p->heavy || !p->settled_in) {
+        printf("Memory allocation failed for delta stepping\n");
+        exit(EXIT_FAILURE);
+    }
+    int count = 0;
+    sorted->offsets[0] = 0;
+    for (int u = 0; u < n; u++) {
+        int first = count;
+        for (int e = g->offsets[u]; e < g->offsets[u + 1]; e++) {
+            // Removed edges are zero weight self loops and never relax anything
+            if (g->weights[e] > 0) {
+                pairs[2 * count] = g->neighbors[e];
+                pairs[2 * count + 1] = g->weights[e];
+                count++;
+            }
+        }
+        qsort(pairs + 2 * first, count - first, 2 * sizeof(int), compare_edges);
+        sorted->offsets[u + 1] = count;
+    }
+    for (int e = 0; e < count; e++) {
+        sorted->neighbors[e] = pairs[2 * e];
+        sorted->weights[e] = pairs[2 * e + 1];
+    }
+    sorted->num_edges = count;
+    free(pairs);
+}
+
+// One run on one thread, every thread of the pool runs this together
+static void delta_search(DeltaThread *t) {
+    DeltaPool *p = t->p;
+    int n = p->g->num_nodes;
+    int first = (int)((long long)n * t->id / p->threads);
+    int last = (int)((long long)n * (t->id + 1) / p->threads);
+    for (int v = first; v < last; v++) {
+        p->distance[v] = INT_MAX;
+        p->settled_in[v] = -1;
+        if (p->split_delta == p->delta) {
+            continue;
+        }
+        // Rows are sorted by weight, find the first edge heavier than delta
+        int low = p->sorted.offsets[v];
+        int high = p->sorted.offsets[v + 1];
+        while (low < high) {
+            int mid = low + (high - low) / 2;
+            if (p->sorted.weights[mid] <= p->delta) {
+                low = mid + 1;
+            } else {
+                high = mid;
+            }
+        }
+        p->heavy[v] = low;
+    }
+    pthread_barrier_wait(&p->barrier);
+    if (t->id == 0) {
+        p->split_delta = p->delta;
+        p->distance[p->source] = 0;
+        bin_push(t, 0, p->source);
+    }
+
+    int bucket = 0;
+    for (int round = 0;; round++) {
+        // Offer the lowest bucket this thread has, the lowest of all of
+        // them is relaxed next
+        DeltaOffer *offer = &p->offers[round & 1][t->id];
+        int b = bucket;
+        while (b < t->num_bins && t->bins[b].count == 0) {
+            b++;
+        }
+        offer->bucket = b < t->num_bins ? b : INT_MAX;
+        offer->nodes = b < t->num_bins ? t->bins[b].nodes : NULL;
+        offer->count = b < t->num_bins ? t->bins[b].count : 0;
+        offer->settled = t->settled.count;
+        pthread_barrier_wait(&p->barrier);
+
+        // Everyone has stopped reading the last round's nodes
+        free(t->current.nodes);
+        t->current.nodes = NULL;
+        if (t->id == 0) {
+            p->claimed[(round + 1) & 1] = 0;
+        }
+        const DeltaOffer *offers = p->offers[round & 1];
+        int next = INT_MAX;
+        int settled = 0;
+        for (int k = 0; k < p->threads; k++) {
+            if (offers[k].bucket < next) {
+                next = offers[k].bucket;
+            }
+            settled += offers[k].settled;
+        }
+        // The bucket stayed empty, so its nodes are final. Their heavy edges
+        // reach later buckets only and are relaxed once, then the buckets
+        // are offered again since these may have filed nodes below next.
+        if (settled > 0 && next != bucket) {
+            for (int i = 0; i < t->settled.count; i++) {
+                int u = t->settled.nodes[i];
+                relax(t, p->heavy[u], p->sorted.offsets[u + 1], __atomic_load_n(&p->distance[u], __ATOMIC_RELAXED));
+            }
+            t->settled.count = 0;
+            continue;
+        }
+        bucket = next;
+        if (bucket == INT_MAX) {
+            break;
+        }
+        // The offered nodes stay put for the others to read, new ones for
+        // this bucket go into a fresh bin
+        if (offer->bucket == bucket) {
+            t->current = t->bins[bucket];
+            memset(&t->bins[bucket], 0, sizeof(DeltaBin));
+        }
+        int total = 0;
+        for (int k = 0; k < p->threads; k++) {
+            total += offers[k].bucket == bucket ? offers[k].count : 0;
+        }
+
+        // Relax the bucket a chunk at a time
+        long long bottom = (long long)bucket * p->delta;
+        int i;
+        while ((i = __atomic_fetch_add(&p->claimed[round & 1], DELTA_CHUNK, __ATOMIC_RELAXED)) < total) {
+            int end = i + DELTA_CHUNK < total ? i + DELTA_CHUNK : total;
+            int k = 0;
+            int base = 0;
+            for (; i < end; i++) {
+                // Find the thread whose nodes hold entry i
+                while (offers[k].bucket != bucket || i >= base + offers[k].count) {
+                    base += offers[k].bucket == bucket ? offers[k].count : 0;
+                    k++;
+                }
+                int u = offers[k].nodes[i - base];
+                int du = __atomic_load_n(&p->distance[u], __ATOMIC_RELAXED);
+                // Filed here before its distance dropped into an earlier bucket
+                if (du < bottom) {
+                    continue;
+                }
+                // Light edges can lead back into this bucket, so they are
+                // relaxed every time u is, its heavy edges only once
+                relax(t, p->sorted.offsets[u], p->heavy[u], du);
+                // Two threads may both queue u, its heavy edges are then
+                // relaxed twice, which is harmless
+                if (p->heavy[u] < p->sorted.offsets[u + 1] &&
+                    __atomic_load_n(&p->settled_in[u], __ATOMIC_RELAXED) != bucket) {
+                    __atomic_store_n(&p->settled_in[u], bucket, __ATOMIC_RELAXED);
+                    bin_append(&t->settled, u);
+                }
+            }
+        }
+    }
+    free(t->current.nodes);
+    t->current.nodes = NULL;
+
+    t->reached = tree_parents(&p->sorted, p->distance, p->prev, first, last);
+    pthread_barrier_wait(&p->barrier);
+}
+
+static void *delta_worker(void *arg) {
+    DeltaThread *t = arg;
+    DeltaPool *p = t->p;
+    while (1) {
+        // Wait for delta_run or delta_free
+        pthread_barrier_wait(&p->barrier);
+        if (p->stopping) {
+            break;
+        }
+        delta_search(t);
+    }
+    return NULL;
+}
+
+DeltaPool *delta_create(const Graph *g, int threads) {
+    DeltaPool *p = malloc(sizeof(DeltaPool));
+    if (threads < 1) {
+        threads = 1;
+    }
+    if (!p) {
+        printf("Memory allocation failed for delta stepping\n");
+        exit(EXIT_FAILURE);
+    }
+    p->g = g;
+    p->threads = threads;
+    p->stopping = 0;
+    p->workers = calloc(threads, sizeof(DeltaThread));
+    p->offers[0] = malloc(threads * sizeof(DeltaOffer));
+    p->offers[1] = malloc(threads * sizeof(DeltaOffer));
+    if (!p->workers || !p->offers[0] || !p->offers[1]) {
+        printf("Memory allocation failed for delta stepping\n");
+        exit(EXIT_FAILURE);
+    }
+
+    long long sum = 0;
+    int count = 0;
+    for (int e = 0; e < g->offsets[g->num_nodes]; e++) {
+        if (g->weights[e] > 0) {
+            sum += g->weights[e];
+            count++;
+        }
+    }
+    p->mean_weight = count && sum / count > 0 ? (int)(sum / count) : 1;
+    sort_edges(p);
+    p->split_delta = 0;
+
+    pthread_barrier_init(&p->barrier, NULL, threads);
+    // The thread calling delta_run is thread 0
+    for (int k = 0; k < threads; k++) {
+        p->workers[k].p = p;
+        p->workers[k].id = k;
+    }
+    for (int k = 1; k < threads; k++) {
+        if (pthread_create(&p->workers[k].thread, NULL, delta_worker, &p->workers[k]) != 0) {
+            printf("Unable to start delta stepping worker\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    return p;
+}
+
+int delta_run(DeltaPool *p, int source, int delta, int *distance, int *prev) {
+    if (source < 0 || source >= p->g->num_nodes) {
+        return 0;
+    }
+    p->source = source;
+    int narrowest = p->mean_weight / DELTA_MIN_SHARE > 0 ? p->mean_weight / DELTA_MIN_SHARE : 1;
+    p->delta = delta > 0 ? delta : p->mean_weight;
+    if (p->delta < narrowest) {
+        p->delta = narrowest;
+    }
+    p->distance = distance;
+    p->prev = prev;
+    p->claimed[0] = 0;
+    p->claimed[1] = 0;
+    pthread_barrier_wait(&p->barrier);
+    delta_search(&p->workers[0]);
+
+    int reached = 0;
+    for (int k = 0; k < p->threads; k++) {
+        reached += p->workers[k].reached;
+    }
+    return reached;
+}
+
+void delta_free(DeltaPool *p) {
+    if (!p) {
+        return;
+    }
+    p->stopping = 1;
+    pthread_barrier_wait(&p->barrier);
+    for (int k = 0; k < p->threads; k++) {
+        DeltaThread *t = &p->workers[k];
+        if (k > 0) {
+            pthread_join(t->thread, NULL);
+        }
+        for (int b = 0; b < t->num_bins; b++) {
+            free(t->bins[b].nodes);
+        }
+        free(t->bins);
+        free(t->settled.nodes);
+    }
+    pthread_barrier_destroy(&p->barrier);
+    free(p->offers[0]);
+    free(p->offers[1]);
+    free(p->sorted.offsets);
+    free(p->sorted.neighbors);
+    free(p->sorted.weights);
+    free(p->heavy);
+    free(p->settled_in);
+    free(p->workers);
+    free(p);
+}
+
+int tree_parents(const Graph *g, const int *distance, int *prev, int first, int last) {
+    int reached = 0;
+    for (int v = first; v < last; v++) {
+        prev[v] = -1;
+        if (distance[v] == INT_MAX) {
+            continue;
+        }
+        reached++;
+        int best = INT_MAX;
+        for (int e = g->offsets[v]; e < g->offsets[v + 1]; e++) {
+            int u = g->neighbors[e];
+            // Edges run both ways, so the row of v lists the edges into it.
+            // Removed edges are zero weight self loops and never count.
+            if (g->weights[e] <= 0 || distance[u] == INT_MAX || distance[u] + g->weights[e] != distance[v]) {
+                continue;
+            }
+            if (distance[u] < best || (distance[u] == best && u < prev[v])) {
+                best = distance[u];
+                prev[v] = u;
+            }
+        }
+    }
+    return reached;
+}
@@ -0,0 +1,32 @@
+#ifndef T3_DELTA_H_
+#define T3_DELTA_H_
+
+#include "t3.h"
+
+// Delta stepping: a parallel engine for whole shortest path trees
+// Nodes are kept in buckets of width delta by tentative distance. All nodes
+// of the lowest bucket are relaxed at once, split among the threads, until
+// the bucket stays empty, then the next bucket is taken. Distances are
+// lowered with compare and swap and every thread files the nodes it
+// lowered in buckets of its own, so relaxing takes no locks. Edges up to
+// delta long are light and relaxed whenever their node is, heavier ones
+// can't reach the same bucket and are relaxed once per node after its
+// bucket stays empty. The threads are started once by delta_create and
+// wait between runs.
+typedef struct DeltaPool DeltaPool;
+
+DeltaPool *delta_create(const Graph *g, int threads); // the thread calling delta_run is one of the threads
+// distance and prev get an entry for every node of g, see path_tree for
+// their meaning. delta 0 uses the mean edge weight, and delta is raised to
+// a quarter of it at least. Returns the nodes reached. Only one run at a
+// time, and not while g changes.
+int delta_run(DeltaPool *p, int source, int delta, int *distance, int *prev);
+void delta_free(DeltaPool *p);
+
+// prev[v] for v in first..last-1 from final distances, the neighbour u with
+// distance[u] + weight == distance[v] that has the lowest distance, then
+// the lowest index. -1 for source and unreached nodes. Returns how many of
+// them were reached.
+int tree_parents(const Graph *g, const int *distance, int *prev, int first, int last);
+
+#endif
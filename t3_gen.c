@@ -0,0 +1,182 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "t3.h"
+#include "t3_gen.h"
+
+// Average distance between neighbouring stops in metres
+#define GEN_SPACING 150.0
+#define METRES_PER_DEGREE (EARTH_RADIUS_M * M_PI / 180.0)
+
+typedef struct GenState {
+    unsigned long long rng;
+    int nodes;
+    double *x; // metres east of the origin
+    double *y; // metres north of the origin
+    FILE *edges;
+    long num_edges;
+} GenState;
+
+// xorshift64*, the same seed gives the same graph everywhere
+static unsigned long long next_random(GenState *s) {
+    s->rng ^= s->rng >> 12;
+    s->rng ^= s->rng << 25;
+    s->rng ^= s->rng >> 27;
+    return s->rng * 2685821657736338717ULL;
+}
+
+static double uniform(GenState *s) {
+    return (next_random(s) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static void write_edge(GenState *s, int a, int b) {
+    double dx = s->x[a] - s->x[b];
+    double dy = s->y[a] - s->y[b];
+    int weight = (int)(sqrt(dx * dx + dy * dy) * (1.0 + 0.5 * uniform(s))) + 1;
+    fprintf(s->edges, "\"%d\",\"%d\",\"%d\"\n", a + 1, b + 1, weight);
+    s->num_edges++;
+}
+
+static void make_grid(GenState *s) {
+    int side = (int)ceil(sqrt((double)s->nodes));
+    for (int i = 0; i < s->nodes; i++) {
+        s->x[i] = (i % side) * GEN_SPACING;
+        s->y[i] = (i / side) * GEN_SPACING;
+    }
+    for (int i = 0; i < s->nodes; i++) {
+        if ((i + 1) % side != 0 && i + 1 < s->nodes) {
+            write_edge(s, i, i + 1);
+        }
+        if (i + side < s->nodes) {
+            write_edge(s, i, i + side);
+        }
+    }
+}
+
+static void scatter(GenState *s, double size) {
+    for (int i = 0; i < s->nodes; i++) {
+        s->x[i] = uniform(s) * size;
+        s->y[i] = uniform(s) * size;
+    }
+}
+
+// Bucket the stops into cells one radius wide and only compare stops in
+// neighbouring cells
+static int make_geometric(GenState *s) {
+    double size = GEN_SPACING * sqrt((double)s->nodes);
+    double radius = size * sqrt(6.0 / (M_PI * s->nodes));
+    scatter(s, size);
+    int cells = (int)(size / radius) + 1;
+    int *first = malloc((size_t)cells * cells * sizeof(int));
+    int *next = malloc(s->nodes * sizeof(int));
+    if (!first || !next) {
+        free(first);
+        free(next);
+        return 0;
+    }
+    memset(first, -1, (size_t)cells * cells * sizeof(int));
+    for (int i = 0; i < s->nodes; i++) {
+        int cell = (int)(s->y[i] / radius) * cells + (int)(s->x[i] / radius);
+        next[i] = first[cell];
+        first[cell] = i;
+    }
+    for (int i = 0; i < s->nodes; i++) {
+        int cx = (int)(s->x[i] / radius);
+        int cy = (int)(s->y[i] / radius);
+        for (int ny = cy - 1; ny <= cy + 1; ny++) {
+            for (int nx = cx - 1; nx <= cx + 1; nx++) {
+                if (nx < 0 || ny < 0 || nx >= cells || ny >= cells) {
+                    continue;
+                }
+                for (int j = first[ny * cells + nx]; j != -1; j = next[j]) {
+                    double dx = s->x[i] - s->x[j];
+                    double dy = s->y[i] - s->y[j];
+                    // Each pair once
+                    if (j > i && dx * dx + dy * dy <= radius * radius) {
+                        write_edge(s, i, j);
+                    }
+                }
+            }
+        }
+    }
+    free(first);
+    free(next);
+    return 1;
+}
+
+// Every edge end goes into targets, so a uniform pick from it chooses a
+// stop in proportion to its degree
+static int make_scalefree(GenState *s) {
+    const int links = 2;
+    scatter(s, GEN_SPACING * sqrt((double)s->nodes));
+    int *targets = malloc((size_t)2 * links * s->nodes * sizeof(int) + sizeof(int));
+    if (!targets) {
+        return 0;
+    }
+    long count = 0;
+    for (int i = 1; i < s->nodes; i++) {
+        int picks = i < links ? i : links;
+        for (int k = 0; k < picks; k++) {
+            // The first few stops link to everything before them
+            int j = i <= links ? k : targets[next_random(s) % count];
+            write_edge(s, i, j);
+            targets[count++] = j;
+            targets[count++] = i;
+        }
+    }
+    free(targets);
+    return 1;
+}
+
+long generate_graph(const char *kind, int nodes, unsigned int seed,
+                    const char *vertices, const char *edges) {
+    if (nodes < 1) {
+        printf("A graph needs at least one stop\n");
+        return -1;
+    }
+    GenState s;
+    s.rng = seed * 0x9E3779B97F4A7C15ULL + 1;
+    s.nodes = nodes;
+    s.num_edges = 0;
+    s.x = malloc(nodes * sizeof(double));
+    s.y = malloc(nodes * sizeof(double));
+    s.edges = fopen(edges, "w");
+    FILE *out = fopen(vertices, "w");
+    int ok = s.x && s.y && s.edges && out;
+    if (!ok) {
+        printf("Unable to write %s and %s\n", vertices, edges);
+    }
+
+    if (ok) {
+        fprintf(s.edges, "vertex1,vertex2,weight\n");
+        if (strcmp(kind, "grid") == 0) {
+            make_grid(&s);
+        } else if (strcmp(kind, "geometric") == 0) {
+            ok = make_geometric(&s);
+        } else if (strcmp(kind, "scalefree") == 0) {
+            ok = make_scalefree(&s);
+        } else {
+            printf("Unknown graph kind %s\n", kind);
+            ok = 0;
+        }
+    }
+    if (ok) {
+        fprintf(out, "StopId,Name,Latitude,Longitude\n");
+        double lon_scale = METRES_PER_DEGREE * cos(53.35 * M_PI / 180.0);
+        for (int i = 0; i < nodes; i++) {
+            fprintf(out, "\"%d\",\"Stop %d\",\"%.8f\",\"%.8f\"\n", i + 1, i + 1,
+                    53.35 + s.y[i] / METRES_PER_DEGREE, -6.26 + s.x[i] / lon_scale);
+        }
+    }
+
+    if (s.edges && fclose(s.edges) != 0) {
+        ok = 0;
+    }
+    if (out && fclose(out) != 0) {
+        ok = 0;
+    }
+    free(s.x);
+    free(s.y);
+    return ok ? s.num_edges : -1;
+}
@@ -0,0 +1,17 @@
+#ifndef T3_GEN_H_
+#define T3_GEN_H_
+
+// Synthetic networks written as vertices and edges CSV files in the same
+// layout as the Dublin data, so they load through load_vertices/load_edges.
+// Stops are numbered 1..nodes and placed around Dublin about 150 m apart,
+// edge weights are the distance between the stops times 1.0 to 1.5.
+//   grid       square lattice, every stop linked to its 4 neighbours
+//   geometric  random positions, stops closer than a radius giving about
+//              6 neighbours each are linked
+//   scalefree  preferential attachment, every new stop links to 2 existing
+//              ones picked in proportion to their degree
+// Returns the number of edges written, -1 on failure.
+long generate_graph(const char *kind, int nodes, unsigned int seed,
+                    const char *vertices, const char *edges);
+
+#endif
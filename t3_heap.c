@@ -0,0 +1,301 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "t3_heap.h"
+#include "instrument.h"
+
+// Ordering used by every queue kind, smaller key first then smaller node id
+static int pq_less(const PQueue *q, int a, int b) {
+    return q->key[a] < q->key[b] || (q->key[a] == q->key[b] && a < b);
+}
+
+PQueue *pq_create(PQKind kind, int capacity) {
+    PQueue *q = calloc(1, sizeof(PQueue));
+    if (!q) {
+        printf("Memory allocation failed for PQueue\n");
+        exit(EXIT_FAILURE);
+    }
+    q->kind = kind;
+    q->capacity = capacity;
+    q->key = malloc(capacity * sizeof(int));
+    q->pos = malloc(capacity * sizeof(int));
+    if (kind != PQ_RADIX) {
+        q->heap = malloc(capacity * sizeof(int));
+    }
+    if (!q->key || !q->pos || (kind != PQ_RADIX && !q->heap)) {
+        printf("Memory allocation failed for PQueue\n");
+        exit(EXIT_FAILURE);
+    }
+    // Nothing is queued yet
+    memset(q->pos, -1, capacity * sizeof(int));
+    return q;
+}
+
+void pq_clear(PQueue *q) {
+    if (q->kind == PQ_RADIX) {
+        for (int b = 0; b < 33; b++) {
+            for (int i = 0; i < q->bucket_size[b]; i++) {
+                q->pos[(int)(q->buckets[b][i] & 0xffffffffu)] = -1;
+            }
+            q->bucket_size[b] = 0;
+        }
+        q->last = 0;
+    } else {
+        for (int i = 0; i < q->size; i++) {
+            q->pos[q->heap[i]] = -1;
+        }
+    }
+    q->size = 0;
+}
+
+/* ---------- d-ary heaps ---------- */
+
+static int pq_arity(const PQueue *q) {
+    return q->kind == PQ_QUATERNARY ? 4 : 2;
+}
+
+// Place node at slot i and record where it went
+static void heap_set(PQueue *q, int i, int node) {
+    q->heap[i] = node;
+    q->pos[node] = i;
+}
+
+static void sift_up(PQueue *q, int i) {
+    int d = pq_arity(q);
+    int node = q->heap[i];
+    while (i > 0) {
+        int parent = (i - 1) / d;
+        if (!pq_less(q, node, q->heap[parent])) {
+            break;
+        }
+        heap_set(q, i, q->heap[parent]);
+        i = parent;
+    }
+    heap_set(q, i, node);
+}
+
+static void sift_down(PQueue *q, int i) {
+    int d = pq_arity(q);
+    int node = q->heap[i];
+    while (1) {
+        int first = i * d + 1;
+        if (first >= q->size) {
+            break;
+        }
+        // Find the smallest child
+        int best = first;
+        int last = first + d < q->size ? first + d : q->size;
+        for (int c = first + 1; c < last; c++) {
+            if (pq_less(q, q->heap[c], q->heap[best])) {
+                best = c;
+            }
+        }
+        if (!pq_less(q, q->heap[best], node)) {
+            break;
+        }
+        heap_set(q, i, q->heap[best]);
+        i = best;
+    }
+    heap_set(q, i, node);
+}
+
+/* ---------- radix heap ---------- */
+
+// Packed entries compare by key first and node id second
+static uint64_t radix_pack(int node, int key) {
+    return ((uint64_t)(unsigned int)key << 32) | (unsigned int)node;
+}
+
+// Bucket b holds entries whose key differs from last first at bit b - 1,
+// bucket 0 holds the entries with a key equal to last
+static int radix_bucket(const PQueue *q, uint64_t entry) {
+    unsigned int diff = (unsigned int)(entry >> 32) ^ q->last;
+    return diff ? 32 - __builtin_clz(diff) : 0;
+}
+
+static void radix_grow(PQueue *q, int b) {
+    if (q->bucket_size[b] == q->bucket_cap[b]) {
+        int cap = q->bucket_cap[b] ? q->bucket_cap[b] * 2 : 16;
+        uint64_t *grown = realloc(q->buckets[b], cap * sizeof(uint64_t));
+        if (!grown) {
+            printf("Memory allocation failed for PQueue\n");
+            exit(EXIT_FAILURE);
+        }
+        q->buckets[b] = grown;
+        q->bucket_cap[b] = cap;
+    }
+}
+
+// Bucket 0 is a binary min heap of its entries, they all share a key so
+// many nodes on one key still pop in node order in O(log k)
+static void radix_append(PQueue *q, int b, uint64_t entry) {
+    radix_grow(q, b);
+    uint64_t *bucket = q->buckets[b];
+    int i = q->bucket_size[b]++;
+    if (b == 0) {
+        while (i > 0 && entry < bucket[(i - 1) / 2]) {
+            bucket[i] = bucket[(i - 1) / 2];
+            i = (i - 1) / 2;
+        }
+    }
+    bucket[i] = entry;
+}
+
+// Removes and returns the smallest entry of bucket 0
+static uint64_t radix_take_first(PQueue *q) {
+    uint64_t *bucket = q->buckets[0];
+    uint64_t first = bucket[0];
+    uint64_t entry = bucket[--q->bucket_size[0]];
+    int size = q->bucket_size[0];
+    int i = 0;
+    while (1) {
+        int child = 2 * i + 1;
+        if (child >= size) {
+            break;
+        }
+        if (child + 1 < size && bucket[child + 1] < bucket[child]) {
+            child++;
+        }
+        if (bucket[child] >= entry) {
+            break;
+        }
+        bucket[i] = bucket[child];
+        i = child;
+    }
+    if (size > 0) {
+        bucket[i] = entry;
+    }
+    return first;
+}
+
+// An entry is stale once its node was popped or given a smaller key
+static int radix_live(const PQueue *q, uint64_t entry) {
+    int node = (int)(entry & 0xffffffffu);
+    return q->pos[node] != -1 && radix_pack(node, q->key[node]) == entry;
+}
+
+/* ---------- common interface ---------- */
+
+void pq_push(PQueue *q, int node, int key) {
+    if (q->kind == PQ_RADIX) {
+        // Keys may never drop below the last popped key, which holds for
+        // Dijkstra and for A* with a consistent heuristic
+        if (q->pos[node] == -1) {
+            q->size++;
+            INSTR_ADD(pushes, 1);
+        } else if (key < q->key[node]) {
+            INSTR_ADD(decrease_keys, 1);
+        } else {
+            // Like the d-ary heaps a larger key leaves the node as it is
+            return;
+        }
+        q->pos[node] = 1;
+        q->key[node] = key;
+        uint64_t entry = radix_pack(node, key);
+        radix_append(q, radix_bucket(q, entry), entry);
+        return;
+    }
+
+    if (q->pos[node] == -1) {
+        // New node goes at the bottom and bubbles up
+        q->key[node] = key;
+        heap_set(q, q->size++, node);
+        sift_up(q, q->size - 1);
+        INSTR_ADD(pushes, 1);
+    } else if (key < q->key[node]) {
+        // Decrease key in place
+        q->key[node] = key;
+        INSTR_ADD(decrease_keys, 1);
+        sift_up(q, q->pos[node]);
+    }
+}
+
+int pq_pop(PQueue *q, int *key) {
+    if (q->size == 0) {
+        return -1;
+    }
+
+    int node;
+    if (q->kind == PQ_RADIX) {
+        while (1) {
+            // Take the smallest live entry of bucket 0, dropping stale ones
+            node = -1;
+            while (node < 0 && q->bucket_size[0] > 0) {
+                uint64_t entry = radix_take_first(q);
+                if (radix_live(q, entry)) {
+                    node = (int)(entry & 0xffffffffu);
+                }
+            }
+            if (node >= 0) {
+                break;
+            }
+            int b = 1;
+            while (q->bucket_size[b] == 0) {
+                b++;
+            }
+            // Move last up to the smallest live key and redistribute around it
+            uint64_t min = UINT64_MAX;
+            for (int i = 0; i < q->bucket_size[b]; i++) {
+                uint64_t entry = q->buckets[b][i];
+                if (radix_live(q, entry) && entry < min) {
+                    min = entry;
+                }
+            }
+            int count = q->bucket_size[b];
+            q->bucket_size[b] = 0;
+            if (min == UINT64_MAX) {
+                continue; // bucket held only stale entries
+            }
+            q->last = (unsigned int)(min >> 32);
+            for (int i = 0; i < count; i++) {
+                uint64_t entry = q->buckets[b][i];
+                if (radix_live(q, entry)) {
+                    radix_append(q, radix_bucket(q, entry), entry);
+                }
+            }
+        }
+    } else {
+        node = q->heap[0];
+        q->size--;
+        if (q->size > 0) {
+            heap_set(q, 0, q->heap[q->size]);
+            sift_down(q, 0);
+        }
+    }
+
+    if (q->kind == PQ_RADIX) {
+        q->size--;
+    }
+    q->pos[node] = -1;
+    INSTR_ADD(pops, 1);
+    if (key) {
+        *key = q->key[node];
+    }
+    return node;
+}
+
+void pq_free(PQueue *q) {
+    if (!q) {
+        return;
+    }
+    for (int b = 0; b < 33; b++) {
+        free(q->buckets[b]);
+    }
+    free(q->key);
+    free(q->pos);
+    free(q->heap);
+    free(q);
+}
+
+int pq_kind_from_name(const char *name) {
+    if (strcmp(name, "binary") == 0) {
+        return PQ_BINARY;
+    }
+    if (strcmp(name, "4ary") == 0) {
+        return PQ_QUATERNARY;
+    }
+    if (strcmp(name, "radix") == 0) {
+        return PQ_RADIX;
+    }
+    return -1;
+}
@@ -0,0 +1,40 @@
+#ifndef T3_HEAP_H_
+#define T3_HEAP_H_
+
+#include <stdint.h>
+
+// Priority queue implementations available to the search engines
+typedef enum PQKind {
+    PQ_BINARY,
+    PQ_QUATERNARY,
+    PQ_RADIX
+} PQKind;
+
+// Min priority queue of node ids keyed by non-negative int distances
+// Ties are broken by the lower node id so every kind settles nodes in the
+// same order as a linear min_distance scan would
+typedef struct PQueue {
+    PQKind kind;
+    int capacity; // node ids must be below this
+    int size;     // number of live nodes in the queue
+    int *key;     // current key of every queued node
+    int *pos;     // heap slot of a node, -1 when not queued
+    // d-ary heap storage
+    int *heap;
+    // radix heap storage, 33 buckets of packed (key << 32 | node) entries
+    // bucketed by the highest key bit that differs from the last popped key
+    unsigned int last;
+    uint64_t *buckets[33];
+    int bucket_size[33];
+    int bucket_cap[33];
+} PQueue;
+
+PQueue *pq_create(PQKind kind, int capacity); // creates an empty queue for node ids 0..capacity-1
+void pq_clear(PQueue *q); // removes every node from the queue
+void pq_push(PQueue *q, int node, int key); // inserts node, or lowers its key if it is already queued
+int pq_pop(PQueue *q, int *key); // removes the minimum node and returns it, -1 if the queue is empty
+void pq_free(PQueue *q); // frees the queue
+
+int pq_kind_from_name(const char *name); // parses "binary", "4ary" or "radix", -1 if unknown
+
+#endif
@@ -0,0 +1,531 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "t3.h"
+#include "t3_csv.h"
+#include "t3_stops.h"
+#include "t3_load.h"
+
+// Ranges smaller than this aren't worth a thread of their own
+#define LOAD_MIN_CHUNK (1 << 20)
+// Bytes of CSV per record, only used to size the first buffers
+#define LOAD_RECORD_GUESS 16
+
+// One stop record, the name points into the file
+typedef struct StopRecord {
+    int id;
+    const char *name;
+    int name_len;
+    float latitude;
+    float longitude;
+} StopRecord;
+
+// One byte range of the file and what its thread read from it
+typedef struct LoadChunk {
+    pthread_t thread;
+    CsvReader r;
+    const StopTable *stops; // maps stop numbers while reading edges
+    int stopped; // a malformed record ended parsing before the end of the range
+    int records;
+    StopRecord *stop_records;
+    Edge *edges; // stop indices
+    int num_edges;
+    Edge *unknown; // stop numbers of edges with a stop that doesn't exist
+    int num_unknown;
+    int cap;
+    int unknown_cap;
+} LoadChunk;
+
+// Shared by the threads building the CSR arrays. Thread k reads chunk k
+// and owns the rows of node range k, ranges split the nodes evenly.
+typedef struct CsrBuild {
+    LoadChunk *chunks;
+    int parts;
+    int n;
+    // Per chunk and range: entries the chunk has for the range, and where
+    // its next one goes in by_range
+    long long *spread;
+    long long *cursor;
+    long long *range_start; // where each range's entries start, parts + 1 entries
+    Edge *by_range; // both directions of every edge from the row's node, grouped by range
+    int *row; // start of every row in the unsorted arrays, n + 1 entries
+    int *kept; // entries of each row, then where its next one goes, then those left after dropping duplicates
+    long long *partial; // per thread sums, turned into each thread's base
+    int *neighbors; // both directions of every edge grouped by row
+    int *weights;
+    Graph *g;
+    pthread_barrier_t barrier;
+} CsrBuild;
+
+typedef struct CsrWorker {
+    pthread_t thread;
+    CsrBuild *b;
+    int id;
+    // One row's neighbours with their entries, sorted to find duplicates
+    int *pairs;
+    int pairs_cap;
+} CsrWorker;
+
+// Number of ranges to parse r in
+static int load_parts(const CsvReader *r, int threads) {
+    size_t chunks = 1 + (r->size - r->pos) / LOAD_MIN_CHUNK;
+    if (threads < 1) {
+        threads = 1;
+    }
+    return chunks < (size_t)threads ? (int)chunks : threads;
+}
+
+// Makes room for one more item, doubling the array when it is full
+static void *grow(void *items, int count, int *cap, size_t size) {
+    if (count < *cap) {
+        return items;
+    }
+    *cap = *cap ? *cap * 2 : 1024;
+    items = realloc(items, (size_t)*cap * size);
+    if (!items) {
+        printf("Memory allocation failed while loading\n");
+        exit(EXIT_FAILURE);
+    }
+    return items;
+}
+
+static int first_cap(const LoadChunk *c) {
+    return (int)((c->r.size - c->r.pos) / LOAD_RECORD_GUESS) + 16;
+}
+
+// Function to parse a stop from the CSV file
+static int parse_stop(CsvReader *r, StopRecord *stop) {
+    const char *field;
+    int len;
+
+    // Read stop_no
+    if (csv_next_field(r, &field, &len) == NEXT_FIELD_FAIL) {
+        return 0;
+    }
+    stop->id = csv_parse_int(field, len);
+
+    // Read Name
+    if (csv_next_field(r, &field, &len) == NEXT_FIELD_FAIL) {
+        return 0;
+    }
+    if (len > MAX_STRING_SIZE - 1) {
+        len = MAX_STRING_SIZE - 1;
+    }
+    stop->name = field;
+    stop->name_len = len;
+
+    // Read Latitude
+    if (csv_next_field(r, &field, &len) == NEXT_FIELD_FAIL) {
+        return 0;
+    }
+    stop->latitude = csv_parse_double(field, len);
+
+    // Read Longitude
+    if (csv_next_field(r, &field, &len) == NEXT_FIELD_FAIL) {
+        return 0;
+    }
+    stop->longitude = csv_parse_double(field, len);
+    return 1;
+}
+
+// Function to parse an edge from the CSV file
+static int parse_edge(CsvReader *r, Edge *edge) {
+    const char *field;
+    int len;
+
+    // Read from
+    if (csv_next_field(r, &field, &len) == NEXT_FIELD_FAIL) {
+        return 0;
+    }
+    edge->from = csv_parse_int(field, len);
+
+    // Read to
+    if (csv_next_field(r, &field, &len) == NEXT_FIELD_FAIL) {
+        return 0;
+    }
+    edge->to = csv_parse_int(field, len);
+
+    // Read weight
+    if (csv_next_field(r, &field, &len) == NEXT_FIELD_FAIL) {
+        return 0;
+    }
+    edge->weight = csv_parse_int(field, len);
+
+    return 1;
+}
+
+static void *read_stops(void *arg) {
+    LoadChunk *c = arg;
+    StopRecord stop;
+    c->cap = first_cap(c);
+    c->stop_records = malloc(c->cap * sizeof(StopRecord));
+    if (!c->stop_records) {
+        printf("Memory allocation failed while loading\n");
+        exit(EXIT_FAILURE);
+    }
+    while (parse_stop(&c->r, &stop)) {
+        c->stop_records = grow(c->stop_records, c->records, &c->cap, sizeof(StopRecord));
+        c->stop_records[c->records++] = stop;
+    }
+    c->stopped = c->r.pos < c->r.size;
+    return NULL;
+}
+
+static void *read_edges(void *arg) {
+    LoadChunk *c = arg;
+    Edge edge;
+    c->cap = first_cap(c);
+    c->edges = malloc(c->cap * sizeof(Edge));
+    if (!c->edges) {
+        printf("Memory allocation failed while loading\n");
+        exit(EXIT_FAILURE);
+    }
+    while (parse_edge(&c->r, &edge)) {
+        c->records++;
+        // The graph is indexed by stop, not by the numbers in the file
+        int from = stops_find(c->stops, edge.from);
+        int to = stops_find(c->stops, edge.to);
+        if (from < 0 || to < 0) {
+            c->unknown = grow(c->unknown, c->num_unknown, &c->unknown_cap, sizeof(Edge));
+            c->unknown[c->num_unknown++] = edge;
+            continue;
+        }
+        c->edges = grow(c->edges, c->num_edges, &c->cap, sizeof(Edge));
+        edge.from = from;
+        edge.to = to;
+        c->edges[c->num_edges++] = edge;
+    }
+    c->stopped = c->r.pos < c->r.size;
+    return NULL;
+}
+
+// Splits r, runs read on every range and returns how many ranges count
+// The calling thread reads the first range. Ranges after the first one that
+// stopped early are dropped, a single pass would never have reached them.
+static int read_chunks(CsvReader *r, int threads, const StopTable *stops,
+                       void *(*read)(void *), LoadChunk **result) {
+    int parts = load_parts(r, threads);
+    CsvReader *ranges = malloc(parts * sizeof(CsvReader));
+    LoadChunk *chunks = calloc(parts, sizeof(LoadChunk));
+    if (!ranges || !chunks) {
+        printf("Memory allocation failed while loading\n");
+        exit(EXIT_FAILURE);
+    }
+    csv_split(r, parts, ranges);
+    for (int k = 0; k < parts; k++) {
+        chunks[k].r = ranges[k];
+        chunks[k].stops = stops;
+    }
+    free(ranges);
+
+    for (int k = 1; k < parts; k++) {
+        if (pthread_create(&chunks[k].thread, NULL, read, &chunks[k]) != 0) {
+            printf("Unable to start load worker\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    read(&chunks[0]);
+    for (int k = 1; k < parts; k++) {
+        pthread_join(chunks[k].thread, NULL);
+    }
+
+    int used = 1;
+    while (used < parts && !chunks[used - 1].stopped) {
+        used++;
+    }
+    r->pos = chunks[used - 1].r.pos;
+    *result = chunks;
+    return used;
+}
+
+static void free_chunks(LoadChunk *chunks, int parts) {
+    for (int k = 0; k < parts; k++) {
+        free(chunks[k].stop_records);
+        free(chunks[k].edges);
+        free(chunks[k].unknown);
+    }
+    free(chunks);
+}
+
+int load_stop_records(CsvReader *r, StopTable *stops, int threads) {
+    LoadChunk *chunks;
+    int parts = load_parts(r, threads);
+    int used = read_chunks(r, threads, NULL, read_stops, &chunks);
+
+    // Stops get their index in file order, so the table is filled on one thread
+    int added = 0;
+    for (int k = 0; k < used; k++) {
+        for (int i = 0; i < chunks[k].records; i++) {
+            StopRecord *s = &chunks[k].stop_records[i];
+            if (stops_add(stops, s->id, s->name, s->name_len, s->latitude, s->longitude) < 0) {
+                printf("Unable to add stop %d\n", s->id);
+            } else {
+                added++;
+            }
+        }
+    }
+    free_chunks(chunks, parts);
+    return added;
+}
+
+// First node of range k when n nodes are split into parts ranges
+static int range_first(int n, int parts, int k) {
+    return (int)(((long long)n * k + parts - 1) / parts);
+}
+
+// Range node u falls in, range_first(n, parts, k) <= u < range_first(n, parts, k + 1)
+static int range_of(int n, int parts, int u) {
+    return (int)((long long)u * parts / n);
+}
+
+// Turns b->partial into the sum of the threads before each one and returns
+// the total, every thread runs this on its own after a barrier
+static long long thread_base(CsrBuild *b, int id, long long *base) {
+    long long total = 0;
+    for (int t = 0; t < b->parts; t++) {
+        if (t == id) {
+            *base = total;
+        }
+        total += b->partial[t];
+    }
+    return total;
+}
+
+static int compare_pairs(const void *a, const void *b) {
+    const int *x = a;
+    const int *y = b;
+    if (x[0] != y[0]) {
+        return x[0] < y[0] ? -1 : 1;
+    }
+    return x[1] < y[1] ? -1 : x[1] > y[1];
+}
+
+// Zeroes the weight of every entry of row first..last-1 that has a later
+// entry for the same neighbour, so only the last one is kept like
+// build_graph does
+static void mark_duplicates(CsrWorker *w, const int *neighbors, int *weights, int first, int last) {
+    int count = last - first;
+    if (count < 2) {
+        return;
+    }
+    if (count > w->pairs_cap) {
+        w->pairs_cap = count * 2;
+        free(w->pairs);
+        w->pairs = malloc(w->pairs_cap * 2 * sizeof(int));
+        if (!w->pairs) {
+            printf("Memory allocation failed for Graph\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int e = first; e < last; e++) {
+        w->pairs[2 * (e - first)] = neighbors[e];
+        w->pairs[2 * (e - first) + 1] = e;
+    }
+    qsort(w->pairs, count, 2 * sizeof(int), compare_pairs);
+    for (int i = 0; i + 1 < count; i++) {
+        if (w->pairs[2 * i] == w->pairs[2 * i + 2]) {
+            weights[w->pairs[2 * i + 1]] = 0;
+        }
+    }
+}
+
+// Thread id sorts the edges of chunk id by node range, then sorts out the
+// rows of range id. Both steps are stable, so every row keeps the file
+// order of its entries. Each step waits for the one before it to finish on
+// every thread. Memory is O(parts * parts) besides the edges themselves.
+static void *build_worker(void *arg) {
+    CsrWorker *w = arg;
+    CsrBuild *b = w->b;
+    int id = w->id;
+    int n = b->n;
+    int parts = b->parts;
+    long long *spread = b->spread + (size_t)id * parts;
+    long long *cursor = b->cursor + (size_t)id * parts;
+    const LoadChunk *c = &b->chunks[id];
+
+    // Count both directions of every edge of this chunk by range
+    memset(spread, 0, parts * sizeof(long long));
+    for (int i = 0; i < c->num_edges; i++) {
+        spread[range_of(n, parts, c->edges[i].from)]++;
+        spread[range_of(n, parts, c->edges[i].to)]++;
+    }
+    pthread_barrier_wait(&b->barrier);
+
+    // Ranges one after the other, chunk by chunk inside every range
+    long long base = 0;
+    for (int k = 0; k < parts; k++) {
+        if (k == id) {
+            b->range_start[id] = base;
+        }
+        for (int t = 0; t < parts; t++) {
+            long long count = b->spread[(size_t)t * parts + k];
+            if (t == id) {
+                cursor[k] = base;
+            }
+            base += count;
+        }
+    }
+    long long total = base;
+    if (id == 0) {
+        b->range_start[parts] = total;
+        b->by_range = malloc((total ? total : 1) * sizeof(Edge));
+        b->neighbors = malloc((total ? total : 1) * sizeof(int));
+        b->weights = malloc((total ? total : 1) * sizeof(int));
+        if (!b->by_range || !b->neighbors || !b->weights) {
+            printf("Memory allocation failed for Graph\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    pthread_barrier_wait(&b->barrier);
+
+    // Scatter the edges of this chunk into their ranges
+    Edge *by_range = b->by_range;
+    for (int i = 0; i < c->num_edges; i++) {
+        const Edge *e = &c->edges[i];
+        Edge *entry = &by_range[cursor[range_of(n, parts, e->from)]++];
+        *entry = *e;
+        entry = &by_range[cursor[range_of(n, parts, e->to)]++];
+        entry->from = e->to;
+        entry->to = e->from;
+        entry->weight = e->weight;
+    }
+    pthread_barrier_wait(&b->barrier);
+
+    // Counting sort of range id into its rows, which take the same part of
+    // the arrays as the range did
+    int first = range_first(n, parts, id);
+    int last = range_first(n, parts, id + 1);
+    long long begin = b->range_start[id];
+    long long end = b->range_start[id + 1];
+    int *neighbors = b->neighbors;
+    int *weights = b->weights;
+    for (int u = first; u < last; u++) {
+        b->kept[u] = 0;
+    }
+    for (long long i = begin; i < end; i++) {
+        b->kept[by_range[i].from]++;
+    }
+    base = begin;
+    for (int u = first; u < last; u++) {
+        int count = b->kept[u];
+        b->row[u] = (int)base;
+        b->kept[u] = (int)base;
+        base += count;
+    }
+    for (long long i = begin; i < end; i++) {
+        int slot = b->kept[by_range[i].from]++;
+        neighbors[slot] = by_range[i].to;
+        weights[slot] = by_range[i].weight;
+    }
+    if (id == parts - 1) {
+        b->row[n] = (int)total;
+    }
+
+    // Compact the rows, dropping removed and duplicate entries
+    long long sum = 0;
+    for (int u = first; u < last; u++) {
+        int out = b->row[u];
+        int row_end = u + 1 < last ? b->row[u + 1] : (int)end;
+        mark_duplicates(w, neighbors, weights, b->row[u], row_end);
+        for (int e = b->row[u]; e < row_end; e++) {
+            if (weights[e] != 0) {
+                neighbors[out] = neighbors[e];
+                weights[out++] = weights[e];
+            }
+        }
+        b->kept[u] = out - b->row[u];
+        sum += b->kept[u];
+    }
+    b->partial[id] = sum;
+    pthread_barrier_wait(&b->barrier);
+
+    // Copy the compacted rows into arrays of the final size
+    Graph *g = b->g;
+    total = thread_base(b, id, &base);
+    if (id == 0) {
+        free(b->by_range);
+        b->by_range = NULL;
+        g->offsets[n] = (int)total;
+        g->num_edges = (int)total;
+        g->neighbors = malloc((total ? total : 1) * sizeof(int));
+        g->weights = malloc((total ? total : 1) * sizeof(int));
+        if (!g->neighbors || !g->weights) {
+            printf("Memory allocation failed for Graph\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    pthread_barrier_wait(&b->barrier);
+    for (int u = first; u < last; u++) {
+        g->offsets[u] = (int)base;
+        memcpy(g->neighbors + base, neighbors + b->row[u], b->kept[u] * sizeof(int));
+        memcpy(g->weights + base, weights + b->row[u], b->kept[u] * sizeof(int));
+        base += b->kept[u];
+    }
+    return NULL;
+}
+
+int load_edge_records(CsvReader *r, const StopTable *stops, Graph *g, int threads) {
+    LoadChunk *chunks;
+    int parts = load_parts(r, threads);
+    int used = read_chunks(r, threads, stops, read_edges, &chunks);
+
+    int records = 0;
+    for (int k = 0; k < used; k++) {
+        for (int i = 0; i < chunks[k].num_unknown; i++) {
+            printf("Edge %d-%d refers to an unknown stop\n", chunks[k].unknown[i].from, chunks[k].unknown[i].to);
+        }
+        records += chunks[k].records;
+    }
+
+    // One builder per chunk that was kept
+    int n = g->num_nodes;
+    CsrBuild b;
+    b.chunks = chunks;
+    b.parts = used;
+    b.n = n;
+    b.spread = malloc((size_t)used * used * sizeof(long long));
+    b.cursor = malloc((size_t)used * used * sizeof(long long));
+    b.range_start = malloc((used + 1) * sizeof(long long));
+    b.row = malloc((n + 1) * sizeof(int));
+    b.kept = malloc((n ? n : 1) * sizeof(int));
+    b.partial = malloc(used * sizeof(long long));
+    b.g = g;
+    CsrWorker *workers = calloc(used, sizeof(CsrWorker));
+    if (!b.spread || !b.cursor || !b.range_start || !b.row || !b.kept || !b.partial || !workers) {
+        printf("Memory allocation failed for Graph\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int k = 0; k < used; k++) {
+        workers[k].b = &b;
+        workers[k].id = k;
+    }
+    pthread_barrier_init(&b.barrier, NULL, used);
+    // The calling thread is builder 0
+    for (int k = 1; k < used; k++) {
+        if (pthread_create(&workers[k].thread, NULL, build_worker, &workers[k]) != 0) {
+            printf("Unable to start load worker\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    build_worker(&workers[0]);
+    for (int k = 1; k < used; k++) {
+        pthread_join(workers[k].thread, NULL);
+    }
+    pthread_barrier_destroy(&b.barrier);
+
+    for (int k = 0; k < used; k++) {
+        free(workers[k].pairs);
+    }
+    free(b.spread);
+    free(b.cursor);
+    free(b.range_start);
+    free(b.row);
+    free(b.kept);
+    free(b.partial);
+    free(b.neighbors);
+    free(b.weights);
+    free(workers);
+    free_chunks(chunks, parts);
+    return records;
+}
@@ -0,0 +1,28 @@
+#ifndef T3_LOAD_H_
+#define T3_LOAD_H_
+
+#include "t3.h"
+#include "t3_csv.h"
+#include "t3_stops.h"
+
+// Parallel CSV loading for load_vertices and load_edges
+// The records left in r are split into byte ranges on record boundaries
+// (see csv_split) and every range is parsed on its own thread, up to
+// threads of them and fewer for small files. The result is the same as
+// parsing the file in one pass: records keep their file order and parsing
+// still ends at the first malformed record. r->pos is left after the last
+// record read.
+
+// Adds every stop record to stops in file order, returns the stops added
+int load_stop_records(CsvReader *r, StopTable *stops, int threads);
+
+// Reads every edge record, maps its stop numbers to indices with stops and
+// builds the CSR arrays of the empty graph g from them with a parallel
+// two level counting sort, by node range on the thread that read the edges
+// and by row on the thread owning the range. Besides the edges it needs
+// O(threads * threads + nodes) memory, and gives the arrays add_edge and
+// build_graph would. Edges
+// with unknown stops are reported and skipped. Returns the records read.
+int load_edge_records(CsvReader *r, const StopTable *stops, Graph *g, int threads);
+
+#endif
@@ -0,0 +1,440 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "t3.h"
+#include "t3_batch.h"
+#include "t3_server.h"
+#include "t3_writer.h"
+#include "instrument.h"
+
+// Bytes read from a client per turn, a request line has to fit
+#define SERVER_BUFFER 65536
+// Connections waiting in the kernel to be accepted
+#define SERVER_BACKLOG 256
+// Unsent answers a client may have before its requests are left unread
+#define SERVER_OUTPUT_LIMIT (1 << 20)
+
+// Set by the signal handler, the event loop checks it when interrupted
+static volatile sig_atomic_t stopping;
+
+static void stop_serving(int sig) {
+    (void)sig;
+    stopping = 1;
+}
+
+// One client, only ever handled by one worker at a time since epoll
+// reports it once and it is re-armed after its turn. The socket is non
+// blocking, answers the client isn't reading yet wait in out.
+typedef struct Connection {
+    int fd;
+    char *out; // answers not sent yet
+    size_t out_used;
+    size_t out_sent;
+    size_t out_cap;
+    char buffer[SERVER_BUFFER + 1];
+    int used; // bytes of lines not answered yet
+    int overflow; // dropping the rest of a line that didn't fit
+    int hung_up; // the client has sent everything, only answers are left
+    struct Connection *next_ready;
+    struct Connection *prev_open;
+    struct Connection *next_open;
+} Connection;
+
+typedef struct ServerPool {
+    pthread_mutex_t lock;
+    pthread_cond_t ready; // a connection has input or the server is stopping
+    Connection *first_ready; // FIFO of connections with input
+    Connection *last_ready;
+    Connection *open; // every connection, so they can be closed on stop
+    int epoll_fd;
+    int done;
+} ServerPool;
+
+typedef struct ServerWorker {
+    pthread_t thread;
+    ServerPool *pool;
+    SearchWorkspace *ws;
+    PathWriter *writer; // formats the answers of the connection it is serving
+    long answered;
+} ServerWorker;
+
+static void push_ready(ServerPool *pool, Connection *c) {
+    pthread_mutex_lock(&pool->lock);
+    c->next_ready = NULL;
+    if (pool->last_ready) {
+        pool->last_ready->next_ready = c;
+    } else {
+        pool->first_ready = c;
+    }
+    pool->last_ready = c;
+    pthread_cond_signal(&pool->ready);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// Next connection with input, NULL once the server is stopping
+static Connection *take_ready(ServerPool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    while (!pool->first_ready && !pool->done) {
+        pthread_cond_wait(&pool->ready, &pool->lock);
+    }
+    Connection *c = NULL;
+    if (!pool->done) {
+        c = pool->first_ready;
+        pool->first_ready = c->next_ready;
+        if (!pool->first_ready) {
+            pool->last_ready = NULL;
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return c;
+}
+
+static Connection *open_connection(ServerPool *pool, int fd) {
+    Connection *c = malloc(sizeof(Connection));
+    int flags = fcntl(fd, F_GETFL);
+    if (!c || flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) != 0) {
+        printf("Unable to set up connection\n");
+        free(c);
+        close(fd);
+        return NULL;
+    }
+    c->fd = fd;
+    c->out = NULL;
+    c->out_used = 0;
+    c->out_sent = 0;
+    c->out_cap = 0;
+    c->used = 0;
+    c->overflow = 0;
+    c->hung_up = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    c->prev_open = NULL;
+    c->next_open = pool->open;
+    if (pool->open) {
+        pool->open->prev_open = c;
+    }
+    pool->open = c;
+    pthread_mutex_unlock(&pool->lock);
+    return c;
+}
+
+static void close_connection(ServerPool *pool, Connection *c) {
+    pthread_mutex_lock(&pool->lock);
+    if (c->prev_open) {
+        c->prev_open->next_open = c->next_open;
+    } else {
+        pool->open = c->next_open;
+    }
+    if (c->next_open) {
+        c->next_open->prev_open = c->prev_open;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    epoll_ctl(pool->epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+    free(c->out);
+    close(c->fd);
+    free(c);
+}
+
+// Answers queued for c that the client hasn't taken yet
+static size_t backlog(const Connection *c) {
+    return c->out_used - c->out_sent;
+}
+
+// Watch c for what its next turn can do, it is reported once: input while
+// the backlog has room and the client is still sending, room in the socket
+// while answers wait
+static int arm(ServerPool *pool, Connection *c, int op) {
+    struct epoll_event event;
+    event.events = EPOLLONESHOT;
+    if (!c->hung_up && backlog(c) < SERVER_OUTPUT_LIMIT) {
+        event.events |= EPOLLIN | EPOLLRDHUP;
+    }
+    if (backlog(c) > 0) {
+        event.events |= EPOLLOUT;
+    }
+    event.data.ptr = c;
+    return epoll_ctl(pool->epoll_fd, op, c->fd, &event);
+}
+
+// Answer one complete request line
+static void answer_line(ServerWorker *worker, char *line) {
+    RouteQuery query;
+    PathResult result;
+    while (*line == ' ' || *line == '\t' || *line == '\r') {
+        line++;
+    }
+    if (*line == '\0') {
+        return;
+    }
+    if (!parse_route_query(line, &query)) {
+        writer_text(worker->writer, "error\n");
+        return;
+    }
+    INSTR_RESET();
+    find_path(worker->ws, query.start, query.end, &result);
+    writer_path(worker->writer, &result);
+    INSTR_DUMP("\"query\":\"server\",\"start\":%d,\"end\":%d,\"total\":%d",
+               result.start, result.end, result.total == INT_MAX ? -1 : result.total);
+    worker->answered++;
+}
+
+// Move what the worker's writer formatted to the end of c's answers. The
+// writer only ever formats, it is emptied after every line so it never
+// flushes to a FILE.
+static void take_output(ServerWorker *worker, Connection *c) {
+    PathWriter *w = worker->writer;
+    if (c->out_used + w->used > c->out_cap) {
+        size_t cap = c->out_cap ? c->out_cap : 4096;
+        while (cap < c->out_used + w->used) {
+            cap *= 2;
+        }
+        char *out = realloc(c->out, cap);
+        if (!out) {
+            printf("Memory allocation failed for server\n");
+            exit(EXIT_FAILURE);
+        }
+        c->out = out;
+        c->out_cap = cap;
+    }
+    memcpy(c->out + c->out_used, w->buffer, w->used);
+    c->out_used += w->used;
+    w->used = 0;
+}
+
+// Send as much of c's answers as the socket takes without blocking
+// Returns 0 if the client can't be written to any more.
+static int send_output(Connection *c) {
+    while (backlog(c) > 0) {
+        ssize_t sent = send(c->fd, c->out + c->out_sent, backlog(c), MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 1;
+        }
+        if (sent <= 0) {
+            return 0;
+        }
+        c->out_sent += sent;
+    }
+    c->out_used = 0;
+    c->out_sent = 0;
+    return 1;
+}
+
+// Answer the complete lines in c's buffer until the backlog is full, the
+// rest wait for the client to catch up
+static void answer_lines(ServerWorker *worker, Connection *c) {
+    int start = 0;
+    for (int i = 0; i < c->used && backlog(c) < SERVER_OUTPUT_LIMIT; i++) {
+        if (c->buffer[i] != '\n') {
+            continue;
+        }
+        c->buffer[i] = '\0';
+        if (c->overflow) {
+            writer_text(worker->writer, "error\n");
+            c->overflow = 0;
+        } else {
+            answer_line(worker, c->buffer + start);
+        }
+        take_output(worker, c);
+        start = i + 1;
+    }
+    memmove(c->buffer, c->buffer + start, c->used - start);
+    c->used -= start;
+    // A full buffer without a line end can't be answered
+    if (c->used == SERVER_BUFFER && !memchr(c->buffer, '\n', c->used)) {
+        c->overflow = 1;
+        c->used = 0;
+    }
+}
+
+// One turn: send what the client is ready for, then while the backlog has
+// room read what it has sent and answer every complete line. Returns 0 once
+// the client is gone or has hung up and has all its answers.
+static int serve_turn(ServerWorker *worker, Connection *c) {
+    if (!send_output(c)) {
+        return 0;
+    }
+    if (!c->hung_up && backlog(c) < SERVER_OUTPUT_LIMIT) {
+        // Lines left by a turn that filled the backlog come first
+        answer_lines(worker, c);
+    }
+    if (!c->hung_up && backlog(c) < SERVER_OUTPUT_LIMIT) {
+        ssize_t got;
+        do {
+            got = recv(c->fd, c->buffer + c->used, SERVER_BUFFER - c->used, MSG_DONTWAIT);
+        } while (got < 0 && errno == EINTR);
+        if (got == 0) {
+            c->hung_up = 1;
+        } else if (got < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            return 0;
+        } else if (got > 0) {
+            c->used += got;
+        }
+    }
+    // Answer and send until the lines run out or the client stops reading
+    do {
+        answer_lines(worker, c);
+        if (!send_output(c)) {
+            return 0;
+        }
+    } while (backlog(c) == 0 && memchr(c->buffer, '\n', c->used));
+    return !c->hung_up || backlog(c) > 0;
+}
+
+static void *server_worker(void *arg) {
+    ServerWorker *worker = arg;
+    ServerPool *pool = worker->pool;
+    Connection *c;
+    while ((c = take_ready(pool)) != NULL) {
+        if (!serve_turn(worker, c) || arm(pool, c, EPOLL_CTL_MOD) != 0) {
+            close_connection(pool, c);
+        }
+    }
+    return NULL;
+}
+
+// Creates the listening socket at path, replacing a stale one
+static int open_socket(const char *path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        printf("Socket path %s is too long\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        printf("Unable to create socket\n");
+        return -1;
+    }
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, SERVER_BACKLOG) != 0) {
+        printf("Unable to listen on %s\n", path);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+long serve(const char *path, int threads) {
+    if (threads < 1) {
+        threads = 1;
+    }
+    // Lazy preprocessing is not thread safe, get it out of the way
+    prepare_search();
+
+    int listener = open_socket(path);
+    if (listener < 0) {
+        return -1;
+    }
+    ServerPool pool;
+    pool.epoll_fd = epoll_create1(0);
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = NULL; // the listener
+    if (pool.epoll_fd < 0 || epoll_ctl(pool.epoll_fd, EPOLL_CTL_ADD, listener, &event) != 0) {
+        printf("Unable to watch %s\n", path);
+        close(listener);
+        unlink(path);
+        return -1;
+    }
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.ready, NULL);
+    pool.first_ready = NULL;
+    pool.last_ready = NULL;
+    pool.open = NULL;
+    pool.done = 0;
+
+    // Writes to a client that hung up should fail, not kill the server
+    signal(SIGPIPE, SIG_IGN);
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stop_serving;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    stopping = 0;
+
+    ServerWorker *workers = malloc(threads * sizeof(ServerWorker));
+    if (!workers) {
+        printf("Memory allocation failed for server\n");
+        exit(EXIT_FAILURE);
+    }
+    // Only the event loop should see the stop signals
+    sigset_t signals, previous;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, &previous);
+    for (int t = 0; t < threads; t++) {
+        workers[t].pool = &pool;
+        workers[t].ws = workspace_create();
+        workers[t].writer = writer_create(NULL, OUTPUT_CSV);
+        workers[t].answered = 0;
+        if (pthread_create(&workers[t].thread, NULL, server_worker, &workers[t]) != 0) {
+            printf("Unable to start server worker\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+
+    printf("Serving on %s with %d threads\n", path, threads);
+    fflush(stdout);
+    struct epoll_event events[64];
+    while (!stopping) {
+        int count = epoll_wait(pool.epoll_fd, events, 64, -1);
+        for (int i = 0; i < count; i++) {
+            Connection *c = events[i].data.ptr;
+            if (c) {
+                push_ready(&pool, c);
+                continue;
+            }
+            int fd = accept(listener, NULL, NULL);
+            if (fd < 0) {
+                continue;
+            }
+            c = open_connection(&pool, fd);
+            if (c && arm(&pool, c, EPOLL_CTL_ADD) != 0) {
+                close_connection(&pool, c);
+            }
+        }
+    }
+
+    // Stop the workers, then drop every connection still open
+    pthread_mutex_lock(&pool.lock);
+    pool.done = 1;
+    pthread_cond_broadcast(&pool.ready);
+    pthread_mutex_unlock(&pool.lock);
+    long answered = 0;
+    for (int t = 0; t < threads; t++) {
+        pthread_join(workers[t].thread, NULL);
+        workspace_free(workers[t].ws);
+        writer_free(workers[t].writer);
+        answered += workers[t].answered;
+    }
+    while (pool.open) {
+        close_connection(&pool, pool.open);
+    }
+    close(listener);
+    close(pool.epoll_fd);
+    unlink(path);
+
+    free(workers);
+    pthread_mutex_destroy(&pool.lock);
+    pthread_cond_destroy(&pool.ready);
+    printf("Answered %ld requests\n", answered);
+    return answered;
+}
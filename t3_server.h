@@ -0,0 +1,17 @@
+#ifndef T3_SERVER_H_
+#define T3_SERVER_H_
+
+// Route server on a Unix domain socket
+// Clients send "start,end" (or "start end") lines and get one
+// CSV answer per line (see t3_writer.h) back in the same order, so any number
+// of requests can be in flight on one connection. A line without two
+// numbers is answered with "error". An epoll loop watches every
+// connection and hands the ones with input to a pool of threads workers,
+// so a busy client can't hold a worker while others wait. Sockets never
+// block: answers a client isn't reading are kept for it, and its requests
+// are left unread while too many wait.
+// Runs until SIGINT or SIGTERM, returns the number of requests answered or
+// -1 if the socket couldn't be set up.
+long serve(const char *path, int threads);
+
+#endif
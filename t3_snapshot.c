@@ -0,0 +1,193 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "t3_snapshot.h"
+
+// Round a byte offset up to the next section boundary
+static uint64_t align8(uint64_t at) {
+    return (at + 7) & ~(uint64_t)7;
+}
+
+// FNV style hash taken a word at a time, the payload is a multiple of 8
+static uint64_t checksum(const unsigned char *data, uint64_t size) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (uint64_t i = 0; i < size; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        h = (h ^ word) * 0x100000001b3ull;
+        h ^= h >> 29;
+    }
+    return h;
+}
+
+int snapshot_write(const char *fname, const Graph *g, const StopTable *stops,
+                   const ContractionHierarchy *ch) {
+    SnapshotHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, SNAPSHOT_MAGIC, 8);
+    h.version = SNAPSHOT_VERSION;
+    h.endian = SNAPSHOT_ENDIAN;
+    h.num_nodes = g->num_nodes;
+    h.num_edges = g->num_edges;
+    h.num_stops = stops->count;
+    h.names_size = stops->names_size;
+    h.num_id_slots = stops->num_id_slots;
+    h.ch_arcs = ch ? ch->num_arcs : -1;
+    h.ch_shortcuts = ch ? ch->num_shortcuts : 0;
+
+    // Lay the sections out one after the other
+    uint64_t n = stops->count;
+    h.offsets_at = align8(sizeof(SnapshotHeader));
+    h.neighbors_at = align8(h.offsets_at + (uint64_t)(g->num_nodes + 1) * sizeof(int));
+    h.weights_at = align8(h.neighbors_at + (uint64_t)g->num_edges * sizeof(int));
+    h.ids_at = align8(h.weights_at + (uint64_t)g->num_edges * sizeof(int));
+    h.latitude_at = align8(h.ids_at + n * sizeof(int));
+    h.longitude_at = align8(h.latitude_at + n * sizeof(float));
+    h.name_at = align8(h.longitude_at + n * sizeof(float));
+    h.names_at = align8(h.name_at + n * sizeof(unsigned int));
+    h.id_slots_at = align8(h.names_at + stops->names_size);
+    h.file_size = align8(h.id_slots_at + (uint64_t)stops->num_id_slots * sizeof(int));
+    if (ch) {
+        uint64_t arcs = ch->num_arcs;
+        h.ch_rank_at = h.file_size;
+        h.ch_order_at = align8(h.ch_rank_at + (uint64_t)g->num_nodes * sizeof(int));
+        h.ch_offsets_at = align8(h.ch_order_at + (uint64_t)g->num_nodes * sizeof(int));
+        h.ch_targets_at = align8(h.ch_offsets_at + (uint64_t)(g->num_nodes + 1) * sizeof(int));
+        h.ch_weights_at = align8(h.ch_targets_at + arcs * sizeof(int));
+        h.ch_middle_at = align8(h.ch_weights_at + arcs * sizeof(int));
+        h.file_size = align8(h.ch_middle_at + arcs * sizeof(int));
+    }
+
+    // Build the whole file in memory so the checksum can go in the header
+    unsigned char *buf = calloc(1, h.file_size);
+    if (!buf) {
+        printf("Memory allocation failed for snapshot\n");
+        return 0;
+    }
+    memcpy(buf + h.offsets_at, g->offsets, (g->num_nodes + 1) * sizeof(int));
+    memcpy(buf + h.neighbors_at, g->neighbors, g->num_edges * sizeof(int));
+    memcpy(buf + h.weights_at, g->weights, g->num_edges * sizeof(int));
+    memcpy(buf + h.ids_at, stops->ids, n * sizeof(int));
+    memcpy(buf + h.latitude_at, stops->latitude, n * sizeof(float));
+    memcpy(buf + h.longitude_at, stops->longitude, n * sizeof(float));
+    memcpy(buf + h.name_at, stops->name, n * sizeof(unsigned int));
+    memcpy(buf + h.names_at, stops->names, stops->names_size);
+    memcpy(buf + h.id_slots_at, stops->id_slots, stops->num_id_slots * sizeof(int));
+    if (ch) {
+        memcpy(buf + h.ch_rank_at, ch->rank, g->num_nodes * sizeof(int));
+        memcpy(buf + h.ch_order_at, ch->order, g->num_nodes * sizeof(int));
+        memcpy(buf + h.ch_offsets_at, ch->offsets, (g->num_nodes + 1) * sizeof(int));
+        memcpy(buf + h.ch_targets_at, ch->targets, ch->num_arcs * sizeof(int));
+        memcpy(buf + h.ch_weights_at, ch->weights, ch->num_arcs * sizeof(int));
+        memcpy(buf + h.ch_middle_at, ch->middle, ch->num_arcs * sizeof(int));
+    }
+    h.checksum = checksum(buf + h.offsets_at, h.file_size - h.offsets_at);
+    memcpy(buf, &h, sizeof(h));
+
+    FILE *f = fopen(fname, "wb");
+    if (!f) {
+        printf("Unable to open %s\n", fname);
+        free(buf);
+        return 0;
+    }
+    int ok = fwrite(buf, 1, h.file_size, f) == h.file_size;
+    ok = (fclose(f) == 0) && ok;
+    free(buf);
+    if (!ok) {
+        printf("Failed to write %s\n", fname);
+    }
+    return ok;
+}
+
+int snapshot_map(const char *fname, Snapshot *s) {
+    memset(s, 0, sizeof(Snapshot));
+
+    int fd = open(fname, O_RDONLY);
+    if (fd < 0) {
+        printf("Unable to open %s\n", fname);
+        return 0;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(SnapshotHeader)) {
+        printf("%s is not a graph snapshot\n", fname);
+        close(fd);
+        return 0;
+    }
+    // Private and writable so update_edge can change weights without
+    // touching the file
+    void *map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        printf("Unable to map %s\n", fname);
+        return 0;
+    }
+
+    const SnapshotHeader *h = map;
+    const char *error = NULL;
+    if (memcmp(h->magic, SNAPSHOT_MAGIC, 8) != 0) {
+        error = "is not a graph snapshot";
+    } else if (h->endian != SNAPSHOT_ENDIAN) {
+        error = "was written on a machine with different byte order";
+    } else if (h->version != SNAPSHOT_VERSION) {
+        error = "was written by a different snapshot version";
+    } else if (h->file_size != (uint64_t)st.st_size ||
+               h->id_slots_at + (uint64_t)h->num_id_slots * sizeof(int) > h->file_size ||
+               (h->ch_arcs >= 0 && h->ch_middle_at + (uint64_t)h->ch_arcs * sizeof(int) > h->file_size)) {
+        error = "is truncated";
+    } else if (checksum((const unsigned char *)map + h->offsets_at, h->file_size - h->offsets_at) != h->checksum) {
+        error = "failed its checksum";
+    }
+    if (error) {
+        printf("Snapshot %s %s\n", fname, error);
+        munmap(map, st.st_size);
+        return 0;
+    }
+
+    char *base = map;
+    s->map = map;
+    s->size = st.st_size;
+    s->header = h;
+    s->offsets = (int *)(base + h->offsets_at);
+    s->neighbors = (int *)(base + h->neighbors_at);
+    s->weights = (int *)(base + h->weights_at);
+    stops_init(&s->stops);
+    s->stops.count = h->num_stops;
+    s->stops.capacity = h->num_stops;
+    s->stops.ids = (int *)(base + h->ids_at);
+    s->stops.latitude = (float *)(base + h->latitude_at);
+    s->stops.longitude = (float *)(base + h->longitude_at);
+    s->stops.name = (unsigned int *)(base + h->name_at);
+    s->stops.names = base + h->names_at;
+    s->stops.names_size = h->names_size;
+    s->stops.names_cap = h->names_size;
+    s->stops.id_slots = (int *)(base + h->id_slots_at);
+    s->stops.num_id_slots = h->num_id_slots;
+    s->stops.borrowed = 1;
+    if (h->ch_arcs >= 0) {
+        ContractionHierarchy *ch = &s->hierarchy;
+        ch->num_nodes = h->num_nodes;
+        ch->num_arcs = h->ch_arcs;
+        ch->num_shortcuts = h->ch_shortcuts;
+        ch->rank = (int *)(base + h->ch_rank_at);
+        ch->order = (int *)(base + h->ch_order_at);
+        ch->offsets = (int *)(base + h->ch_offsets_at);
+        ch->targets = (int *)(base + h->ch_targets_at);
+        ch->weights = (int *)(base + h->ch_weights_at);
+        ch->middle = (int *)(base + h->ch_middle_at);
+        ch->build_seconds = 0;
+        ch->extra_bytes = (long)(3 * ch->num_nodes + 1) * sizeof(int) + (long)ch->num_arcs * 3 * sizeof(int);
+        ch->borrowed = 1;
+    }
+    return 1;
+}
+
+void snapshot_unmap(Snapshot *s) {
+    if (s->map) {
+        munmap(s->map, s->size);
+    }
+    memset(s, 0, sizeof(Snapshot));
+}
@@ -0,0 +1,66 @@
+#ifndef T3_SNAPSHOT_H_
+#define T3_SNAPSHOT_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "t3.h"
+#include "t3_stops.h"
+#include "t3_ch.h"
+
+#define SNAPSHOT_MAGIC "BUSGRAPH"
+#define SNAPSHOT_VERSION 3
+#define SNAPSHOT_ENDIAN 0x01020304u
+
+// Fixed header at the start of a snapshot file, every section starts on an
+// 8 byte boundary and the checksum covers everything after the header
+typedef struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t endian;
+    uint64_t file_size;
+    uint64_t checksum;
+    int32_t num_nodes;
+    int32_t num_edges;
+    int32_t num_stops;
+    int32_t names_size;
+    int32_t num_id_slots;
+    int32_t ch_arcs; // -1 when no contraction hierarchy was written
+    uint64_t offsets_at;
+    uint64_t neighbors_at;
+    uint64_t weights_at;
+    uint64_t ids_at;
+    uint64_t latitude_at;
+    uint64_t longitude_at;
+    uint64_t name_at;
+    uint64_t names_at;
+    uint64_t id_slots_at;
+    // Contraction hierarchy sections, see ContractionHierarchy
+    int32_t ch_shortcuts;
+    int32_t reserved;
+    uint64_t ch_rank_at;
+    uint64_t ch_order_at;
+    uint64_t ch_offsets_at;
+    uint64_t ch_targets_at;
+    uint64_t ch_weights_at;
+    uint64_t ch_middle_at;
+} SnapshotHeader;
+
+// A mapped snapshot, the arrays point straight into the mapping
+typedef struct Snapshot {
+    void *map;
+    size_t size;
+    const SnapshotHeader *header;
+    int *offsets;
+    int *neighbors;
+    int *weights;
+    StopTable stops; // borrowed table pointing into the mapping
+    ContractionHierarchy hierarchy; // borrowed too, num_nodes is 0 if there is none
+} Snapshot;
+
+// writes the graph, stop table and ch if it is not NULL to fname, returns 0 on failure
+int snapshot_write(const char *fname, const Graph *g, const StopTable *stops,
+                   const ContractionHierarchy *ch);
+int snapshot_map(const char *fname, Snapshot *s); // maps and verifies fname, returns 0 on failure
+void snapshot_unmap(Snapshot *s); // releases the mapping
+
+#endif
@@ -0,0 +1,276 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include "t3.h"
+#include "t3_spatial.h"
+
+// Ranges this small are scanned instead of split further
+#define LEAF_SIZE 8
+
+// Position on the unit sphere
+static void to_point(double latitude, double longitude, double *p) {
+    const double to_rad = M_PI / 180.0;
+    double lat = latitude * to_rad;
+    double lon = longitude * to_rad;
+    p[0] = cos(lat) * cos(lon);
+    p[1] = cos(lat) * sin(lon);
+    p[2] = sin(lat);
+}
+
+// Squared straight line distance <-> great circle distance in metres
+static double chord_to_metres(double chord2) {
+    double half = sqrt(chord2) / 2;
+    return 2 * EARTH_RADIUS_M * asin(half < 1 ? half : 1);
+}
+
+static double metres_to_chord(double metres) {
+    double angle = metres / (2 * EARTH_RADIUS_M);
+    double chord = 2 * sin(angle < M_PI / 2 ? angle : M_PI / 2);
+    return chord * chord;
+}
+
+// Orders stops by one coordinate, ties by stop index so builds are repeatable
+static int before(const double *xyz, int axis, int a, int b) {
+    double ka = xyz[3 * a + axis];
+    double kb = xyz[3 * b + axis];
+    return ka < kb || (ka == kb && a < b);
+}
+
+// Quickselect order[lo..hi) so order[nth] is where a full sort would put it
+static void select_nth(int *order, int lo, int hi, int nth, const double *xyz, int axis) {
+    while (hi - lo > 1) {
+        int pivot = order[lo + (hi - lo) / 2];
+        int i = lo;
+        int j = hi - 1;
+        while (i <= j) {
+            while (before(xyz, axis, order[i], pivot)) {
+                i++;
+            }
+            while (before(xyz, axis, pivot, order[j])) {
+                j--;
+            }
+            if (i <= j) {
+                int t = order[i];
+                order[i++] = order[j];
+                order[j--] = t;
+            }
+        }
+        // order[lo..j] <= pivot <= order[i..hi), anything between equals it
+        if (nth <= j) {
+            hi = j + 1;
+        } else if (nth >= i) {
+            lo = i;
+        } else {
+            return;
+        }
+    }
+}
+
+// The median of order[lo..hi) becomes the root of that range, split on the
+// axis the range is widest along
+static void build_range(SpatialIndex *s, int *order, int lo, int hi, const double *xyz) {
+    while (hi - lo > LEAF_SIZE) {
+        double low[3] = { INFINITY, INFINITY, INFINITY };
+        double high[3] = { -INFINITY, -INFINITY, -INFINITY };
+        for (int i = lo; i < hi; i++) {
+            for (int a = 0; a < 3; a++) {
+                double v = xyz[3 * order[i] + a];
+                low[a] = v < low[a] ? v : low[a];
+                high[a] = v > high[a] ? v : high[a];
+            }
+        }
+        int axis = 0;
+        for (int a = 1; a < 3; a++) {
+            if (high[a] - low[a] > high[axis] - low[axis]) {
+                axis = a;
+            }
+        }
+        int mid = lo + (hi - lo) / 2;
+        select_nth(order, lo, hi, mid, xyz, axis);
+        s->axis[mid] = axis;
+        build_range(s, order, lo, mid, xyz);
+        lo = mid + 1;
+    }
+}
+
+int spatial_build(SpatialIndex *s, const float *latitude, const float *longitude, int count) {
+    s->count = 0;
+    s->stop = malloc((count ? count : 1) * sizeof(int));
+    s->point = malloc((count ? count : 1) * 3 * sizeof(double));
+    s->axis = malloc(count ? count : 1);
+    double *xyz = calloc((count ? count : 1) * 3, sizeof(double));
+    if (!s->stop || !s->point || !s->axis || !xyz) {
+        printf("Memory allocation failed for SpatialIndex\n");
+        free(xyz);
+        spatial_free(s);
+        return 0;
+    }
+
+    for (int i = 0; i < count; i++) {
+        to_point(latitude[i], longitude[i], &xyz[3 * i]);
+        s->stop[i] = i;
+    }
+    build_range(s, s->stop, 0, count, xyz);
+    // Lay the points out in tree order next to their stops
+    for (int i = 0; i < count; i++) {
+        for (int a = 0; a < 3; a++) {
+            s->point[3 * i + a] = xyz[3 * s->stop[i] + a];
+        }
+    }
+    s->count = count;
+    free(xyz);
+    return 1;
+}
+
+// State of one lookup, dist holds squared chords until the lookup is done
+typedef struct SpatialQuery {
+    double q[3];
+    double limit; // nothing further than this is wanted
+    int k; // closest stops kept
+    int found;
+    int total; // stops within limit, including ones that did not fit
+    int shrink; // prune with the kth best once k are found
+    double reach; // furthest a point may be and still matter
+    int *stops;
+    double *dist;
+} SpatialQuery;
+
+// Whether kept entry i is further than entry j, equal distances put the
+// higher index further
+static int further(const SpatialQuery *sq, int i, int j) {
+    return sq->dist[i] > sq->dist[j] || (sq->dist[i] == sq->dist[j] && sq->stops[i] > sq->stops[j]);
+}
+
+static void swap_kept(SpatialQuery *sq, int i, int j) {
+    double d = sq->dist[i];
+    int stop = sq->stops[i];
+    sq->dist[i] = sq->dist[j];
+    sq->stops[i] = sq->stops[j];
+    sq->dist[j] = d;
+    sq->stops[j] = stop;
+}
+
+// Restore the max heap of the first count kept entries below slot i
+static void sift_down_kept(SpatialQuery *sq, int i, int count) {
+    while (2 * i + 1 < count) {
+        int child = 2 * i + 1;
+        if (child + 1 < count && further(sq, child + 1, child)) {
+            child++;
+        }
+        if (!further(sq, child, i)) {
+            return;
+        }
+        swap_kept(sq, i, child);
+        i = child;
+    }
+}
+
+// Keep the k closest as a max heap with the furthest on top, so a stop that
+// makes it in costs O(log k). Only called for stops within reach.
+static void offer(SpatialQuery *sq, int stop, double d2) {
+    sq->total++;
+    if (sq->k == 0) {
+        return;
+    }
+    if (sq->found == sq->k) {
+        // Full, the new stop has to beat the current furthest one
+        if (d2 > sq->dist[0] || (d2 == sq->dist[0] && stop > sq->stops[0])) {
+            return;
+        }
+        sq->dist[0] = d2;
+        sq->stops[0] = stop;
+        sift_down_kept(sq, 0, sq->found);
+    } else {
+        int i = sq->found++;
+        sq->dist[i] = d2;
+        sq->stops[i] = stop;
+        while (i > 0 && further(sq, i, (i - 1) / 2)) {
+            swap_kept(sq, i, (i - 1) / 2);
+            i = (i - 1) / 2;
+        }
+    }
+    if (sq->shrink && sq->found == sq->k && sq->dist[0] < sq->reach) {
+        sq->reach = sq->dist[0];
+    }
+}
+
+static double squared_distance(const double *a, const double *b) {
+    double dx = a[0] - b[0];
+    double dy = a[1] - b[1];
+    double dz = a[2] - b[2];
+    return dx * dx + dy * dy + dz * dz;
+}
+
+static void search_range(const SpatialIndex *s, int lo, int hi, SpatialQuery *sq) {
+    while (hi - lo > LEAF_SIZE) {
+        int mid = lo + (hi - lo) / 2;
+        const double *p = &s->point[3 * mid];
+        double d2 = squared_distance(sq->q, p);
+        if (d2 <= sq->reach) {
+            offer(sq, s->stop[mid], d2);
+        }
+
+        // Closer half first so the bound tightens before the far half
+        double diff = sq->q[s->axis[mid]] - p[s->axis[mid]];
+        if (diff < 0) {
+            search_range(s, lo, mid, sq);
+            lo = mid + 1;
+        } else {
+            search_range(s, mid + 1, hi, sq);
+            hi = mid;
+        }
+        if (diff * diff > sq->reach) {
+            return;
+        }
+    }
+    for (int i = lo; i < hi; i++) {
+        double d2 = squared_distance(sq->q, &s->point[3 * i]);
+        if (d2 <= sq->reach) {
+            offer(sq, s->stop[i], d2);
+        }
+    }
+}
+
+// Runs a lookup and turns the kept distances into metres
+static int run_query(const SpatialIndex *s, SpatialQuery *sq, double latitude, double longitude) {
+    to_point(latitude, longitude, sq->q);
+    sq->reach = sq->limit;
+    search_range(s, 0, s->count, sq);
+    // Take the furthest off the heap one at a time, leaving them closest first
+    for (int end = sq->found - 1; end > 0; end--) {
+        swap_kept(sq, 0, end);
+        sift_down_kept(sq, 0, end);
+    }
+    for (int i = 0; i < sq->found; i++) {
+        sq->dist[i] = chord_to_metres(sq->dist[i]);
+    }
+    return sq->found;
+}
+
+int spatial_nearest(const SpatialIndex *s, double latitude, double longitude, int k, int *stops, double *metres) {
+    SpatialQuery sq = { .limit = INFINITY, .k = k, .shrink = 1, .stops = stops, .dist = metres };
+    if (k <= 0) {
+        return 0;
+    }
+    return run_query(s, &sq, latitude, longitude);
+}
+
+int spatial_within(const SpatialIndex *s, double latitude, double longitude, double radius,
+                   int *stops, double *metres, int max) {
+    SpatialQuery sq = { .limit = metres_to_chord(radius), .k = max > 0 ? max : 0, .stops = stops, .dist = metres };
+    if (radius < 0) {
+        return 0;
+    }
+    run_query(s, &sq, latitude, longitude);
+    return sq.total;
+}
+
+void spatial_free(SpatialIndex *s) {
+    free(s->stop);
+    free(s->point);
+    free(s->axis);
+    s->count = 0;
+    s->stop = NULL;
+    s->point = NULL;
+    s->axis = NULL;
+}
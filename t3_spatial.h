@@ -0,0 +1,23 @@
+#ifndef T3_SPATIAL_H_
+#define T3_SPATIAL_H_
+
+// k-d tree over the stop coordinates, used to snap a position to stops
+// Points are unit vectors on the sphere so the straight line distance
+// orders stops exactly like the great circle distance does
+typedef struct SpatialIndex {
+    int count;
+    int *stop; // stop index held by every tree slot
+    double *point; // x, y, z of every tree slot
+    unsigned char *axis; // axis every slot splits on
+} SpatialIndex;
+
+// builds the tree for count stops, returns 0 on failure
+int spatial_build(SpatialIndex *s, const float *latitude, const float *longitude, int count);
+// up to k stop indices closest first with their distance in metres, returns how many
+int spatial_nearest(const SpatialIndex *s, double latitude, double longitude, int k, int *stops, double *metres);
+// stops within radius metres closest first, writes at most max and returns how many there are in total
+int spatial_within(const SpatialIndex *s, double latitude, double longitude, double radius,
+                   int *stops, double *metres, int max);
+void spatial_free(SpatialIndex *s); // frees the tree and empties it
+
+#endif
@@ -0,0 +1,198 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <limits.h>
+#include <string.h>
+#include "t3_spt.h"
+#include "t3_delta.h"
+
+static void *spt_alloc(size_t size) {
+    void *p = malloc(size ? size : 1);
+    if (!p) {
+        printf("Memory allocation failed for ShortestPathTree\n");
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+// Adds x to the nodes whose parent the current repair has to work out again
+static void note_changed(ShortestPathTree *t, int x) {
+    if (!t->listed[x]) {
+        t->listed[x] = true;
+        t->changed[t->num_changed++] = x;
+    }
+}
+
+// Dijkstra from whatever is queued, distances only ever go down so a
+// node popped once is final and is never queued again
+static int propagate(ShortestPathTree *t, const Graph *g) {
+    int popped = 0;
+    int u;
+    while ((u = pq_pop(t->queue, NULL)) != -1) {
+        popped++;
+        note_changed(t, u);
+        for (int e = g->offsets[u]; e < g->offsets[u + 1]; e++) {
+            int v = g->neighbors[e];
+            if (t->distance[u] + g->weights[e] < t->distance[v]) {
+                t->distance[v] = t->distance[u] + g->weights[e];
+                t->parent[v] = u;
+                pq_push(t->queue, v, t->distance[v]);
+            }
+        }
+    }
+    return popped;
+}
+
+ShortestPathTree *spt_create(const Graph *g, int source, PQKind kind) {
+    int n = g->num_nodes;
+    ShortestPathTree *t = spt_alloc(sizeof(ShortestPathTree));
+    t->source = source;
+    t->num_nodes = n;
+    t->distance = spt_alloc(n * sizeof(int));
+    t->parent = spt_alloc(n * sizeof(int));
+    t->cut = spt_alloc(n * sizeof(bool));
+    t->affected = spt_alloc(n * sizeof(int));
+    t->changed = spt_alloc(n * sizeof(int));
+    t->num_changed = 0;
+    t->listed = spt_alloc(n * sizeof(bool));
+    t->queue = pq_create(kind, n);
+    if (!t->queue) {
+        printf("Memory allocation failed for ShortestPathTree\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < n; i++) {
+        t->distance[i] = INT_MAX;
+        t->parent[i] = -1;
+    }
+    memset(t->cut, 0, n * sizeof(bool));
+    memset(t->listed, 0, n * sizeof(bool));
+
+    t->distance[source] = 0;
+    pq_push(t->queue, source, 0);
+    t->repaired = propagate(t, g);
+    // Every node was just relabelled, the search settled them in the
+    // order path_tree does so the parents already follow its rule
+    for (int i = 0; i < t->num_changed; i++) {
+        t->listed[t->changed[i]] = false;
+    }
+    t->num_changed = 0;
+    return t;
+}
+
+void spt_free(ShortestPathTree *t) {
+    if (!t) {
+        return;
+    }
+    free(t->distance);
+    free(t->parent);
+    free(t->cut);
+    free(t->affected);
+    free(t->changed);
+    free(t->listed);
+    pq_free(t->queue);
+    free(t);
+}
+
+// A shorter edge can only pull the far end closer, and from there
+// whatever hangs off it
+static void repair_decrease(ShortestPathTree *t, const Graph *g, int u, int v, int weight) {
+    // Radix heaps remember the last key popped, a repair starts afresh
+    pq_clear(t->queue);
+    int ends[2] = { u, v };
+    for (int i = 0; i < 2; i++) {
+        int a = ends[i];
+        int b = ends[1 - i];
+        if (t->distance[a] != INT_MAX && t->distance[a] + weight < t->distance[b]) {
+            t->distance[b] = t->distance[a] + weight;
+            t->parent[b] = a;
+            pq_push(t->queue, b, t->distance[b]);
+        }
+    }
+    t->repaired = propagate(t, g);
+}
+
+// A longer or removed tree edge invalidates the subtree below it, every
+// node in it is relabelled from its neighbours outside the subtree and
+// Dijkstra runs from those labels. Nothing outside the subtree can change.
+static void repair_increase(ShortestPathTree *t, const Graph *g, int child) {
+    pq_clear(t->queue);
+    int count = 0;
+    t->affected[count++] = child;
+    t->cut[child] = true;
+    // Children in the tree are neighbours whose parent is the node
+    for (int i = 0; i < count; i++) {
+        int x = t->affected[i];
+        for (int e = g->offsets[x]; e < g->offsets[x + 1]; e++) {
+            int y = g->neighbors[e];
+            if (!t->cut[y] && t->parent[y] == x) {
+                t->cut[y] = true;
+                t->affected[count++] = y;
+            }
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        t->distance[t->affected[i]] = INT_MAX;
+        t->parent[t->affected[i]] = -1;
+    }
+    for (int i = 0; i < count; i++) {
+        int x = t->affected[i];
+        for (int e = g->offsets[x]; e < g->offsets[x + 1]; e++) {
+            int y = g->neighbors[e];
+            if (!t->cut[y] && t->distance[y] != INT_MAX &&
+                t->distance[y] + g->weights[e] < t->distance[x]) {
+                t->distance[x] = t->distance[y] + g->weights[e];
+                t->parent[x] = y;
+            }
+        }
+        if (t->distance[x] != INT_MAX) {
+            pq_push(t->queue, x, t->distance[x]);
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        t->cut[t->affected[i]] = false;
+        note_changed(t, t->affected[i]);
+    }
+    propagate(t, g);
+    t->repaired = count;
+}
+
+// The repairs pick whichever parent they reach first. A parent can only
+// change at a relabelled node, at a neighbour of one, or at the ends of
+// the edge that changed, so those take path_tree's rule again.
+static void fix_parents(ShortestPathTree *t, const Graph *g) {
+    int relabelled = t->num_changed;
+    for (int i = 0; i < relabelled; i++) {
+        int x = t->changed[i];
+        for (int e = g->offsets[x]; e < g->offsets[x + 1]; e++) {
+            note_changed(t, g->neighbors[e]);
+        }
+    }
+    for (int i = 0; i < t->num_changed; i++) {
+        int x = t->changed[i];
+        tree_parents(g, t->distance, t->parent, x, x + 1);
+        t->listed[x] = false;
+    }
+    t->num_changed = 0;
+}
+
+void spt_update(ShortestPathTree *t, const Graph *g, int u, int v, int old_weight, int new_weight) {
+    t->repaired = 0;
+    // A missing edge behaves like an infinitely long one
+    long old_length = old_weight ? old_weight : (long)INT_MAX + 1;
+    long new_length = new_weight ? new_weight : (long)INT_MAX + 1;
+    if (new_length < old_length) {
+        repair_decrease(t, g, u, v, new_weight);
+    } else if (new_length > old_length) {
+        // Only a tree edge matters, any other edge was not on a shortest path
+        if (t->parent[v] == u) {
+            repair_increase(t, g, v);
+        } else if (t->parent[u] == v) {
+            repair_increase(t, g, u);
+        }
+    }
+    if (new_length != old_length) {
+        note_changed(t, u);
+        note_changed(t, v);
+        fix_parents(t, g);
+    }
+}
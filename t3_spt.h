@@ -0,0 +1,31 @@
+#ifndef T3_SPT_H_
+#define T3_SPT_H_
+
+#include "t3.h"
+#include "t3_heap.h"
+
+// Shortest path tree from one source over a t3 Graph, kept correct across
+// edge weight changes by repairing only the part of the tree they affect
+// Parents follow path_tree's rule, the tight neighbour with the lowest
+// distance and then the lowest index, before and after every repair
+typedef struct ShortestPathTree {
+    int source;
+    int num_nodes;
+    int *distance; // INT_MAX for unreachable nodes
+    int *parent;   // -1 at the source and at unreachable nodes
+    bool *cut;     // nodes whose tree path went through a lengthened edge
+    int *affected; // scratch list of the cut nodes
+    int *changed;  // nodes the current repair relabelled, and their neighbours
+    int num_changed;
+    bool *listed;  // nodes already in changed
+    PQueue *queue;
+    int repaired;  // nodes the last spt_update had to look at again
+} ShortestPathTree;
+
+ShortestPathTree *spt_create(const Graph *g, int source, PQKind kind); // full Dijkstra from source
+void spt_free(ShortestPathTree *t);
+// repairs t after the edge between u and v went from old_weight to new_weight,
+// 0 meaning there is no edge, g must already hold the new weight
+void spt_update(ShortestPathTree *t, const Graph *g, int u, int v, int old_weight, int new_weight);
+
+#endif
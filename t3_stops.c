@@ -0,0 +1,162 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "t3_stops.h"
+
+static void *stops_realloc(void *p, size_t size) {
+    void *grown = realloc(p, size ? size : 1);
+    if (!grown) {
+        printf("Memory allocation failed for stop table\n");
+        exit(EXIT_FAILURE);
+    }
+    return grown;
+}
+
+// Fibonacci hashing spreads sequential stop numbers over the table
+static unsigned int hash_id(int id, int num_slots) {
+    return ((unsigned int)id * 2654435769u) & (num_slots - 1);
+}
+
+static unsigned int hash_name(const char *name, int len, int num_slots) {
+    unsigned int h = 2166136261u;
+    for (int i = 0; i < len; i++) {
+        h = (h ^ (unsigned char)name[i]) * 16777619u;
+    }
+    return h & (num_slots - 1);
+}
+
+void stops_init(StopTable *t) {
+    memset(t, 0, sizeof(StopTable));
+}
+
+// Rebuild the id hash with room for at least twice the stops
+static void grow_id_slots(StopTable *t) {
+    int num_slots = t->num_id_slots ? t->num_id_slots * 2 : 1024;
+    free(t->id_slots);
+    t->id_slots = stops_realloc(NULL, num_slots * sizeof(int));
+    t->num_id_slots = num_slots;
+    memset(t->id_slots, -1, num_slots * sizeof(int));
+    for (int i = 0; i < t->count; i++) {
+        unsigned int slot = hash_id(t->ids[i], num_slots);
+        while (t->id_slots[slot] != -1) {
+            slot = (slot + 1) & (num_slots - 1);
+        }
+        t->id_slots[slot] = i;
+    }
+}
+
+static void grow_name_slots(StopTable *t) {
+    int old_slots = t->num_name_slots;
+    int *old = t->name_slots;
+    int num_slots = old_slots ? old_slots * 2 : 1024;
+    t->name_slots = stops_realloc(NULL, num_slots * sizeof(int));
+    t->num_name_slots = num_slots;
+    memset(t->name_slots, -1, num_slots * sizeof(int));
+    for (int i = 0; i < old_slots; i++) {
+        if (old[i] == -1) {
+            continue;
+        }
+        const char *name = t->names + old[i];
+        unsigned int slot = hash_name(name, strlen(name), num_slots);
+        while (t->name_slots[slot] != -1) {
+            slot = (slot + 1) & (num_slots - 1);
+        }
+        t->name_slots[slot] = old[i];
+    }
+    free(old);
+}
+
+// Return the offset of name in the pool, adding it the first time it is seen
+static unsigned int intern_name(StopTable *t, const char *name, int len) {
+    // Keep the name hash at most half full
+    if (2 * (t->num_names + 1) > t->num_name_slots) {
+        grow_name_slots(t);
+    }
+    unsigned int slot = hash_name(name, len, t->num_name_slots);
+    while (t->name_slots[slot] != -1) {
+        const char *seen = t->names + t->name_slots[slot];
+        if (strncmp(seen, name, len) == 0 && seen[len] == '\0') {
+            return t->name_slots[slot];
+        }
+        slot = (slot + 1) & (t->num_name_slots - 1);
+    }
+
+    if (t->names_size + len + 1 > t->names_cap) {
+        int cap = t->names_cap ? t->names_cap : 4096;
+        while (t->names_size + len + 1 > cap) {
+            cap *= 2;
+        }
+        t->names = stops_realloc(t->names, cap);
+        t->names_cap = cap;
+    }
+    unsigned int offset = t->names_size;
+    memcpy(t->names + offset, name, len);
+    t->names[offset + len] = '\0';
+    t->names_size += len + 1;
+    t->name_slots[slot] = offset;
+    t->num_names++;
+    return offset;
+}
+
+int stops_find(const StopTable *t, int id) {
+    if (!t->num_id_slots) {
+        return -1;
+    }
+    unsigned int slot = hash_id(id, t->num_id_slots);
+    while (t->id_slots[slot] != -1) {
+        if (t->ids[t->id_slots[slot]] == id) {
+            return t->id_slots[slot];
+        }
+        slot = (slot + 1) & (t->num_id_slots - 1);
+    }
+    return -1;
+}
+
+int stops_add(StopTable *t, int id, const char *name, int len, float latitude, float longitude) {
+    if (t->borrowed) {
+        printf("Stop table from a snapshot can't be changed\n");
+        return -1;
+    }
+
+    // A repeated stop number replaces the earlier stop, as the old table did
+    int index = stops_find(t, id);
+    if (index == -1) {
+        if (t->count == t->capacity) {
+            int cap = t->capacity ? t->capacity * 2 : 1024;
+            t->ids = stops_realloc(t->ids, cap * sizeof(int));
+            t->latitude = stops_realloc(t->latitude, cap * sizeof(float));
+            t->longitude = stops_realloc(t->longitude, cap * sizeof(float));
+            t->name = stops_realloc(t->name, cap * sizeof(unsigned int));
+            t->capacity = cap;
+        }
+        // Keep the id hash at most half full
+        if (2 * (t->count + 1) > t->num_id_slots) {
+            grow_id_slots(t);
+        }
+        index = t->count++;
+        t->ids[index] = id;
+        unsigned int slot = hash_id(id, t->num_id_slots);
+        while (t->id_slots[slot] != -1) {
+            slot = (slot + 1) & (t->num_id_slots - 1);
+        }
+        t->id_slots[slot] = index;
+    }
+
+    t->latitude[index] = latitude;
+    t->longitude[index] = longitude;
+    t->name[index] = intern_name(t, name, len);
+    return index;
+}
+
+void stops_free(StopTable *t) {
+    if (!t->borrowed) {
+        free(t->ids);
+        free(t->latitude);
+        free(t->longitude);
+        free(t->name);
+        free(t->names);
+        free(t->id_slots);
+    }
+    free(t->name_slots);
+    stops_init(t);
+}
@@ -0,0 +1,33 @@
+#ifndef T3_STOPS_H_
+#define T3_STOPS_H_
+
+// Stop table stored as parallel arrays, stop i of the graph is entry i of
+// every array. External stop numbers can be sparse, id_slots maps them to
+// the dense index. Names are interned so repeated names are stored once.
+typedef struct StopTable {
+    int count;
+    int capacity;
+    int *ids;
+    float *latitude;
+    float *longitude;
+    unsigned int *name; // offset of the name in names
+    char *names;
+    int names_size;
+    int names_cap;
+    // Open addressing hash of stop number -> index, -1 marks a free slot
+    int *id_slots;
+    int num_id_slots; // always a power of two
+    // Hash of name -> offset used while interning, not kept in snapshots
+    int *name_slots;
+    int num_name_slots;
+    int num_names; // distinct names in the pool
+    int borrowed; // arrays belong to a snapshot mapping and are not freed
+} StopTable;
+
+void stops_init(StopTable *t); // empty table
+// adds a stop, or replaces the one with the same number, returns its index or -1 on failure
+int stops_add(StopTable *t, int id, const char *name, int len, float latitude, float longitude);
+int stops_find(const StopTable *t, int id); // index of stop number id, -1 if there is none
+void stops_free(StopTable *t); // frees the arrays and empties the table
+
+#endif
@@ -1,28 +1,349 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "t3.h"
+#include "t3_batch.h"
+#include "t3_server.h"
+#include "instrument.h"
+#include <unistd.h>
 #include <stdio.h>
 
+static void
+usage ( void ) {
+	printf("usage: ./bus VERTICES EDGES [OPTIONS]\n");
+	printf("       ./bus --snapshot SNAPSHOT [OPTIONS]\n");
+	printf("       ./bus --compile SNAPSHOT VERTICES EDGES [--engine ch]\n");
+	printf("options:\n");
+	printf("  --heap binary|4ary|radix          priority queue used by the search\n");
+	printf("  --engine dijkstra|astar|bidir|ch  search engine, --compile keeps the ch preprocessing\n");
+	printf("  --stats                           report nodes settled against plain Dijkstra\n");
+	printf("  --batch FILE                      answer start,end lines from FILE (- for stdin)\n");
+	printf("  --format text|csv|binary          how --batch writes its answers (default csv)\n");
+	printf("  --threads N                       worker threads for loading, --batch, --matrix and --server\n");
+	printf("  --server SOCKET                   answer start,end lines on a Unix socket until stopped\n");
+	printf("  --matrix SOURCES TARGETS          distance table between two lists of stops\n");
+	printf("  --full-search                     --matrix searches never stop early\n");
+	printf("  --isochrone ORIGINS BUDGET        stops within BUDGET of the nearest stop listed in ORIGINS\n");
+	printf("  --near                            ask for positions and use the nearest stops\n");
+	printf("  --nearest K                       ask for a position and list the K stops nearest it\n");
+	printf("  --within METRES                   ask for a position and list the stops within METRES of it\n");
+	printf("  --cache STOP                      keep a shortest path tree from STOP, repeatable\n");
+	printf("  --updates FILE                    apply from,to,weight edge changes before querying\n");
+	printf("  --trace FILE                      append per-query counters as JSON lines (make INSTRUMENT=1)\n");
+}
+
+// Applies every from,to,weight line of in and reports how long each took
+static void
+apply_updates ( FILE *in ) {
+	char line[256];
+	int applied = 0;
+	double total = 0, worst = 0;
+	while ( fgets( line, sizeof(line), in ) ) {
+		int from, to, weight;
+		if ( sscanf( line, "%d ,%d ,%d", &from, &to, &weight ) != 3 ) {
+			continue;
+		}
+		UpdateReport report;
+		if ( !update_edge( from, to, weight, &report ) ) {
+			printf("Edge %d-%d can't be updated\n", from, to);
+			continue;
+		}
+		printf("Edge %d-%d %d -> %d %s in %.1f us, repaired %d trees (%d nodes)\n",
+			from, to, report.old_weight, weight, report.in_place ? "in place" : "rebuilt",
+			report.seconds * 1e6, report.trees_repaired, report.nodes_repaired);
+		applied++;
+		total += report.seconds;
+		worst = report.seconds > worst ? report.seconds : worst;
+	}
+	if ( applied ) {
+		printf("Applied %d updates, mean %.1f us, max %.1f us\n", applied, total / applied * 1e6, worst * 1e6);
+	}
+}
+
 int
 main ( int argc, char *argv[] ) {
 
-	if ( argc < 3 ) {
-		printf("usage: ./bus VERTICES EDGES\n");
-		return EXIT_FAILURE;
+	char *files[2];
+	int num_files = 0;
+	char *compile_to = NULL;
+	char *snapshot = NULL;
+	int stats = 0;
+	int near = 0;
+	int nearest = 0;
+	double within = -1;
+	char *updates = NULL;
+	// Every --cache takes two arguments, so argc bounds them
+	int cached[argc];
+	int num_cached = 0;
+	char *batch = NULL;
+	OutputFormat format = OUTPUT_CSV;
+	char *server = NULL;
+	char *matrix[2] = { NULL, NULL };
+	char *origins = NULL;
+	int budget = 0;
+	int stop_early = 1;
+	int threads = (int)sysconf( _SC_NPROCESSORS_ONLN );
+	int mode = SEARCH_DIJKSTRA;
+	char *trace = NULL;
+
+	for ( int i = 1; i < argc; i++ ) {
+		if ( strcmp( argv[i], "--heap" ) == 0 && i + 1 < argc ) {
+			int kind = pq_kind_from_name( argv[++i] );
+			if ( kind < 0 ) {
+				printf("Unknown heap %s\n", argv[i]);
+				return EXIT_FAILURE;
+			}
+			set_queue_kind( kind );
+		} else if ( strcmp( argv[i], "--engine" ) == 0 && i + 1 < argc ) {
+			mode = search_mode_from_name( argv[++i] );
+			if ( mode < 0 ) {
+				printf("Unknown engine %s\n", argv[i]);
+				return EXIT_FAILURE;
+			}
+			set_search_mode( mode );
+		} else if ( strcmp( argv[i], "--stats" ) == 0 ) {
+			stats = 1;
+		} else if ( strcmp( argv[i], "--batch" ) == 0 && i + 1 < argc ) {
+			batch = argv[++i];
+		} else if ( strcmp( argv[i], "--format" ) == 0 && i + 1 < argc ) {
+			int kind = output_format_from_name( argv[++i] );
+			if ( kind < 0 ) {
+				printf("Unknown format %s\n", argv[i]);
+				return EXIT_FAILURE;
+			}
+			format = kind;
+		} else if ( strcmp( argv[i], "--server" ) == 0 && i + 1 < argc ) {
+			server = argv[++i];
+		} else if ( strcmp( argv[i], "--matrix" ) == 0 && i + 2 < argc ) {
+			matrix[0] = argv[++i];
+			matrix[1] = argv[++i];
+		} else if ( strcmp( argv[i], "--isochrone" ) == 0 && i + 2 < argc ) {
+			origins = argv[++i];
+			budget = atoi( argv[++i] );
+		} else if ( strcmp( argv[i], "--cache" ) == 0 && i + 1 < argc ) {
+			cached[num_cached++] = atoi( argv[++i] );
+		} else if ( strcmp( argv[i], "--updates" ) == 0 && i + 1 < argc ) {
+			updates = argv[++i];
+		} else if ( strcmp( argv[i], "--near" ) == 0 ) {
+			near = 1;
+		} else if ( strcmp( argv[i], "--nearest" ) == 0 && i + 1 < argc ) {
+			nearest = atoi( argv[++i] );
+		} else if ( strcmp( argv[i], "--within" ) == 0 && i + 1 < argc ) {
+			within = atof( argv[++i] );
+		} else if ( strcmp( argv[i], "--full-search" ) == 0 ) {
+			stop_early = 0;
+		} else if ( strcmp( argv[i], "--threads" ) == 0 && i + 1 < argc ) {
+			threads = atoi( argv[++i] );
+		} else if ( strcmp( argv[i], "--compile" ) == 0 && i + 1 < argc ) {
+			compile_to = argv[++i];
+		} else if ( strcmp( argv[i], "--snapshot" ) == 0 && i + 1 < argc ) {
+			snapshot = argv[++i];
+		} else if ( strcmp( argv[i], "--trace" ) == 0 && i + 1 < argc ) {
+			trace = argv[++i];
+		} else if ( argv[i][0] != '-' && num_files < 2 ) {
+			files[num_files++] = argv[i];
+		} else {
+			usage();
+			return EXIT_FAILURE;
+		}
 	}
 
-	if ( !load_vertices( argv[1] ) ) {
-		printf("Failed to load vertices\n");
-		return EXIT_FAILURE;
+	if ( trace ) {
+#ifdef INSTRUMENT
+		INSTR_OPEN( trace );
+#else
+		printf("Tracing is not compiled in, rebuild with make INSTRUMENT=1\n");
+#endif
 	}
 
-	if ( !load_edges( argv[2] ) ) {
-		printf("Failed to load edges\n");		
-		return EXIT_FAILURE;
+	set_load_threads( threads );
+	INSTR_RESET();
+	if ( snapshot ) {
+		if ( num_files > 0 || compile_to ) {
+			usage();
+			return EXIT_FAILURE;
+		}
+		if ( !load_snapshot( snapshot ) ) {
+			printf("Failed to load snapshot\n");
+			return EXIT_FAILURE;
+		}
+	} else {
+		if ( num_files < 2 ) {
+			usage();
+			return EXIT_FAILURE;
+		}
+
+		if ( !load_vertices( files[0] ) ) {
+			printf("Failed to load vertices\n");
+			return EXIT_FAILURE;
+		}
+
+		if ( !load_edges( files[1] ) ) {
+			printf("Failed to load edges\n");		
+			return EXIT_FAILURE;
+		}
 	}
+	INSTR_DUMP("\"query\":\"load\",\"stops\":%d,\"edges\":%d", num_stops(), num_edges());
 
-	
+	// Compile mode only writes the snapshot
+	if ( compile_to ) {
+		int ok = save_snapshot( compile_to );
+		if ( ok ) {
+			printf("Wrote snapshot %s\n", compile_to);
+		}
+		free_memory();
+		return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
 
+	for ( int i = 0; i < num_cached; i++ ) {
+		if ( !cache_tree( cached[i] ) ) {
+			printf("Stop %d does not exist.\n", cached[i]);
+		}
+	}
+
+	if ( updates ) {
+		FILE *in = fopen( updates, "r" );
+		if ( !in ) {
+			printf("Unable to open %s\n", updates);
+			free_memory();
+			return EXIT_FAILURE;
+		}
+		apply_updates( in );
+		fclose( in );
+	}
+
+	prepare_graph();
+
+	// Matrix mode prints the distance table and exits
+	if ( matrix[0] ) {
+		int *lists[2];
+		int counts[2];
+		for ( int k = 0; k < 2; k++ ) {
+			FILE *in = fopen( matrix[k], "r" );
+			if ( !in ) {
+				printf("Unable to open %s\n", matrix[k]);
+				free_memory();
+				return EXIT_FAILURE;
+			}
+			counts[k] = read_stop_list( in, &lists[k] );
+			fclose( in );
+		}
+		int *table = malloc( (size_t)counts[0] * counts[1] * sizeof(int) + 1 );
+		if ( !table ) {
+			printf("Memory allocation failed for distance table\n");
+			return EXIT_FAILURE;
+		}
+		distance_table( lists[0], counts[0], lists[1], counts[1], table, threads, stop_early );
+		write_distance_table( stdout, lists[0], counts[0], lists[1], counts[1], table );
+		free( table );
+		free( lists[0] );
+		free( lists[1] );
+		free_memory();
+		return EXIT_SUCCESS;
+	}
+
+	// Isochrone mode prints every stop within the budget and exits
+	if ( origins ) {
+		FILE *in = fopen( origins, "r" );
+		if ( !in ) {
+			printf("Unable to open %s\n", origins);
+			free_memory();
+			return EXIT_FAILURE;
+		}
+		int *list;
+		int count = read_stop_list( in, &list );
+		fclose( in );
+		int n = num_stops();
+		int *stop_nos = malloc( n * sizeof(int) + 1 );
+		int *distances = malloc( n * sizeof(int) + 1 );
+		if ( !stop_nos || !distances ) {
+			printf("Memory allocation failed for isochrone\n");
+			return EXIT_FAILURE;
+		}
+		SearchWorkspace *ws = workspace_create();
+		int reached = isochrone( ws, list, count, budget, stop_nos, distances, n );
+		if ( reached < 0 ) {
+			printf("None of the stops in %s exist.\n", origins);
+		} else {
+			printf("stop,distance\n");
+			for ( int i = 0; i < reached; i++ ) {
+				printf("%d,%d\n", stop_nos[i], distances[i]);
+			}
+		}
+		workspace_free( ws );
+		free( stop_nos );
+		free( distances );
+		free( list );
+		free_memory();
+		return reached < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+
+	// Stop lookup modes list the stops around one position and exit
+	if ( nearest > 0 || within >= 0 ) {
+		double position[2];
+		printf("Please enter latitude and longitude >\t");
+		if ( scanf("%lf %lf", &position[0], &position[1]) != 2 ) {
+			free_memory();
+			return EXIT_FAILURE;
+		}
+		int n = num_stops();
+		int *stop_nos = malloc( n * sizeof(int) + 1 );
+		double *metres = malloc( n * sizeof(double) + 1 );
+		if ( !stop_nos || !metres ) {
+			printf("Memory allocation failed for stop lookup\n");
+			return EXIT_FAILURE;
+		}
+		int found = nearest > 0 ? nearest_stops( position[0], position[1], nearest, stop_nos, metres )
+		                        : stops_within( position[0], position[1], within, stop_nos, metres, n );
+		printf("stop,metres\n");
+		for ( int i = 0; i < found; i++ ) {
+			printf("%d,%.1f\n", stop_nos[i], metres[i]);
+		}
+		free( stop_nos );
+		free( metres );
+		free_memory();
+		return EXIT_SUCCESS;
+	}
+
+	// Only the modes below search with the selected engine
+	prepare_search();
+
+	// Server mode answers clients until it is stopped
+	if ( server ) {
+		long answered = serve( server, threads );
+		free_memory();
+		return answered < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+
+	// Batch mode answers every query in the file instead of asking
+	if ( batch ) {
+		FILE *in = strcmp( batch, "-" ) == 0 ? stdin : fopen( batch, "r" );
+		if ( !in ) {
+			printf("Unable to open %s\n", batch);
+			free_memory();
+			return EXIT_FAILURE;
+		}
+		answer_batch( in, stdout, format, threads );
+		if ( in != stdin ) {
+			fclose( in );
+		}
+		free_memory();
+		return EXIT_SUCCESS;
+	}
+
+	// Positions are snapped to the nearest stops
+	if ( near ) {
+		double position[4];
+		printf("Please enter starting latitude and longitude >\t");
+		int ok = scanf("%lf %lf", &position[0], &position[1]) == 2;
+		printf("Please enter destination latitude and longitude >\t");
+		ok = ok && scanf("%lf %lf", &position[2], &position[3]) == 2;
+		if ( ok ) {
+			shortest_path_near( position[0], position[1], position[2], position[3] );
+		}
+		free_memory();
+		return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
 
     // get the start and end point
     printf("Please enter stating bus stop >\t\t");
@@ -33,6 +354,12 @@ main ( int argc, char *argv[] ) {
     scanf("%d", &endingNode);
 
 	shortest_path(startingNode, endingNode);
+
+	if ( stats ) {
+		int settled = last_settled();
+		int baseline = search_settled( startingNode, endingNode, SEARCH_DIJKSTRA );
+		printf("Settled %d nodes (dijkstra settles %d)\n", settled, baseline);
+	}
     
 
 	free_memory();
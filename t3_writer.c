@@ -0,0 +1,193 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <limits.h>
+#include "t3.h"
+#include "t3_writer.h"
+#include "instrument.h"
+
+// Bytes formatted before they are handed to stdio
+#define WRITER_BUFFER (1 << 20)
+// Longest number put_int writes, sign included
+#define INT_DIGITS 11
+// Room a text line needs besides the stop name
+#define TEXT_LINE 80
+
+int output_format_from_name(const char *name) {
+    if (strcmp(name, "text") == 0) {
+        return OUTPUT_TEXT;
+    }
+    if (strcmp(name, "csv") == 0) {
+        return OUTPUT_CSV;
+    }
+    if (strcmp(name, "binary") == 0) {
+        return OUTPUT_BINARY;
+    }
+    return -1;
+}
+
+PathWriter *writer_create(FILE *out, OutputFormat format) {
+    PathWriter *w = malloc(sizeof(PathWriter));
+    char *buffer = malloc(WRITER_BUFFER);
+    if (!w || !buffer) {
+        printf("Memory allocation failed for output buffer\n");
+        exit(EXIT_FAILURE);
+    }
+    w->out = out;
+    w->format = format;
+    w->buffer = buffer;
+    w->used = 0;
+    w->capacity = WRITER_BUFFER;
+    w->failed = 0;
+    return w;
+}
+
+int writer_flush(PathWriter *w) {
+    if (w->used > 0 && fwrite(w->buffer, 1, w->used, w->out) != w->used) {
+        w->failed = 1;
+    }
+    w->used = 0;
+    return !w->failed;
+}
+
+int writer_free(PathWriter *w) {
+    if (!w) {
+        return 1;
+    }
+    int ok = writer_flush(w);
+    free(w->buffer);
+    free(w);
+    return ok;
+}
+
+// Room for bytes more, flushing first if they don't fit and growing the
+// buffer if they never would
+static char *reserve(PathWriter *w, size_t bytes) {
+    if (w->used + bytes > w->capacity) {
+        writer_flush(w);
+    }
+    if (bytes > w->capacity) {
+        char *buffer = realloc(w->buffer, bytes);
+        if (!buffer) {
+            printf("Memory allocation failed for output buffer\n");
+            exit(EXIT_FAILURE);
+        }
+        w->buffer = buffer;
+        w->capacity = bytes;
+    }
+    return w->buffer + w->used;
+}
+
+// Decimal digits of v at p, returns the end, no locale or format parsing
+static char *put_int(char *p, int v) {
+    unsigned int u = v;
+    if (v < 0) {
+        *p++ = '-';
+        u = 0u - u;
+    }
+    char digits[INT_DIGITS];
+    int n = 0;
+    do {
+        digits[n++] = '0' + u % 10;
+        u /= 10;
+    } while (u);
+    while (n) {
+        *p++ = digits[--n];
+    }
+    return p;
+}
+
+static void write_csv(PathWriter *w, const PathResult *result) {
+    int found = result->total != INT_MAX;
+    int length = found ? result->length : 0;
+    char *start = reserve(w, (size_t)(length + 3) * (INT_DIGITS + 1) + 1);
+    char *p = start;
+    p = put_int(p, result->start);
+    *p++ = ',';
+    p = put_int(p, result->end);
+    *p++ = ',';
+    p = put_int(p, found ? result->total : -1);
+    *p++ = ',';
+    for (int i = 0; i < length; i++) {
+        if (i) {
+            *p++ = ' ';
+        }
+        p = put_int(p, stop_number(result->stops[i]));
+    }
+    *p++ = '\n';
+    w->used += p - start;
+}
+
+static void write_binary(PathWriter *w, const PathResult *result) {
+    int found = result->total != INT_MAX;
+    int32_t head[4] = { result->start, result->end, found ? result->total : -1, found ? result->length : 0 };
+    int32_t *p = (int32_t *)reserve(w, (4 + (size_t)head[3]) * sizeof(int32_t));
+    // The buffer position needn't be aligned, copy rather than store
+    memcpy(p, head, sizeof(head));
+    char *q = (char *)p + sizeof(head);
+    for (int i = 0; i < head[3]; i++) {
+        int32_t stop = stop_number(result->stops[i]);
+        memcpy(q, &stop, sizeof(stop));
+        q += sizeof(stop);
+    }
+    w->used += q - (char *)p;
+}
+
+// printf into the buffer, size is an upper bound on what it writes
+static void put_text(PathWriter *w, size_t size, const char *format, ...) __attribute__((format(printf, 3, 4)));
+
+static void put_text(PathWriter *w, size_t size, const char *format, ...) {
+    char *p = reserve(w, size);
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(p, size, format, args);
+    va_end(args);
+    w->used += n < 0 ? 0 : (size_t)n < size ? (size_t)n : size - 1;
+}
+
+static void write_text(PathWriter *w, const PathResult *result) {
+    // Check if there is a path
+    if (result->total == INT_MAX) {
+        put_text(w, TEXT_LINE, "No path exists between %d and %d\n", result->start, result->end);
+        return;
+    }
+
+    const char *from = stop_name(stop_index(result->start));
+    const char *to = stop_name(stop_index(result->end));
+    put_text(w, TEXT_LINE + strlen(from) + strlen(to), "Shortest path from %d (%s) to %d (%s):\n",
+             result->start, from, result->end, to);
+    for (int i = 0; i < result->length; i++) {
+        int stop = result->stops[i];
+        const char *name = stop_name(stop);
+        put_text(w, TEXT_LINE + strlen(name), "%-10d %-30s %-12.8f %-12.8f\n",
+                 stop_number(stop),
+                 name,
+                 stop_latitude(stop),
+                 stop_longitude(stop));
+    }
+    put_text(w, TEXT_LINE, "Total distance: %d\n", result->total);
+}
+
+void writer_path(PathWriter *w, const PathResult *result) {
+    INSTR_PHASE_BEGIN(PHASE_OUTPUT);
+    switch (w->format) {
+    case OUTPUT_TEXT:
+        write_text(w, result);
+        break;
+    case OUTPUT_BINARY:
+        write_binary(w, result);
+        break;
+    default:
+        write_csv(w, result);
+        break;
+    }
+    INSTR_PHASE_END(PHASE_OUTPUT);
+}
+
+void writer_text(PathWriter *w, const char *text) {
+    size_t length = strlen(text);
+    memcpy(reserve(w, length), text, length);
+    w->used += length;
+}
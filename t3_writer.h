@@ -0,0 +1,38 @@
+#ifndef T3_WRITER_H_
+#define T3_WRITER_H_
+
+#include <stdio.h>
+#include "t3.h"
+
+// Output formats for path results
+//   text    the "Shortest path from ..." listing shortest_path prints
+//   csv     one "start,end,total,stop stop ..." line per result, total -1
+//           and no stops when there is no path
+//   binary  per result the int32s start, end, total (-1 for no path) and
+//           length, then length stop numbers, all in host byte order
+typedef enum OutputFormat {
+    OUTPUT_TEXT,
+    OUTPUT_CSV,
+    OUTPUT_BINARY
+} OutputFormat;
+
+// Formats results into one large buffer and hands it to out with a single
+// fwrite when it fills up or is flushed, so stdio is locked once per buffer
+// instead of once per number. One writer per thread.
+typedef struct PathWriter {
+    FILE *out;
+    OutputFormat format;
+    char *buffer;
+    size_t used;
+    size_t capacity;
+    int failed; // a write to out has failed
+} PathWriter;
+
+int output_format_from_name(const char *name); // parses "text", "csv" or "binary", -1 if unknown
+PathWriter *writer_create(FILE *out, OutputFormat format);
+void writer_path(PathWriter *w, const PathResult *result); // appends one result in the writer's format
+void writer_text(PathWriter *w, const char *text); // appends text as it is, for replies such as "error"
+int writer_flush(PathWriter *w); // writes out everything buffered, returns 0 if a write failed
+int writer_free(PathWriter *w); // flushes and frees the writer, returns 0 if a write failed
+
+#endif